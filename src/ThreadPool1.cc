@@ -35,9 +35,12 @@ namespace Utils {
 
   void
   ThreadPool1::Worker::worker_loop() {
+    m_metrics->start();
     m_running.wait(); // wait to start the first job
     while ( m_active ) {
-      m_job();
+      m_metrics->begin_job( m_enqueue_ns );
+      m_tp->run_job( m_job );
+      m_metrics->end_job();
       m_running.red();  // job done
       m_running.wait(); // wait to start a new job
     }
@@ -82,14 +85,18 @@ namespace Utils {
   { join(); m_workers.clear(); }
 
   void
-  ThreadPool1::wait() {
+  ThreadPool1::wait_workers() {
     m_thread_to_send = 0;
     for ( auto && w : m_workers ) w.wait();
   }
 
+  void
+  ThreadPool1::wait()
+  { wait_workers(); rethrow_exception(); }
+
   void
   ThreadPool1::resize( unsigned numThreads ) {
-    wait();
+    wait_workers();
     stop();
     m_workers.resize( size_t(numThreads) );
     setup();
@@ -103,6 +110,20 @@ namespace Utils {
   ThreadPool1::stop()
   { m_thread_to_send = 0; for ( auto && w : m_workers ) w.stop(); }
 
+  void
+  ThreadPool1::metrics( tp::Metrics & m ) const {
+    ThreadPoolBase::metrics( m );
+    for ( Worker const & w : m_workers ) m.add_worker( w.metrics() );
+  }
+
+  void
+  ThreadPool1::reset_metrics()
+  { for ( Worker & w : m_workers ) w.metrics().reset(); }
+
+  void
+  ThreadPool1::info( ostream_type & s ) const
+  { metrics().print( s ); }
+
 }
 
 ///
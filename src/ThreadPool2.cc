@@ -137,6 +137,7 @@ namespace Utils {
   ThreadPool2::wait() {
     m_queue.work( true ); // Help out instead of sitting around idly.
     m_queue.wait();
+    rethrow_exception();
   }
 
   void
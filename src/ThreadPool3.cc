@@ -49,6 +49,7 @@ namespace Utils {
     //-----------------
     m_queue_spin.lock();
     m_work_queue.push( task );
+    m_queue_high_water.set_max( m_work_queue.size() );
     --m_push_waiting;
     m_queue_spin.unlock();
     //-----------------
@@ -85,26 +86,19 @@ namespace Utils {
   }
 
   void
-  ThreadPool3::worker_thread(
-    real_type & pop_ms,
-    real_type & job_ms,
-    unsigned  & n_job
-  ) {
-    TicToc tm;
+  ThreadPool3::worker_thread( tp::WorkerMetrics & wm ) {
     ++m_running_thread;
+    wm.start();
     while ( !m_done ) {
       // ---------------------------- POP
-      tm.tic();
       TaskData * task = pop_task();
-      tm.toc();
-      pop_ms += tm.elapsed_ms();
       // ---------------------------- RUN
-      tm.tic();
-      (*task)(); // run and delete task;
-      tm.toc();
-      job_ms += tm.elapsed_ms();
+      if ( m_done ) { (*task)(); --m_running_task; break; } // null task of join()
+      wm.begin_job( task->enqueue_ns() );
+      run_job( *task ); // run and delete task;
+      wm.end_job();
       // ---------------------------- UPDATE
-      --m_running_task; ++n_job;
+      --m_running_task;
     }
     --m_running_thread;
   }
@@ -113,13 +107,9 @@ namespace Utils {
   ThreadPool3::create_workers( unsigned thread_count ) {
     m_worker_threads.clear();
     m_worker_threads.reserve(thread_count);
-    m_job_ms.resize( std::size_t(thread_count) );
-    m_pop_ms.resize( std::size_t(thread_count) );
-    m_n_job.resize( std::size_t(thread_count) );
-    std::fill( m_job_ms.begin(), m_job_ms.end(), 0 );
-    std::fill( m_pop_ms.begin(), m_pop_ms.end(), 0 );
-    std::fill( m_n_job.begin(), m_n_job.end(), 0 );
-    m_push_ms      = 0;
+    m_metrics.resize( std::size_t(thread_count) );
+    for ( auto & wm : m_metrics ) wm.reset( new tp::WorkerMetrics() );
+    m_queue_high_water.reset();
     m_done         = false;
     m_push_waiting = 0;
     m_pop_waiting  = 0;
@@ -128,9 +118,7 @@ namespace Utils {
         m_worker_threads.emplace_back(
           //std::thread(
           &ThreadPool3::worker_thread, this,
-          std::ref(m_pop_ms[i]),
-          std::ref(m_job_ms[i]),
-          std::ref(m_n_job[i])
+          std::ref(*m_metrics[i])
           //)
         );
     } catch(...) {
@@ -141,7 +129,7 @@ namespace Utils {
 
   void
   ThreadPool3::join() {
-    wait();
+    wait_tasks();
     m_done = true;
     { // send null task until all the workers stopped
       std::function<void()> null_job = [](){};
@@ -163,20 +151,23 @@ namespace Utils {
   }
 
   void
-  ThreadPool3::info( ostream_type & s ) const {
-    unsigned nw = unsigned(m_pop_ms.size());
-    for ( unsigned i = 0; i < nw; ++i ) {
-      unsigned njob = m_n_job[i];
-      fmt::print( s,
-        "Worker {:2}, #job = {:4}, [job {:10}, POP {:10}]\n",
-        i, njob,
-        fmt::format( "{:.3} mus", 1000*m_job_ms[i]/njob ),
-        fmt::format( "{:.3} mus", 1000*m_pop_ms[i]/njob )
-      );
-    }
-    fmt::print( s, "PUSH {:10.6} ms\n\n", m_push_ms );
+  ThreadPool3::metrics( tp::Metrics & m ) const {
+    ThreadPoolBase::metrics( m );
+    for ( auto const & wm : m_metrics ) m.add_worker( *wm );
+    m.has_queue        = true;
+    m.queue_high_water = m_queue_high_water.get();
+  }
+
+  void
+  ThreadPool3::reset_metrics() {
+    for ( auto & wm : m_metrics ) wm->reset();
+    m_queue_high_water.reset();
   }
 
+  void
+  ThreadPool3::info( ostream_type & s ) const
+  { metrics().print( s ); }
+
 }
 
 ///
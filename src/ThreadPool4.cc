@@ -39,19 +39,15 @@ namespace Utils {
 
   void
   ThreadPool4::push_task( TaskData * task ) {
-    m_tm.tic();
-    // --------------------------
     ++m_push_waiting;
     m_work_on_queue_mutex.lock();
     m_queue_push_cv.wait( m_work_on_queue_mutex, [&]()->bool { return !m_work_queue.is_full(); } );
     m_work_queue.push( task );
+    m_queue_high_water.set_max( m_work_queue.size() );
     --m_push_waiting;
     m_work_on_queue_mutex.unlock();
     if ( m_pop_waiting > 0 ) m_queue_pop_cv.notify_one();
     if ( m_push_waiting > 0 && !m_work_queue.is_full() ) m_queue_push_cv.notify_one();
-    // --------------------------
-    m_tm.toc();
-    m_push_ms += m_tm.elapsed_ms();
   }
 
   tp::Queue::TaskData *
@@ -69,26 +65,19 @@ namespace Utils {
   }
 
   void
-  ThreadPool4::worker_thread(
-    real_type & pop_ms,
-    real_type & job_ms,
-    unsigned  & n_job
-  ) {
-    TicToc tm;
+  ThreadPool4::worker_thread( tp::WorkerMetrics & wm ) {
     ++m_running_thread;
+    wm.start();
     while ( !m_done ) {
       // ---------------------------- POP
-      tm.tic();
       TaskData * task = pop_task();
-      tm.toc();
-      pop_ms += tm.elapsed_ms();
       // ---------------------------- RUN
-      tm.tic();
-      (*task)(); // run and delete task;
-      tm.toc();
-      job_ms += tm.elapsed_ms();
+      if ( m_done ) { (*task)(); --m_running_task; break; } // null task of join()
+      wm.begin_job( task->enqueue_ns() );
+      run_job( *task ); // run and delete task;
+      wm.end_job();
       // ---------------------------- UPDATE
-      --m_running_task; ++n_job;
+      --m_running_task;
     }
     --m_running_thread;
   }
@@ -97,22 +86,16 @@ namespace Utils {
   ThreadPool4::create_workers( unsigned thread_count ) {
     m_worker_threads.clear();
     m_worker_threads.reserve(thread_count);
-    m_job_ms.resize( std::size_t(thread_count) );
-    m_pop_ms.resize( std::size_t(thread_count) );
-    m_n_job.resize( std::size_t(thread_count) );
-    std::fill( m_job_ms.begin(), m_job_ms.end(), 0 );
-    std::fill( m_pop_ms.begin(), m_pop_ms.end(), 0 );
-    std::fill( m_n_job.begin(), m_n_job.end(), 0 );
-    m_push_ms = 0;
+    m_metrics.resize( std::size_t(thread_count) );
+    for ( auto & wm : m_metrics ) wm.reset( new tp::WorkerMetrics() );
+    m_queue_high_water.reset();
     m_done    = false;
     try {
       for ( unsigned i=0; i<thread_count; ++i )
         m_worker_threads.emplace_back(
           //std::thread(
           &ThreadPool4::worker_thread, this,
-          std::ref(m_pop_ms[i]),
-          std::ref(m_job_ms[i]),
-          std::ref(m_n_job[i])
+          std::ref(*m_metrics[i])
           //)
         );
     } catch(...) {
@@ -130,12 +113,12 @@ namespace Utils {
   }
 
   void
-  ThreadPool4::wait()
+  ThreadPool4::wait_tasks()
   { while ( !m_work_queue.empty() || m_running_task > 0 ) nano_sleep(); }
 
   void
   ThreadPool4::join() {
-    this->wait(); // finish all the running task
+    this->wait_tasks(); // finish all the running task
     m_done = true;
     unsigned i = m_running_thread;
     while ( i-- > 0 ) push_task( new TaskData([](){}) );
@@ -146,20 +129,23 @@ namespace Utils {
   }
 
   void
-  ThreadPool4::info( ostream_type & s ) const {
-    unsigned nw = unsigned(m_pop_ms.size());
-    for ( unsigned i = 0; i < nw; ++i ) {
-      unsigned njob = m_n_job[i];
-      fmt::print( s,
-        "Worker {:2}, #job = {:4}, [job {:10}, POP {:10}]\n",
-        i, njob,
-        fmt::format( "{:.3} mus", 1000*m_job_ms[i]/njob ),
-        fmt::format( "{:.3} mus", 1000*m_pop_ms[i]/njob )
-      );
-    }
-    fmt::print( s, "PUSH {:10.6} ms\n\n", m_push_ms );
+  ThreadPool4::metrics( tp::Metrics & m ) const {
+    ThreadPoolBase::metrics( m );
+    for ( auto const & wm : m_metrics ) m.add_worker( *wm );
+    m.has_queue        = true;
+    m.queue_high_water = m_queue_high_water.get();
+  }
+
+  void
+  ThreadPool4::reset_metrics() {
+    for ( auto & wm : m_metrics ) wm->reset();
+    m_queue_high_water.reset();
   }
 
+  void
+  ThreadPool4::info( ostream_type & s ) const
+  { metrics().print( s ); }
+
 }
 
 ///
@@ -80,14 +80,19 @@ namespace Utils {
     s << '\n';
   }
 
+  void
+  ThreadPool5::metrics( tp::Metrics & m ) const {
+    ThreadPoolBase::metrics( m );
+    for ( Worker const & w : m_workers ) m.add_worker( w.metrics() );
+  }
+
+  void
+  ThreadPool5::reset_metrics()
+  { for ( Worker & w : m_workers ) w.metrics().reset(); }
+
   void
   ThreadPool5::info( ostream_type & s ) const {
-    for ( Worker const & w : m_workers ) w.info(s);
-    fmt::print( s,
-      "LAUNCH {} ms\n"
-      "POP    {} ms\n",
-      m_exec_ms, m_pop_ms
-    );
+    metrics().print( s );
     info_stack( s );
     fmt::print( s, "\n" );
   }
@@ -124,39 +129,22 @@ namespace Utils {
   void
   ThreadPool5::Worker::worker_loop() {
     m_is_running.red(); // block computation
+    m_metrics->start();
     while ( m_active ) {
-      m_tm.tic();
       m_is_running.wait(); // wait signal to start computation
-      m_tm.toc();
-      m_wait_ms += m_tm.elapsed_ms();
       // ----------------------------------------
       if ( !m_active ) break; // if finished exit
-      m_tm.tic();
-      m_job();
-      m_tm.toc();
-      m_job_ms += m_tm.elapsed_ms();
+      m_metrics->begin_job( m_enqueue_ns );
+      m_tp->run_job( m_job );
+      m_metrics->end_job();
       // ----------------------------------------
-      m_tm.tic();
       m_is_running.red();     // block computation
       ++m_job_done_counter;
       m_tp->push_worker( m_worker_id ); // worker ready for a new computation
-      m_tm.toc();
-      m_sync_ms += m_tm.elapsed_ms();
       std::this_thread::yield();
     }
   }
 
-  void
-  ThreadPool5::Worker::info( ostream_type & s ) const {
-    fmt::print( s,
-      "Worker {:2}, #job = {:4}, [job {:10}, sync {:10}, wait {:10}]\n",
-      m_worker_id, m_job_done_counter,
-      fmt::format( "{:.3} mus", 1000*elapsed_job_ms()/m_job_done_counter),
-      fmt::format( "{:.3} mus", 1000*elapsed_sync_ms()/m_job_done_counter),
-      fmt::format( "{:.3} mus", 1000*elapsed_wait_ms()/m_job_done_counter)
-    );
-  }
-
 }
 
 ///
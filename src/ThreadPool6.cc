@@ -0,0 +1,267 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2022                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      Via Sommarive 9, I-38123 Povo, Trento, Italy                        |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+///
+/// file: ThreadPool6.cc
+///
+
+#include "Utils.hh"
+
+namespace Utils {
+
+  ThreadPool6::ThreadPool6( unsigned max_threads, unsigned min_threads )
+  : ThreadPoolBase()
+  {
+    set_elastic( min_threads, max_threads );
+  }
+
+  ThreadPool6::~ThreadPool6() { join(); }
+
+  void
+  ThreadPool6::set_elastic(
+    unsigned  min_threads,
+    unsigned  max_threads,
+    real_type idle_timeout_ms,
+    real_type grow_latency_us
+  ) {
+    UTILS_ASSERT(
+      max_threads > 0 && min_threads <= max_threads,
+      "ThreadPool6::set_elastic( min_threads = {}, max_threads = {}, ... )\n"
+      "must be 0 <= min_threads <= max_threads and max_threads > 0\n",
+      min_threads, max_threads
+    );
+    UTILS_ASSERT(
+      idle_timeout_ms > 0 && grow_latency_us >= 0,
+      "ThreadPool6::set_elastic( ..., idle_timeout_ms = {}, grow_latency_us = {} )\n"
+      "must be idle_timeout_ms > 0 and grow_latency_us >= 0\n",
+      idle_timeout_ms, grow_latency_us
+    );
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_min_threads  = min_threads;
+      m_max_threads  = max_threads;
+      m_idle_timeout = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<real_type,std::milli>(idle_timeout_ms)
+      );
+      m_grow_latency = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<real_type,std::micro>(grow_latency_us)
+      );
+      while ( m_alive < m_min_threads ) spawn_worker();
+    }
+    // workers in excess retire when idle
+    m_worker_cv.notify_all();
+    reap_workers();
+  }
+
+  void
+  ThreadPool6::resize( unsigned numThreads ) {
+    if ( numThreads == 0 ) numThreads = 1;
+    // current parameters, read under the lock (workers read them too)
+    unsigned  min_threads;
+    real_type idle_timeout_ms, grow_latency_us;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      min_threads     = std::min( m_min_threads, numThreads );
+      idle_timeout_ms = std::chrono::duration<real_type,std::milli>(m_idle_timeout).count();
+      grow_latency_us = std::chrono::duration<real_type,std::micro>(m_grow_latency).count();
+    }
+    set_elastic( min_threads, numThreads, idle_timeout_ms, grow_latency_us );
+  }
+
+  void
+  ThreadPool6::spawn_worker() {
+    m_metrics.emplace_back( new tp::WorkerMetrics() );
+    m_threads.emplace_back( &ThreadPool6::worker_loop, this, m_metrics.back().get() );
+    ++m_alive;
+    ++m_n_spawn;
+    if ( m_alive > m_max_alive ) m_max_alive = m_alive;
+  }
+
+  void
+  ThreadPool6::reap_workers() {
+    std::vector<std::thread> to_join;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for ( std::thread::id const & id : m_retired ) {
+        auto it = std::find_if(
+          m_threads.begin(), m_threads.end(),
+          [&id]( std::thread const & t ) { return t.get_id() == id; }
+        );
+        if ( it != m_threads.end() ) {
+          to_join.emplace_back( std::move(*it) );
+          m_threads.erase( it );
+        }
+      }
+      m_retired.clear();
+    }
+    for ( std::thread & t : to_join ) if ( t.joinable() ) t.join();
+  }
+
+  void
+  ThreadPool6::exec( std::function<void()> && fun ) {
+    bool to_reap;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_queue.emplace_back( std::move(fun) );
+      if ( m_queue.size() > m_queue_high_water ) m_queue_high_water = m_queue.size();
+      // at least one worker (also when min_threads == 0 or after join)
+      while ( m_alive < std::max( m_min_threads, unsigned(1) ) ) spawn_worker();
+      if ( must_grow( m_queue.back().m_enqueued ) ) spawn_worker();
+      to_reap = !m_retired.empty();
+    }
+    m_worker_cv.notify_one();
+    if ( to_reap ) reap_workers();
+  }
+
+  void
+  ThreadPool6::worker_loop( tp::WorkerMetrics * wm ) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    wm->start();
+    while ( true ) {
+      // too many workers after a resize, leave
+      if ( m_alive > m_max_threads ) break;
+      if ( m_queue.empty() ) {
+        if ( m_shutdown ) break;
+        ++m_idle;
+        bool wake_up = m_worker_cv.wait_for(
+          lock, m_idle_timeout,
+          [this]()->bool {
+            return !m_queue.empty() || m_shutdown || m_alive > m_max_threads;
+          }
+        );
+        --m_idle;
+        // idle for too long, retire if the pool can shrink
+        if ( !wake_up && m_alive > m_min_threads ) break;
+        continue;
+      }
+      Task task( std::move(m_queue.front()) );
+      m_queue.pop_front();
+      ++m_running;
+      // a task that waited too long means the pool is saturated
+      if ( must_grow( clock::now() ) ) spawn_worker();
+      lock.unlock();
+      wm->begin_job( uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          task.m_enqueued.time_since_epoch()
+        ).count()
+      ) );
+      run_job( task.m_fun );
+      wm->end_job();
+      lock.lock();
+      --m_running;
+      if ( m_queue.empty() && m_running == 0 ) m_done_cv.notify_all();
+    }
+    --m_alive;
+    ++m_n_retire;
+    // keep the statistic of the retired worker
+    m_retired_metrics.merge( *wm );
+    m_metrics.erase( std::find_if(
+      m_metrics.begin(), m_metrics.end(),
+      [wm]( std::unique_ptr<tp::WorkerMetrics> const & p ) { return p.get() == wm; }
+    ) );
+    m_retired.emplace_back( std::this_thread::get_id() );
+    m_done_cv.notify_all();
+  }
+
+  void
+  ThreadPool6::wait() {
+    wait_tasks();
+    rethrow_exception();
+  }
+
+  void
+  ThreadPool6::wait_tasks() {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_done_cv.wait(
+        lock, [this]()->bool { return m_queue.empty() && m_running == 0; }
+      );
+    }
+    reap_workers();
+  }
+
+  void
+  ThreadPool6::join() {
+    wait_tasks();
+    std::vector<std::thread> to_join;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_shutdown = true;
+    }
+    m_worker_cv.notify_all();
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_done_cv.wait( lock, [this]()->bool { return m_alive == 0; } );
+      to_join.swap( m_threads );
+      m_retired.clear();
+      m_shutdown = false; // the pool can be used again
+    }
+    for ( std::thread & t : to_join ) if ( t.joinable() ) t.join();
+  }
+
+  unsigned
+  ThreadPool6::thread_count() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_alive;
+  }
+
+  unsigned
+  ThreadPool6::idle_count() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_idle;
+  }
+
+  void
+  ThreadPool6::metrics( tp::Metrics & m ) const {
+    ThreadPoolBase::metrics( m );
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for ( auto const & wm : m_metrics ) m.add_worker( *wm );
+    m.add_retired( m_retired_metrics );
+    m.has_queue        = true;
+    m.queue_high_water = m_queue_high_water;
+  }
+
+  void
+  ThreadPool6::reset_metrics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for ( auto & wm : m_metrics ) wm->reset();
+    m_retired_metrics.reset();
+    m_queue_high_water = 0;
+  }
+
+  void
+  ThreadPool6::info( ostream_type & s ) const {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      fmt::print( s,
+        "Workers alive {} (idle {}), min {}, max {}, peak {}\n"
+        "spawned {}, retired {}\n",
+        m_alive, m_idle, m_min_threads, m_max_threads, m_max_alive,
+        m_n_spawn, m_n_retire
+      );
+    }
+    metrics().print( s );
+  }
+
+}
+
+///
+/// eof: ThreadPool6.cc
+///
@@ -0,0 +1,214 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2022                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      Via Sommarive 9, I-38123 Povo, Trento, Italy                        |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+///
+/// file: ThreadPoolBase.cc
+///
+
+#include "Utils.hh"
+
+namespace Utils {
+
+  namespace tp {
+
+    /*\
+     |   __  __      _       _
+     |  |  \/  |___ | |_ _ _(_)__ ___
+     |  | |\/| / -_)|  _| '_| / _(_-<
+     |  |_|  |_\___| \__|_| |_\__/__/
+    \*/
+
+    void
+    Metrics::clear() {
+      name.clear();
+      n_thread = 0;
+      workers.clear();
+      retired          = WorkerStats();
+      queue_high_water = 0;
+      has_queue        = false;
+      std::fill_n( latency, Histogram::NBIN, 0 );
+    }
+
+    static
+    void
+    fill_stats( WorkerStats & ws, WorkerMetrics const & w ) {
+      ws.n_job   = w.n_job.get();
+      ws.busy_ns = w.busy_ns.get();
+      ws.idle_ns = w.idle_ns.get();
+      ws.n_steal = w.n_steal.get();
+    }
+
+    void
+    Metrics::add_worker( WorkerMetrics const & w ) {
+      WorkerStats ws;
+      fill_stats( ws, w );
+      workers.emplace_back( ws );
+      for ( unsigned k = 0; k < Histogram::NBIN; ++k ) latency[k] += w.latency.get(k);
+    }
+
+    void
+    Metrics::add_retired( WorkerMetrics const & w ) {
+      fill_stats( retired, w );
+      for ( unsigned k = 0; k < Histogram::NBIN; ++k ) latency[k] += w.latency.get(k);
+    }
+
+    uint64_t
+    Metrics::n_job() const {
+      uint64_t res = retired.n_job;
+      for ( WorkerStats const & w : workers ) res += w.n_job;
+      return res;
+    }
+
+    uint64_t
+    Metrics::busy_ns() const {
+      uint64_t res = retired.busy_ns;
+      for ( WorkerStats const & w : workers ) res += w.busy_ns;
+      return res;
+    }
+
+    uint64_t
+    Metrics::idle_ns() const {
+      uint64_t res = retired.idle_ns;
+      for ( WorkerStats const & w : workers ) res += w.idle_ns;
+      return res;
+    }
+
+    uint64_t
+    Metrics::n_steal() const {
+      uint64_t res = retired.n_steal;
+      for ( WorkerStats const & w : workers ) res += w.n_steal;
+      return res;
+    }
+
+    double
+    Metrics::latency_percentile( double p ) const {
+      uint64_t tot = 0;
+      for ( unsigned k = 0; k < Histogram::NBIN; ++k ) tot += latency[k];
+      if ( tot == 0 ) return 0;
+      double target = std::min( std::max( p, 0.0 ), 100.0 ) * double(tot) / 100;
+      uint64_t acc = 0;
+      for ( unsigned k = 0; k < Histogram::NBIN; ++k ) {
+        if ( latency[k] == 0 ) continue;
+        if ( double(acc + latency[k]) >= target ) {
+          // geometric interpolation inside the bin [2^k,2^(k+1))
+          double frac = (target - double(acc)) / double(latency[k]);
+          return std::ldexp( std::pow( 2.0, frac ), int(k) );
+        }
+        acc += latency[k];
+      }
+      return std::ldexp( 1.0, int(Histogram::NBIN) );
+    }
+
+    std::string
+    Metrics::to_json() const {
+      std::string res = fmt::format(
+        "{{\"name\":\"{}\",\"n_thread\":{},\"n_job\":{},\"busy_ns\":{},"
+        "\"idle_ns\":{},\"n_steal\":{},\"queue_high_water\":{},",
+        name, n_thread, n_job(), busy_ns(), idle_ns(), n_steal(),
+        has_queue ? fmt::format( "{}", queue_high_water ) : std::string("null")
+      );
+      res += fmt::format(
+        "\"latency_ns\":{{\"p50\":{:.0f},\"p90\":{:.0f},\"p99\":{:.0f},\"p999\":{:.0f}}},",
+        latency_percentile(50), latency_percentile(90),
+        latency_percentile(99), latency_percentile(99.9)
+      );
+      res += "\"latency_log2_hist\":[";
+      for ( unsigned k = 0; k < Histogram::NBIN; ++k )
+        res += fmt::format( k == 0 ? "{}" : ",{}", latency[k] );
+      res += "],\"workers\":[";
+      bool first = true;
+      for ( WorkerStats const & w : workers ) {
+        res += fmt::format(
+          "{}{{\"n_job\":{},\"busy_ns\":{},\"idle_ns\":{},\"n_steal\":{},\"utilization\":{:.4f}}}",
+          first ? "" : ",", w.n_job, w.busy_ns, w.idle_ns, w.n_steal, w.utilization()
+        );
+        first = false;
+      }
+      res += "]}";
+      return res;
+    }
+
+    void
+    Metrics::print( ostream_type & s ) const {
+      unsigned i = 0;
+      for ( WorkerStats const & w : workers ) {
+        fmt::print( s,
+          "Worker {:2}, #job = {:6}, busy {:10}, idle {:10}, steal {:4}, util {:5.1f}%\n",
+          i++, w.n_job,
+          fmt::format( "{:.3} ms", 1e-6*double(w.busy_ns) ),
+          fmt::format( "{:.3} ms", 1e-6*double(w.idle_ns) ),
+          w.n_steal, 100*w.utilization()
+        );
+      }
+      if ( retired.n_job > 0 )
+        fmt::print( s, "Retired workers, #job = {:6}\n", retired.n_job );
+      fmt::print( s,
+        "#job = {}, latency p50 {:.3} mus, p90 {:.3} mus, p99 {:.3} mus\n",
+        n_job(),
+        1e-3*latency_percentile(50),
+        1e-3*latency_percentile(90),
+        1e-3*latency_percentile(99)
+      );
+      if ( has_queue ) fmt::print( s, "queue high water {}\n", queue_high_water );
+      s << '\n';
+    }
+
+  }
+
+  /*\
+   |   _____       _     ___
+   |  |_   _|_ _ __| |__ / __|_ _ ___ _  _ _ __
+   |    | |/ _` (_-< / /| (_ | '_/ _ \ || | '_ \
+   |    |_|\__,_/__/_\_\ \___|_| \___/\_,_| .__/
+   |                                     |_|
+  \*/
+
+  void
+  TaskGroup::job_done( std::exception_ptr e, bool skipped ) {
+    if ( e ) m_token.cancel(); // a failed batch stop as soon as possible
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if ( e && !m_exception ) m_exception = e;
+    if ( skipped ) ++m_skipped;
+    if ( --m_pending == 0 ) m_cv.notify_all();
+  }
+
+  void
+  TaskGroup::wait() {
+    std::exception_ptr e;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait( lock, [this]()->bool { return m_pending == 0; } );
+      std::swap( e, m_exception );
+    }
+    m_token.reset(); // the group can be reused
+    if ( e ) std::rethrow_exception( e );
+  }
+
+  TaskGroup::~TaskGroup() {
+    m_token.cancel();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait( lock, [this]()->bool { return m_pending == 0; } );
+  }
+
+}
+
+///
+/// eof: ThreadPoolBase.cc
+///
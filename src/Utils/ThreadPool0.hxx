@@ -48,8 +48,8 @@ namespace Utils {
 
     virtual ~ThreadPool0() = default;
 
-    void         exec( Func && fun )  override { fun(); }
-    void         wait()               override { }
+    void         exec( Func && fun )  override { run_job( fun ); }
+    void         wait()               override { rethrow_exception(); }
     void         join()               override { }
     unsigned     thread_count() const override { return 1; }
     void         resize( unsigned )   override { }
@@ -46,11 +46,13 @@ namespace Utils {
       using real_type = double;
 
       bool                  m_active;
+      ThreadPool1 *         m_tp = nullptr;
       UTILS_SEMAPHORE       m_running;
       std::thread           m_running_thread;
       std::function<void()> m_job;
-
-      TicToc m_tm;
+      uint64_t              m_enqueue_ns = 0;
+      // on the heap: aligned storage and stable when the vector of workers grows
+      std::unique_ptr<tp::WorkerMetrics> m_metrics{ new tp::WorkerMetrics() };
 
       void worker_loop();
 
@@ -67,10 +69,15 @@ namespace Utils {
 
       Worker( Worker && rhs ) noexcept
       : m_active(rhs.m_active)
+      , m_tp(rhs.m_tp)
       , m_running_thread(std::move(rhs.m_running_thread))
       , m_job(std::move(rhs.m_job))
+      , m_enqueue_ns(rhs.m_enqueue_ns)
+      , m_metrics(std::move(rhs.m_metrics))
       {}
 
+      void set_pool( ThreadPool1 * tp ) { m_tp = tp; }
+
       void start();
       void stop();
 
@@ -81,11 +88,16 @@ namespace Utils {
 
       void
       exec( std::function<void()> & fun ) {
+        uint64_t t = tp::now_ns();
         m_running.wait_red(); // se gia occupato in task aspetta
-        m_job = fun;          // cambia funzione da eseguire
+        m_job        = fun;   // cambia funzione da eseguire
+        m_enqueue_ns = t;
         m_running.green();    // activate computation
       }
 
+      tp::WorkerMetrics const & metrics() const { return *m_metrics; }
+      tp::WorkerMetrics       & metrics()       { return *m_metrics; }
+
       std::thread::id     get_id()     const { return m_running_thread.get_id(); }
       std::thread const & get_thread() const { return m_running_thread; }
       std::thread &       get_thread()       { return m_running_thread; }
@@ -96,7 +108,8 @@ namespace Utils {
     // need to keep track of threads so we can join them
     std::vector<Worker> m_workers;
 
-    void setup() { for ( auto & w: m_workers ) w.start(); }
+    void setup() { for ( auto & w: m_workers ) { w.set_pool( this ); w.start(); } }
+    void wait_workers();
 
   public:
 
@@ -126,6 +139,11 @@ namespace Utils {
     void resize( unsigned numThreads ) override;
     char const * name() const override { return "ThreadPool1"; }
 
+    void info( ostream_type & s ) const override;
+    void metrics( tp::Metrics & m ) const override;
+    void reset_metrics() override;
+    using ThreadPoolBase::metrics;
+
     // EXTRA
     void start();
     void stop();
@@ -254,20 +254,22 @@ namespace Utils {
     void
     exec( std::function<void()> && fun ) override {
       class WrappedFunction : public VirtualTask {
+        ThreadPool2         * m_tp;
         std::function<void()> m_f;
       public:
         explicit
-        WrappedFunction( std::function<void()> && f ) : m_f(std::move(f)) { }
-        virtual void operator()() override { m_f(); delete this; }
+        WrappedFunction( ThreadPool2 * tp, std::function<void()> && f )
+        : m_tp(tp), m_f(std::move(f)) { }
+        virtual void operator()() override { m_tp->run_job( m_f ); delete this; }
       };
-      m_queue.put( new WrappedFunction( std::move(fun) ) );
+      m_queue.put( new WrappedFunction( this, std::move(fun) ) );
     }
 
     void wait() override;
 
     /**
      * Discard all tasks from the queue that have not yet started and wait for all threads to return.
-     * Also throws an exception if one of the tasks has encountered an uncatched exception.
+     * An exception thrown by a task is not rethrown here, it is kept for the next wait().
      * Leaves the pool in a shutdown state not ready to run tasks, but ready for destruction.
      */
 
@@ -277,8 +279,7 @@ namespace Utils {
      * Destroy the thread pool.
      *
      * Does the equivalent of wait() and join() before the thread pool is destructed.
-     * This means, the destructor can hang a long time and can throw an exception
-     * (unless wait() or join() have been called before the destructor).
+     * This means, the destructor can hang a long time.
      */
 
     unsigned thread_count()   const override { return unsigned(m_worker_threads.size()); }
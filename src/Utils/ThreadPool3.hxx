@@ -28,21 +28,13 @@ namespace Utils {
     // -----------------------------------------
     UTILS_SPINLOCK              m_queue_spin;
 
-    TicToc                 m_tm;
-    std::vector<real_type> m_job_ms;
-    std::vector<real_type> m_pop_ms;
-    std::vector<unsigned>  m_n_job;
-    real_type              m_push_ms;
+    std::vector<std::unique_ptr<tp::WorkerMetrics>> m_metrics;          // one for each worker
+    tp::Counter                                     m_queue_high_water; // updated in the locked part
 
     TaskData * pop_task();
     void push_task( TaskData * task );
 
-    void
-    worker_thread(
-      real_type & pop_ms,
-      real_type & job_ms,
-      unsigned  & n_job
-    );
+    void worker_thread( tp::WorkerMetrics & wm );
 
     void create_workers( unsigned thread_count );
 
@@ -57,22 +49,23 @@ namespace Utils {
     virtual ~ThreadPool3() { join(); }
 
     void
-    exec( std::function<void()> && fun ) override {
-      m_tm.tic();
-      push_task( new TaskData(std::move(fun)) );
-      m_tm.toc();
-      m_push_ms += m_tm.elapsed_ms();
-    }
+    exec( std::function<void()> && fun ) override
+    { push_task( new TaskData(std::move(fun)) ); }
 
     void
-    wait() override
+    wait_tasks()
     { while ( !m_work_queue.empty() || m_running_task > 0 ) std::this_thread::yield(); }
 
+    void wait() override { wait_tasks(); rethrow_exception(); }
+
     void join() override;
     void resize( unsigned thread_count ) override { resize( thread_count, 0 ); }
     void resize( unsigned thread_count, unsigned queue_capacity );
 
     void info( ostream_type & s ) const override;
+    void metrics( tp::Metrics & m ) const override;
+    void reset_metrics() override;
+    using ThreadPoolBase::metrics;
 
     unsigned thread_count()   const override { return unsigned(m_worker_threads.size()); }
     unsigned queue_capacity() const          { return m_work_queue.capacity(); }
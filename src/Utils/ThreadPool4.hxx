@@ -27,11 +27,8 @@ namespace Utils {
     std::atomic<unsigned>       m_push_waiting;
     // -----------------------------------------
 
-    TicToc                   m_tm;
-    std::vector<real_type>   m_job_ms;
-    std::vector<real_type>   m_pop_ms;
-    std::vector<unsigned>    m_n_job;
-    real_type                m_push_ms;
+    std::vector<std::unique_ptr<tp::WorkerMetrics>> m_metrics;          // one for each worker
+    tp::Counter                                     m_queue_high_water; // updated in the locked part
 
     inline
     void
@@ -46,12 +43,7 @@ namespace Utils {
     TaskData * pop_task();
     void push_task( TaskData * task );
 
-    void
-    worker_thread(
-      real_type & pop_ms,
-      real_type & job_ms,
-      unsigned  & n_job
-    );
+    void worker_thread( tp::WorkerMetrics & wm );
 
     void create_workers( unsigned thread_count );
 
@@ -72,10 +64,14 @@ namespace Utils {
     exec( std::function<void()> && fun ) override
     { push_task( new TaskData(std::move(fun)) ); }
 
-    void wait() override;
+    void wait_tasks();
+    void wait() override { wait_tasks(); rethrow_exception(); }
 
     void join() override;
     void info( ostream_type & s ) const override;
+    void metrics( tp::Metrics & m ) const override;
+    void reset_metrics() override;
+    using ThreadPoolBase::metrics;
 
     unsigned thread_count()   const override { return unsigned(m_worker_threads.size()); }
     unsigned queue_capacity() const          { return m_work_queue.capacity(); }
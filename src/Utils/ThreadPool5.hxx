@@ -52,10 +52,9 @@ namespace Utils {
       UTILS_SEMAPHORE       m_is_running;
       std::thread           m_running_thread;
       std::function<void()> m_job;
-      TicToc                m_tm;
-      real_type             m_job_ms  = 0;
-      real_type             m_sync_ms = 0;
-      real_type             m_wait_ms = 0;
+      uint64_t              m_enqueue_ns = 0;
+      // on the heap: aligned storage and stable when the vector of workers grows
+      std::unique_ptr<tp::WorkerMetrics> m_metrics{ new tp::WorkerMetrics() };
 
       void worker_loop();
 
@@ -64,8 +63,11 @@ namespace Utils {
       explicit Worker() { start(); }
       ~Worker() { stop(); }
 
-      // dummy copy constructor for resize
-      Worker( Worker && ) {}
+      // move constructor for resize (the workers are not running), keeps the metrics
+      Worker( Worker && rhs ) noexcept
+      : m_enqueue_ns(rhs.m_enqueue_ns)
+      , m_metrics(std::move(rhs.m_metrics))
+      {}
 
       void
       setup( ThreadPool5 * tp, unsigned id ) {
@@ -83,19 +85,17 @@ namespace Utils {
       void stop();
 
       void
-      exec( std::function<void()> & fun ) {
+      exec( std::function<void()> & fun, uint64_t enqueue_ns ) {
         m_is_running.wait_red();
-        m_job = fun;          // cambia funzione da eseguire
+        m_job        = fun;   // cambia funzione da eseguire
+        m_enqueue_ns = enqueue_ns;
         m_is_running.green(); // activate computation
       }
 
       unsigned job_done_counter() const { return m_job_done_counter; }
 
-      real_type elapsed_job_ms()  const { return m_job_ms; }
-      real_type elapsed_sync_ms() const { return m_sync_ms; }
-      real_type elapsed_wait_ms() const { return m_wait_ms; }
-
-      void info( ostream_type & s ) const;
+      tp::WorkerMetrics const & metrics() const { return *m_metrics; }
+      tp::WorkerMetrics       & metrics()       { return *m_metrics; }
     };
 
     // =========================================================================
@@ -108,9 +108,6 @@ namespace Utils {
     std::vector<unsigned>   m_stack;
     std::mutex              m_stack_mutex;
     std::condition_variable m_stack_cond;
-    TicToc                  m_tm;
-    real_type               m_exec_ms = 0;
-    real_type               m_pop_ms  = 0;
 
     void setup() { for ( auto & w: m_workers ) w.start(); }
 
@@ -131,23 +128,17 @@ namespace Utils {
 
     void
     exec( std::function<void()> && fun ) override {
+      uint64_t t = tp::now_ns();
       // cerca prima thread libera
-
-      m_tm.tic();
-      Worker & w = m_workers[pop_worker()];
-      m_tm.toc();
-      m_pop_ms += m_tm.elapsed_ms();
-
-      m_tm.tic();
-      w.exec( fun );
-      m_tm.toc();
-      m_exec_ms += m_tm.elapsed_ms();
+      m_workers[pop_worker()].exec( fun, t );
     }
 
     void
-    wait() override
+    wait_workers()
     { for ( auto & w : m_workers ) w.wait(); }
 
+    void wait() override { wait_workers(); rethrow_exception(); }
+
     void
     join() override
     { stop(); }
@@ -158,7 +149,7 @@ namespace Utils {
 
     void
     resize( unsigned numThreads ) override
-    { wait(); stop(); resize_workers( numThreads ); }
+    { wait_workers(); stop(); resize_workers( numThreads ); }
 
     char const * name() const override { return "ThreadPool5"; }
 
@@ -167,6 +158,9 @@ namespace Utils {
 
     void info_stack( ostream_type & s ) const;
     void info( ostream_type & s ) const override;
+    void metrics( tp::Metrics & m ) const override;
+    void reset_metrics() override;
+    using ThreadPoolBase::metrics;
   };
 }
 
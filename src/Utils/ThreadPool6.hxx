@@ -0,0 +1,151 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2022                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+///
+/// file: ThreadPool6.hxx
+///
+
+namespace Utils {
+
+  /*\
+   |   _____ _                        _ ____             _  __
+   |  |_   _| |__  _ __ ___  __ _  __| |  _ \ ___   ___ | |/ /_
+   |    | | | '_ \| '__/ _ \/ _` |/ _` | |_) / _ \ / _ \| | '_ \
+   |    | | | | | | | |  __/ (_| | (_| |  __/ (_) | (_) | | (_) |
+   |    |_| |_| |_|_|  \___|\__,_|\__,_|_|   \___/ \___/|_|\___/
+  \*/
+
+  //!
+  //! Elastic thread pool.
+  //!
+  //! The number of workers floats between `min_threads` and `max_threads`:
+  //! a new worker is spawned when a task waited in the queue more than
+  //! `grow_latency` and no worker is idle, an idle worker retires itself
+  //! after `idle_timeout` without jobs.
+  //! `resize` changes the number of workers without draining the queue.
+  //!
+  class ThreadPool6 : public ThreadPoolBase {
+
+    using real_type = double;
+    using clock     = std::chrono::steady_clock;
+
+    class Task {
+    public:
+      std::function<void()> m_fun;
+      clock::time_point     m_enqueued;
+
+      Task( std::function<void()> && f )
+      : m_fun(std::move(f))
+      , m_enqueued(clock::now())
+      { }
+    };
+
+    std::deque<Task>             m_queue;
+    std::vector<std::thread>     m_threads;
+    std::vector<std::thread::id> m_retired; // exited workers to be joined
+
+    mutable std::mutex      m_mutex;
+    std::condition_variable m_worker_cv; // wake up idle workers
+    std::condition_variable m_done_cv;   // wake up wait()
+
+    unsigned m_min_threads = 1;
+    unsigned m_max_threads = 1;
+    unsigned m_alive       = 0; // workers alive
+    unsigned m_idle        = 0; // workers waiting for a job
+    unsigned m_running     = 0; // jobs in execution
+    bool     m_shutdown    = false;
+
+    clock::duration m_idle_timeout;
+    clock::duration m_grow_latency;
+
+    // statistic
+    unsigned m_n_spawn   = 0;
+    unsigned m_n_retire  = 0;
+    unsigned m_max_alive = 0;
+    uint64_t m_queue_high_water = 0;
+
+    std::vector<std::unique_ptr<tp::WorkerMetrics>> m_metrics; // workers alive
+    tp::WorkerMetrics                               m_retired_metrics;
+
+    void worker_loop( tp::WorkerMetrics * wm );
+    void spawn_worker(); // must be called with m_mutex locked
+    void reap_workers();
+    void wait_tasks();
+
+    bool
+    must_grow( clock::time_point const & now ) const {
+      return m_idle == 0 &&
+             m_alive < m_max_threads &&
+             !m_queue.empty() &&
+             now - m_queue.front().m_enqueued > m_grow_latency;
+    }
+
+  public:
+
+    explicit
+    ThreadPool6(
+      unsigned max_threads = std::max(
+        unsigned(1),
+        unsigned(std::thread::hardware_concurrency()-1)
+      ),
+      unsigned min_threads = 1
+    );
+
+    virtual ~ThreadPool6();
+
+    void exec( std::function<void()> && fun ) override;
+    void wait() override;
+    void join() override;
+
+    unsigned thread_count() const override;
+    void     resize( unsigned numThreads ) override;
+
+    //!
+    //! Set the elastic behaviour of the pool.
+    //!
+    //! \param min_threads     minimum number of workers alive
+    //! \param max_threads     maximum number of workers alive
+    //! \param idle_timeout_ms an idle worker retire after this time
+    //! \param grow_latency_us spawn a worker when a task waits more than this
+    //!
+    void
+    set_elastic(
+      unsigned  min_threads,
+      unsigned  max_threads,
+      real_type idle_timeout_ms = 5000,
+      real_type grow_latency_us = 100
+    );
+
+    unsigned min_threads() const { return m_min_threads; }
+    unsigned max_threads() const { return m_max_threads; }
+    unsigned idle_count()  const;
+
+    char const * name() const override { return "ThreadPool6 (elastic)"; }
+
+    void info( ostream_type & s ) const override;
+    void metrics( tp::Metrics & m ) const override;
+    void reset_metrics() override;
+    using ThreadPoolBase::metrics;
+  };
+
+}
+
+///
+/// eof: ThreadPool6.hxx
+///
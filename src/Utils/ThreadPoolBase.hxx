@@ -23,6 +23,211 @@
 
 namespace Utils {
 
+  namespace tp {
+
+    /*\
+     |   __  __      _       _
+     |  |  \/  |___ | |_ _ _(_)__ ___
+     |  | |\/| / -_)|  _| '_| / _(_-<
+     |  |_|  |_\___| \__|_| |_\__/__/
+    \*/
+
+    //!
+    //! Time stamp in nanoseconds (steady clock)
+    //!
+    inline
+    uint64_t
+    now_ns() {
+      return uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()
+        ).count()
+      );
+    }
+
+    //!
+    //! Counter with a single writer that can be read concurrently.
+    //! The update is a plain load/store, no locked instruction is used.
+    //!
+    class Counter {
+      std::atomic<uint64_t> m_value{0};
+    public:
+      void
+      add( uint64_t v ) {
+        m_value.store( m_value.load(std::memory_order_relaxed) + v, std::memory_order_relaxed );
+      }
+
+      void
+      set_max( uint64_t v ) {
+        if ( v > m_value.load(std::memory_order_relaxed) )
+          m_value.store( v, std::memory_order_relaxed );
+      }
+
+      uint64_t get()   const { return m_value.load(std::memory_order_relaxed); }
+      void     reset()       { m_value.store( 0, std::memory_order_relaxed ); }
+    };
+
+    //!
+    //! Histogram of latencies with power of 2 bins,
+    //! bin `k` counts the latencies in `[2^k,2^(k+1))` nanoseconds.
+    //!
+    class Histogram {
+    public:
+      static unsigned const NBIN = 40;
+
+      static
+      unsigned
+      bin( uint64_t ns ) {
+        if ( ns < 2 ) return 0;
+        #if defined(__GNUC__) || defined(__clang__)
+        unsigned k = unsigned(63 - __builtin_clzll(ns));
+        #else
+        unsigned k = 0;
+        while ( ns > 1 ) { ns >>= 1; ++k; }
+        #endif
+        return k < NBIN ? k : NBIN-1;
+      }
+
+      void     add( uint64_t ns )       { m_bin[bin(ns)].add(1); }
+      uint64_t get( unsigned k )  const { return m_bin[k].get(); }
+      void     reset()                  { for ( Counter & c : m_bin ) c.reset(); }
+
+      void
+      merge( Histogram const & h )
+      { for ( unsigned k = 0; k < NBIN; ++k ) m_bin[k].add( h.get(k) ); }
+
+    private:
+      Counter m_bin[NBIN];
+    };
+
+    //!
+    //! Snapshot of the statistic of a worker
+    //!
+    class WorkerStats {
+    public:
+      uint64_t n_job   = 0; //!< number of tasks executed
+      uint64_t busy_ns = 0; //!< time spent running tasks
+      uint64_t idle_ns = 0; //!< time spent waiting for tasks
+      uint64_t n_steal = 0; //!< tasks taken from other workers
+
+      //! fraction of time spent running tasks
+      double
+      utilization() const {
+        uint64_t tot = busy_ns + idle_ns;
+        return tot > 0 ? double(busy_ns)/double(tot) : 0;
+      }
+    };
+
+    //!
+    //! Statistic of a worker, updated only by the worker thread.
+    //!
+    class alignas(64) WorkerMetrics {
+      uint64_t m_last_ns = 0; // end of the last job (private to the worker)
+    public:
+      Counter   n_job;
+      Counter   busy_ns;
+      Counter   idle_ns;
+      Counter   n_steal;
+      Histogram latency; //!< enqueue to start latency
+
+      //!
+      //! Aligned allocation: before C++17 a plain `new` does not honour
+      //! `alignas(64)`.  The block is over-allocated, the original pointer
+      //! is stored just before the aligned one.
+      //!
+      static
+      void *
+      operator new( std::size_t n ) {
+        void * raw = std::malloc( n + 64 );
+        if ( raw == nullptr ) throw std::bad_alloc();
+        std::uintptr_t a = ( reinterpret_cast<std::uintptr_t>(raw) + 64 ) & ~std::uintptr_t(63);
+        void * p = reinterpret_cast<void*>( a );
+        static_cast<void**>(p)[-1] = raw;
+        return p;
+      }
+
+      static
+      void
+      operator delete( void * p ) noexcept
+      { if ( p != nullptr ) std::free( static_cast<void**>(p)[-1] ); }
+
+      //! worker is starting, open idle period
+      void start() { m_last_ns = now_ns(); }
+
+      //! job taken, close idle period and record latency
+      void
+      begin_job( uint64_t enqueue_ns ) {
+        uint64_t t = now_ns();
+        idle_ns.add( t - m_last_ns );
+        latency.add( t > enqueue_ns ? t - enqueue_ns : 0 );
+        m_last_ns = t;
+      }
+
+      //! job done, close busy period
+      void
+      end_job() {
+        uint64_t t = now_ns();
+        busy_ns.add( t - m_last_ns );
+        n_job.add(1);
+        m_last_ns = t;
+      }
+
+      //! accumulate the statistic of another worker (e.g. a retired one)
+      void
+      merge( WorkerMetrics const & w ) {
+        n_job.add( w.n_job.get() );
+        busy_ns.add( w.busy_ns.get() );
+        idle_ns.add( w.idle_ns.get() );
+        n_steal.add( w.n_steal.get() );
+        latency.merge( w.latency );
+      }
+
+      //! to be called when the pool is idle
+      void
+      reset() {
+        n_job.reset(); busy_ns.reset(); idle_ns.reset(); n_steal.reset();
+        latency.reset();
+        m_last_ns = now_ns();
+      }
+    };
+
+    //!
+    //! Snapshot of the runtime statistic of a thread pool.
+    //!
+    class Metrics {
+    public:
+      std::string              name;
+      unsigned                 n_thread = 0;
+      std::vector<WorkerStats> workers;
+      uint64_t                 latency[Histogram::NBIN]; //!< enqueue to start (log2 ns bins)
+      WorkerStats              retired;                  //!< workers no longer alive
+      uint64_t                 queue_high_water = 0;     //!< max number of queued tasks
+      bool                     has_queue        = false; //!< queue_high_water is meaningful
+
+      Metrics() { clear(); }
+
+      void clear();
+
+      //! add worker statistic to the snapshot
+      void add_worker( WorkerMetrics const & w );
+
+      //! add statistic of a retired worker (only to the totals)
+      void add_retired( WorkerMetrics const & w );
+
+      uint64_t n_job()   const;
+      uint64_t busy_ns() const;
+      uint64_t idle_ns() const;
+      uint64_t n_steal() const;
+
+      //! percentile `p` in [0,100] of enqueue to start latency (nanoseconds)
+      double latency_percentile( double p ) const;
+
+      std::string to_json() const;
+      void        print( ostream_type & s ) const;
+    };
+
+  }
+
   /*\
    |   _____ _                    _ ___          _ ___
    |  |_   _| |_  _ _ ___ __ _ __| | _ \___  ___| | _ ) __ _ ___ ___
@@ -32,6 +237,37 @@ namespace Utils {
 
   class ThreadPoolBase {
 
+    std::mutex         m_exception_mutex;
+    std::exception_ptr m_exception; // first exception thrown by a job
+
+  protected:
+
+    //! keep the first exception, the others are discarded
+    void
+    save_exception( std::exception_ptr e ) noexcept {
+      std::lock_guard<std::mutex> lock(m_exception_mutex);
+      if ( !m_exception ) m_exception = e;
+    }
+
+    //! run a job, an exception escaping the job is kept for `wait()`
+    template <typename Job>
+    void
+    run_job( Job & job ) noexcept {
+      try { job(); }
+      catch (...) { save_exception( std::current_exception() ); }
+    }
+
+    //! rethrow (and clear) the exception kept by `run_job`
+    void
+    rethrow_exception() {
+      std::exception_ptr e;
+      {
+        std::lock_guard<std::mutex> lock(m_exception_mutex);
+        std::swap( e, m_exception );
+      }
+      if ( e ) std::rethrow_exception( e );
+    }
+
   public:
 
     //disable copy
@@ -57,12 +293,129 @@ namespace Utils {
       );
     }
 
+    //!
+    //! Wait all the submitted jobs are done.
+    //! If some job throws, the first exception is rethrown here.
+    //!
     virtual void         wait() = 0;
+    //!
+    //! Wait the jobs and stop the workers (exceptions are not rethrown).
+    //!
     virtual void         join() = 0;
     virtual unsigned     thread_count() const = 0;
     virtual void         resize( unsigned numThreads ) = 0;
     virtual char const * name() const = 0;
     virtual void         info( ostream_type & ) const { }
+
+    //!
+    //! Fill a snapshot of the runtime statistic of the pool.
+    //! The default fill only name and number of threads.
+    //!
+    virtual
+    void
+    metrics( tp::Metrics & m ) const {
+      m.clear();
+      m.name     = this->name();
+      m.n_thread = this->thread_count();
+    }
+
+    tp::Metrics
+    metrics() const
+    { tp::Metrics m; this->metrics( m ); return m; }
+
+    //!
+    //! Reset the runtime statistic, to be called when the pool is idle.
+    //!
+    virtual void reset_metrics() { }
+  };
+
+  namespace tp {
+
+    //!
+    //! Cooperative cancellation flag, copies share the same state.
+    //! Long jobs can poll `cancelled()` to stop early.
+    //!
+    class CancelToken {
+      std::shared_ptr<std::atomic<bool>> m_flag;
+    public:
+      CancelToken() : m_flag( std::make_shared<std::atomic<bool>>(false) ) {}
+
+      void cancel()          const { m_flag->store( true, std::memory_order_relaxed ); }
+      bool cancelled() const       { return m_flag->load( std::memory_order_relaxed ); }
+      void reset()           const { m_flag->store( false, std::memory_order_relaxed ); }
+    };
+
+  }
+
+  /*\
+   |   _____       _     ___
+   |  |_   _|_ _ __| |__ / __|_ _ ___ _  _ _ __
+   |    | |/ _` (_-< / /| (_ | '_/ _ \ || | '_ \
+   |    |_|\__,_/__/_\_\ \___|_| \___/\_,_| .__/
+   |                                     |_|
+  \*/
+
+  //!
+  //! A batch of jobs submitted to a pool and waited together.
+  //!
+  //! The first exception thrown by a job cancels the group: the jobs not
+  //! yet started are skipped and `wait()` rethrows the exception.
+  //! `wait()` must be called from a thread not belonging to the pool.
+  //!
+  class TaskGroup {
+    ThreadPoolBase        & m_pool;
+    tp::CancelToken         m_token;
+    mutable std::mutex      m_mutex;
+    std::condition_variable m_cv;
+    unsigned                m_pending = 0;
+    unsigned long           m_skipped = 0;
+    std::exception_ptr      m_exception;
+
+    void job_done( std::exception_ptr e, bool skipped );
+
+  public:
+
+    TaskGroup( TaskGroup const & )               = delete;
+    TaskGroup & operator = ( TaskGroup const & ) = delete;
+
+    explicit TaskGroup( ThreadPoolBase & pool ) : m_pool(pool) {}
+
+    //! cancel the jobs not started and wait the running ones
+    ~TaskGroup();
+
+    template <typename Func, typename... Args>
+    void
+    run( Func && func, Args && ... args ) {
+      std::function<void()> job = std::bind( std::forward<Func>(func), std::forward<Args>(args)... );
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_pending;
+      }
+      m_pool.exec( [this,job]() {
+        if ( m_token.cancelled() ) { job_done( nullptr, true ); return; }
+        std::exception_ptr e;
+        try { job(); } catch (...) { e = std::current_exception(); }
+        job_done( e, false );
+      } );
+    }
+
+    //! wait the jobs of the group and rethrow the first exception
+    void wait();
+
+    //! skip the jobs not yet started
+    void cancel() { m_token.cancel(); }
+
+    bool cancelled() const { return m_token.cancelled(); }
+
+    //! token to poll inside long jobs
+    tp::CancelToken const & token() const { return m_token; }
+
+    //! number of jobs skipped because of cancellation
+    unsigned long
+    skipped() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_skipped;
+    }
   };
 
   namespace tp {
@@ -80,10 +433,12 @@ namespace Utils {
 
       class TaskData {
         std::function<void()> m_fun;
+        uint64_t              m_enqueue_ns;
       public:
-        TaskData( std::function<void()> && f ) : m_fun(std::move(f)) { }
-        TaskData( std::function<void()> & f ) : m_fun(f) { }
-        void operator()() { m_fun(); delete this; }
+        TaskData( std::function<void()> && f ) : m_fun(std::move(f)), m_enqueue_ns(now_ns()) { }
+        TaskData( std::function<void()> & f ) : m_fun(f), m_enqueue_ns(now_ns()) { }
+        void operator()() { std::unique_ptr<TaskData> self(this); m_fun(); } // run and delete
+        uint64_t enqueue_ns() const { return m_enqueue_ns; }
         ~TaskData() = default;
       };
 
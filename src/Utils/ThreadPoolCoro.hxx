@@ -0,0 +1,383 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2022                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+///
+/// file: ThreadPoolCoro.hxx
+///
+
+#ifdef UTILS_HAS_COROUTINES
+
+namespace Utils {
+
+  namespace coro {
+
+    //!
+    //! Awaitable that resumes the coroutine on a worker of `pool`:
+    //!
+    //! \code
+    //! co_await schedule_on( pool );
+    //! // from here the coroutine runs on the pool
+    //! \endcode
+    //!
+    //! Coroutines running on the pool submit new work from the workers,
+    //! so `exec()` must not block when called by a worker: use pools with
+    //! an unbounded queue (ThreadPool0, 2, 6) or a queue large enough
+    //! (ThreadPool3). ThreadPool4 (small bounded queue), ThreadPool5
+    //! (waits for a free worker) and ThreadPool1 (exec not thread safe)
+    //! may deadlock.
+    //!
+    class schedule_on {
+      ThreadPoolBase & m_pool;
+    public:
+      explicit schedule_on( ThreadPoolBase & pool ) : m_pool(pool) {}
+
+      bool await_ready() const noexcept { return false; }
+      void await_suspend( std::coroutine_handle<> h ) { m_pool.exec( [h]() { h.resume(); } ); }
+      void await_resume() const noexcept {}
+    };
+
+    template <typename T> class task;
+
+    namespace detail {
+
+      class promise_base {
+      public:
+        std::coroutine_handle<> m_continuation{ std::noop_coroutine() };
+        std::exception_ptr      m_exception;
+
+        // resume the awaiting coroutine when done
+        class final_awaiter {
+        public:
+          bool await_ready() const noexcept { return false; }
+
+          template <typename P>
+          std::coroutine_handle<>
+          await_suspend( std::coroutine_handle<P> h ) noexcept
+          { return h.promise().m_continuation; }
+
+          void await_resume() const noexcept {}
+        };
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        final_awaiter       final_suspend()   const noexcept { return {}; }
+
+        void unhandled_exception() noexcept { m_exception = std::current_exception(); }
+
+        void
+        rethrow_if_failed() const
+        { if ( m_exception ) std::rethrow_exception( m_exception ); }
+      };
+
+      template <typename T>
+      class promise : public promise_base {
+        std::optional<T> m_value;
+      public:
+        task<T> get_return_object() noexcept;
+
+        template <typename V>
+        void return_value( V && v ) { m_value.emplace( std::forward<V>(v) ); }
+
+        T result() { rethrow_if_failed(); return std::move( *m_value ); }
+      };
+
+      template <>
+      class promise<void> : public promise_base {
+      public:
+        task<void> get_return_object() noexcept;
+
+        void return_void() const noexcept {}
+        void result() const { rethrow_if_failed(); }
+      };
+
+    }
+
+    /*\
+     |   _            _
+     |  | |_ __ _ ___| |__
+     |  |  _/ _` (_-<| / /
+     |   \__\__,_/__/|_\_\
+    \*/
+
+    //!
+    //! Lazy coroutine returning a `T`.
+    //!
+    //! The body starts when the task is awaited and the awaiting coroutine
+    //! is resumed, on the thread that completed the task, without blocking.
+    //! Exceptions thrown by the body are rethrown by `co_await`.
+    //!
+    template <typename T = void>
+    class task {
+    public:
+      using promise_type = detail::promise<T>;
+      using handle_type  = std::coroutine_handle<promise_type>;
+
+    private:
+      handle_type m_handle;
+
+      class awaiter_base {
+      protected:
+        handle_type m_handle;
+      public:
+        explicit awaiter_base( handle_type h ) noexcept : m_handle(h) {}
+
+        bool await_ready() const noexcept { return !m_handle || m_handle.done(); }
+
+        std::coroutine_handle<>
+        await_suspend( std::coroutine_handle<> awaiting ) noexcept {
+          m_handle.promise().m_continuation = awaiting;
+          return m_handle; // start the task
+        }
+      };
+
+    public:
+
+      task( task const & )              = delete;
+      task & operator = ( task const & ) = delete;
+
+      explicit task( handle_type h ) noexcept : m_handle(h) {}
+
+      task( task && t ) noexcept : m_handle(t.m_handle) { t.m_handle = nullptr; }
+
+      task &
+      operator = ( task && t ) noexcept {
+        if ( this != &t ) {
+          if ( m_handle ) m_handle.destroy();
+          m_handle   = t.m_handle;
+          t.m_handle = nullptr;
+        }
+        return *this;
+      }
+
+      ~task() { if ( m_handle ) m_handle.destroy(); }
+
+      bool done() const noexcept { return !m_handle || m_handle.done(); }
+
+      //! result of a completed task (rethrow its exception)
+      T get() { return m_handle.promise().result(); }
+
+      auto
+      operator co_await() & noexcept {
+        class awaiter : public awaiter_base {
+        public:
+          using awaiter_base::awaiter_base;
+          T await_resume() { return this->m_handle.promise().result(); }
+        };
+        return awaiter{ m_handle };
+      }
+
+      auto
+      operator co_await() && noexcept {
+        class awaiter : public awaiter_base {
+        public:
+          using awaiter_base::awaiter_base;
+          T await_resume() { return this->m_handle.promise().result(); }
+        };
+        return awaiter{ m_handle };
+      }
+
+      //! await completion without retrieving the result
+      auto
+      when_ready() noexcept {
+        class awaiter : public awaiter_base {
+        public:
+          using awaiter_base::awaiter_base;
+          void await_resume() const noexcept {}
+        };
+        return awaiter{ m_handle };
+      }
+    };
+
+    namespace detail {
+
+      template <typename T>
+      inline
+      task<T>
+      promise<T>::get_return_object() noexcept
+      { return task<T>{ std::coroutine_handle<promise<T>>::from_promise(*this) }; }
+
+      inline
+      task<void>
+      promise<void>::get_return_object() noexcept
+      { return task<void>{ std::coroutine_handle<promise<void>>::from_promise(*this) }; }
+
+      //
+      // Eager coroutine that runs `body` and calls `on_done(state)` at the end.
+      // The frame is kept alive until the owner is destroyed.
+      //
+      template <typename State>
+      class notifier {
+      public:
+        class promise_type {
+        public:
+          State * m_state = nullptr;
+
+          class final_awaiter {
+          public:
+            bool await_ready() const noexcept { return false; }
+
+            std::coroutine_handle<>
+            await_suspend( std::coroutine_handle<promise_type> h ) noexcept
+            { return h.promise().m_state->on_done(); }
+
+            void await_resume() const noexcept {}
+          };
+
+          notifier
+          get_return_object() noexcept
+          { return notifier{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+
+          std::suspend_always initial_suspend() const noexcept { return {}; }
+          final_awaiter       final_suspend()   const noexcept { return {}; }
+
+          void return_void() const noexcept {}
+          void unhandled_exception() const noexcept { std::terminate(); }
+        };
+
+        using handle_type = std::coroutine_handle<promise_type>;
+
+        explicit notifier( handle_type h ) noexcept : m_handle(h) {}
+        notifier( notifier && n ) noexcept : m_handle(n.m_handle) { n.m_handle = nullptr; }
+        notifier( notifier const & ) = delete;
+        ~notifier() { if ( m_handle ) m_handle.destroy(); }
+
+        void start( State & s ) { m_handle.promise().m_state = &s; m_handle.resume(); }
+
+      private:
+        handle_type m_handle;
+      };
+
+      // completion counter of when_all
+      class when_all_state {
+      public:
+        std::atomic<std::size_t> m_count;
+        std::coroutine_handle<>  m_awaiting;
+
+        explicit when_all_state( std::size_t n ) : m_count(n+1) {}
+
+        // the last to finish resume the awaiting coroutine
+        std::coroutine_handle<>
+        on_done() noexcept {
+          if ( m_count.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) return m_awaiting;
+          return std::noop_coroutine();
+        }
+      };
+
+      template <typename T>
+      notifier<when_all_state>
+      when_all_wrap( task<T> & t )
+      { co_await t.when_ready(); }
+
+      template <typename T>
+      class when_all_awaiter {
+        std::vector<task<T>>                   & m_tasks;
+        std::vector<notifier<when_all_state>>    m_wrap;
+        when_all_state                           m_state;
+      public:
+        explicit
+        when_all_awaiter( std::vector<task<T>> & tasks )
+        : m_tasks(tasks)
+        , m_state(tasks.size())
+        {
+          m_wrap.reserve( tasks.size() );
+          for ( task<T> & t : tasks ) m_wrap.emplace_back( when_all_wrap( t ) );
+        }
+
+        bool await_ready() const noexcept { return m_tasks.empty(); }
+
+        bool
+        await_suspend( std::coroutine_handle<> h ) {
+          m_state.m_awaiting = h;
+          for ( auto & w : m_wrap ) w.start( m_state );
+          // false: all the tasks completed synchronously, continue
+          return m_state.m_count.fetch_sub( 1, std::memory_order_acq_rel ) != 1;
+        }
+
+        void await_resume() const noexcept {}
+      };
+
+      // completion flag of sync_wait
+      class sync_state {
+      public:
+        std::mutex              m_mutex;
+        std::condition_variable m_cv;
+        bool                    m_done = false;
+
+        std::coroutine_handle<>
+        on_done() {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_done = true;
+          m_cv.notify_all();
+          return std::noop_coroutine();
+        }
+      };
+
+      template <typename T>
+      notifier<sync_state>
+      sync_wrap( task<T> & t )
+      { co_await t.when_ready(); }
+
+    }
+
+    //!
+    //! Wait all the tasks (concurrently) and return their results in order.
+    //! If some task throws, the first exception (in order) is rethrown.
+    //!
+    template <typename T>
+    task<std::vector<T>>
+    when_all( std::vector<task<T>> tasks ) {
+      co_await detail::when_all_awaiter<T>( tasks );
+      std::vector<T> res;
+      res.reserve( tasks.size() );
+      for ( task<T> & t : tasks ) res.emplace_back( t.get() );
+      co_return res;
+    }
+
+    inline
+    task<void>
+    when_all( std::vector<task<void>> tasks ) {
+      co_await detail::when_all_awaiter<void>( tasks );
+      for ( task<void> & t : tasks ) t.get();
+    }
+
+    //!
+    //! Block the calling thread (not a worker of the pool running the task)
+    //! until the task is completed and return its result.
+    //!
+    template <typename T>
+    T
+    sync_wait( task<T> && t ) {
+      detail::sync_state st;
+      detail::notifier<detail::sync_state> w( detail::sync_wrap( t ) );
+      w.start( st );
+      {
+        std::unique_lock<std::mutex> lock( st.m_mutex );
+        st.m_cv.wait( lock, [&st]()->bool { return st.m_done; } );
+      }
+      return t.get();
+    }
+
+  }
+
+}
+
+#endif
+
+///
+/// eof: ThreadPoolCoro.hxx
+///
@@ -109,6 +109,7 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <map>
 #include <limits>
 
@@ -124,6 +125,7 @@
 #include <cstdint>
 #include <stdexcept>
 #include <memory>
+#include <chrono>
 
 // disable mingw-std-threads for mingw on MATLAB
 #if defined(__MINGW32__) || defined(__MINGW64__) && !defined(MATLAB_MEX_FILE )
@@ -156,6 +158,15 @@
   #include <atomic>
 #endif
 
+// optional C++20 coroutine layer on the thread pools
+#if defined(__has_include)
+  #if __cplusplus >= 202002L && __has_include(<coroutine>)
+    #include <coroutine>
+    #include <optional>
+    #define UTILS_HAS_COROUTINES
+  #endif
+#endif
+
 #ifdef _MSC_VER
   // Workaround for visual studio
   #ifdef max
@@ -185,6 +196,8 @@
 #include "ThreadPool3.hxx"
 #include "ThreadPool4.hxx"
 #include "ThreadPool5.hxx"
+#include "ThreadPool6.hxx"
+#include "ThreadPoolCoro.hxx"
 // -----------------------
 
 namespace Utils {
@@ -129,8 +129,8 @@ namespace quickpool {
 
       inline
       void
-      free( void * & ptr ) noexcept
-      { if ( ptr ) std::free( ptr ); ptr = nullptr; }
+      free( void * ptr ) noexcept
+      { if ( ptr ) std::free( ptr ); }
 
       //! short version of
       //! https://www.boost.org/doc/libs/1_65_0/boost/align/aligned_allocator.hpp
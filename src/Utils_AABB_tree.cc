@@ -24,6 +24,22 @@
 #include "Utils_AABB_tree.hh"
 #include <algorithm>
 #include <utility>
+#include <limits>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+
+#ifndef UTILS_OS_WINDOWS
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+  #define UTILS_AABB_TREE_USE_SSE
+  #include <xmmintrin.h>
+#endif
 
 namespace Utils {
 
@@ -32,22 +48,42 @@ namespace Utils {
   using std::swap;
   using std::copy_n;
 
+  //
+  // "Surface" of a bbox: sum of the measure of the faces
+  // (perimeter in 2D, area in 3D, length in 1D).
+  //
+  template <typename Real>
+  static
+  Real
+  bbox_surface( Real const bmin[], Real const bmax[], int dim ) {
+    if ( dim == 1 ) return bmax[0] - bmin[0];
+    Real res = 0;
+    for ( int j = 0; j < dim; ++j ) {
+      Real f = 1;
+      for ( int k = 0; k < dim; ++k ) if ( k != j ) f *= bmax[k] - bmin[k];
+      res += f;
+    }
+    return res;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
   template <typename Real>
   bool
-  AABBtree<Real>::overlap1( Real const bb1[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::overlap1( Real const bb1[], Real const bb2[], integer ) {
     return bb1[0] <= bb2[1] && bb1[1] >= bb2[0];
   }
 
   template <typename Real>
   bool
-  AABBtree<Real>::overlap2( Real const bb1[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::overlap2( Real const bb1[], Real const bb2[], integer ) {
     return bb1[0] <= bb2[2] && bb1[2] >= bb2[0] &&
            bb1[1] <= bb2[3] && bb1[3] >= bb2[1];
   }
 
   template <typename Real>
   bool
-  AABBtree<Real>::overlap3( Real const bb1[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::overlap3( Real const bb1[], Real const bb2[], integer ) {
     return bb1[0] <= bb2[3] && bb1[3] >= bb2[0] &&
            bb1[1] <= bb2[4] && bb1[4] >= bb2[1] &&
            bb1[2] <= bb2[5] && bb1[5] >= bb2[2];
@@ -55,7 +91,7 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::overlap4( Real const bb1[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::overlap4( Real const bb1[], Real const bb2[], integer ) {
     return bb1[0] <= bb2[4] && bb1[4] >= bb2[0] &&
            bb1[1] <= bb2[5] && bb1[5] >= bb2[1] &&
            bb1[2] <= bb2[6] && bb1[6] >= bb2[2] &&
@@ -64,7 +100,7 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::overlap5( Real const bb1[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::overlap5( Real const bb1[], Real const bb2[], integer ) {
     return bb1[0] <= bb2[5] && bb1[5] >= bb2[0] &&
            bb1[1] <= bb2[6] && bb1[6] >= bb2[1] &&
            bb1[2] <= bb2[7] && bb1[7] >= bb2[2] &&
@@ -74,7 +110,7 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::overlap6( Real const bb1[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::overlap6( Real const bb1[], Real const bb2[], integer ) {
     return bb1[0] <= bb2[6]  && bb1[6]  >= bb2[0] &&
            bb1[1] <= bb2[7]  && bb1[7]  >= bb2[1] &&
            bb1[2] <= bb2[8]  && bb1[8]  >= bb2[2] &&
@@ -85,19 +121,19 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::overlap7( Real const bb1[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::overlap7( Real const bb1[], Real const bb2[], integer ) {
     return bb1[0] <= bb2[7]  && bb1[7]  >= bb2[0] &&
            bb1[1] <= bb2[8]  && bb1[8]  >= bb2[1] &&
            bb1[2] <= bb2[9]  && bb1[9]  >= bb2[2] &&
            bb1[3] <= bb2[10] && bb1[10] >= bb2[3] &&
            bb1[4] <= bb2[11] && bb1[11] >= bb2[4] &&
            bb1[5] <= bb2[12] && bb1[12] >= bb2[5] &&
-           bb1[6] <= bb2[13] && bb1[14] >= bb2[6];
+           bb1[6] <= bb2[13] && bb1[13] >= bb2[6];
   }
 
   template <typename Real>
   bool
-  AABBtree<Real>::overlap8( Real const bb1[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::overlap8( Real const bb1[], Real const bb2[], integer ) {
     return bb1[0] <= bb2[8]  && bb1[8]  >= bb2[0] &&
            bb1[1] <= bb2[9]  && bb1[9]  >= bb2[1] &&
            bb1[2] <= bb2[10] && bb1[10] >= bb2[2] &&
@@ -110,20 +146,20 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::pnt_overlap1( Real const pnt[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::pnt_overlap1( Real const pnt[], Real const bb2[], integer ) {
     return pnt[0] <= bb2[1] && pnt[0] >= bb2[0];
   }
 
   template <typename Real>
   bool
-  AABBtree<Real>::pnt_overlap2( Real const pnt[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::pnt_overlap2( Real const pnt[], Real const bb2[], integer ) {
     return pnt[0] <= bb2[2] && pnt[0] >= bb2[0] &&
            pnt[1] <= bb2[3] && pnt[1] >= bb2[1];
   }
 
   template <typename Real>
   bool
-  AABBtree<Real>::pnt_overlap3( Real const pnt[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::pnt_overlap3( Real const pnt[], Real const bb2[], integer ) {
     return pnt[0] <= bb2[3] && pnt[0] >= bb2[0] &&
            pnt[1] <= bb2[4] && pnt[1] >= bb2[1] &&
            pnt[2] <= bb2[5] && pnt[2] >= bb2[2];
@@ -131,7 +167,7 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::pnt_overlap4( Real const pnt[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::pnt_overlap4( Real const pnt[], Real const bb2[], integer ) {
     return pnt[0] <= bb2[4] && pnt[0] >= bb2[0] &&
            pnt[1] <= bb2[5] && pnt[1] >= bb2[1] &&
            pnt[2] <= bb2[6] && pnt[2] >= bb2[2] &&
@@ -140,7 +176,7 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::pnt_overlap5( Real const pnt[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::pnt_overlap5( Real const pnt[], Real const bb2[], integer ) {
     return pnt[0] <= bb2[5] && pnt[0] >= bb2[0] &&
            pnt[1] <= bb2[6] && pnt[1] >= bb2[1] &&
            pnt[2] <= bb2[7] && pnt[2] >= bb2[2] &&
@@ -150,7 +186,7 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::pnt_overlap6( Real const pnt[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::pnt_overlap6( Real const pnt[], Real const bb2[], integer ) {
     return pnt[0] <= bb2[6]  && pnt[0] >= bb2[0] &&
            pnt[1] <= bb2[7]  && pnt[1] >= bb2[1] &&
            pnt[2] <= bb2[8]  && pnt[2] >= bb2[2] &&
@@ -161,7 +197,7 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::pnt_overlap7( Real const pnt[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::pnt_overlap7( Real const pnt[], Real const bb2[], integer ) {
     return pnt[0] <= bb2[7]  && pnt[0] >= bb2[0] &&
            pnt[1] <= bb2[8]  && pnt[1] >= bb2[1] &&
            pnt[2] <= bb2[9]  && pnt[2] >= bb2[2] &&
@@ -173,7 +209,7 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::pnt_overlap8( Real const pnt[], Real const bb2[], integer ) {
+  AABBoverlap<Real,0>::pnt_overlap8( Real const pnt[], Real const bb2[], integer ) {
     return pnt[0] <= bb2[8]  && pnt[0] >= bb2[0] &&
            pnt[1] <= bb2[9]  && pnt[1] >= bb2[1] &&
            pnt[2] <= bb2[10] && pnt[2] >= bb2[2] &&
@@ -186,97 +222,663 @@ namespace Utils {
 
   template <typename Real>
   bool
-  AABBtree<Real>::check_overlap( Real const bb1[], Real const bb2[], integer dim ) {
-    bool overlap = false;
-    integer k = dim % 4;
-    switch ( k ) {
-    case 1:
-      overlap = bb1[0] <= bb2[dim] && bb1[dim] >= bb2[0];
-      break;
-    case 2:
-      overlap = bb1[0] <= bb2[dim+0] && bb1[dim+0] >= bb2[0] &&
-                bb1[1] <= bb2[dim+1] && bb1[dim+1] >= bb2[1];
-      break;
-    case 3:
-      overlap = bb1[0] <= bb2[dim+0] && bb1[dim+0] >= bb2[0] &&
-                bb1[1] <= bb2[dim+1] && bb1[dim+1] >= bb2[1] &&
-                bb1[2] <= bb2[dim+2] && bb1[dim+2] >= bb2[2];
-      break;
-    }
-    bb1 += k;
-    bb2 += k;
-    while ( !overlap && k < dim ) {
-      overlap = bb1[0] <= bb2[dim+0] && bb1[dim+0] >= bb2[0] &&
-                bb1[1] <= bb2[dim+1] && bb1[dim+1] >= bb2[1] &&
-                bb1[2] <= bb2[dim+2] && bb1[dim+2] >= bb2[2] &&
-                bb1[3] <= bb2[dim+3] && bb1[dim+3] >= bb2[3];
-      bb1 += 4;
-      bb2 += 4;
-    }
-    return overlap;
+  AABBoverlap<Real,0>::check_overlap( Real const bb1[], Real const bb2[], integer dim ) {
+    for ( integer j = 0; j < dim; ++j )
+      if ( bb1[j] > bb2[dim+j] || bb1[dim+j] < bb2[j] ) return false;
+    return true;
   }
 
   template <typename Real>
   bool
-  AABBtree<Real>::check_overlap_with_point( Real const pnt[], Real const bb2[], integer dim ) {
-    bool overlap = false;
-    integer k = dim % 4;
-    switch ( k ) {
+  AABBoverlap<Real,0>::check_overlap_with_point( Real const pnt[], Real const bb2[], integer dim ) {
+    for ( integer j = 0; j < dim; ++j )
+      if ( pnt[j] > bb2[dim+j] || pnt[j] < bb2[j] ) return false;
+    return true;
+  }
+
+  template <typename Real>
+  void
+  AABBoverlap<Real,0>::setup( integer dim ) {
+    m_dim = dim;
+    switch ( dim ) {
     case 1:
-      overlap = pnt[0] <= bb2[dim] && pnt[0] >= bb2[0];
+      m_check_overlap            = overlap1;
+      m_check_overlap_with_point = pnt_overlap1;
       break;
     case 2:
-      overlap = pnt[0] <= bb2[dim+0] && pnt[0] >= bb2[0] &&
-                pnt[1] <= bb2[dim+1] && pnt[1] >= bb2[1];
+      m_check_overlap            = overlap2;
+      m_check_overlap_with_point = pnt_overlap2;
       break;
     case 3:
-      overlap = pnt[0] <= bb2[dim+0] && pnt[0] >= bb2[0] &&
-                pnt[1] <= bb2[dim+1] && pnt[1] >= bb2[1] &&
-                pnt[2] <= bb2[dim+2] && pnt[2] >= bb2[2];
+      m_check_overlap            = overlap3;
+      m_check_overlap_with_point = pnt_overlap3;
+      break;
+    case 4:
+      m_check_overlap            = overlap4;
+      m_check_overlap_with_point = pnt_overlap4;
+      break;
+    case 5:
+      m_check_overlap            = overlap5;
+      m_check_overlap_with_point = pnt_overlap5;
+      break;
+    case 6:
+      m_check_overlap            = overlap6;
+      m_check_overlap_with_point = pnt_overlap6;
+      break;
+    case 7:
+      m_check_overlap            = overlap7;
+      m_check_overlap_with_point = pnt_overlap7;
+      break;
+    case 8:
+      m_check_overlap            = overlap8;
+      m_check_overlap_with_point = pnt_overlap8;
+      break;
+    default:
+      m_check_overlap            = check_overlap;
+      m_check_overlap_with_point = check_overlap_with_point;
       break;
     }
-    pnt += k;
-    bb2 += k;
-    while ( !overlap && k < dim ) {
-      overlap = pnt[0] <= bb2[dim+0] && pnt[0] >= bb2[0] &&
-                pnt[1] <= bb2[dim+1] && pnt[1] >= bb2[1] &&
-                pnt[2] <= bb2[dim+2] && pnt[2] >= bb2[2] &&
-                pnt[3] <= bb2[dim+3] && pnt[3] >= bb2[3];
-      pnt += 4;
-      bb2 += 4;
-    }
-    return overlap;
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
-  AABBtree<Real>::AABBtree( AABBtree<Real> const & T )
+  template <typename Real, int DIM>
+  AABBtree<Real,DIM>::AABBtree( AABBtree<Real,DIM> const & T )
   {
-    allocate( T.m_num_objects, T.m_dim );
-
-    std::copy_n( T.m_father,    m_nmax,               m_father    );
-    std::copy_n( T.m_child,     m_nmax,               m_child     );
-    std::copy_n( T.m_ptr_nodes, m_nmax,               m_ptr_nodes );
-    std::copy_n( T.m_num_nodes, m_nmax,               m_num_nodes );
+    T.check_full_tree( "AABBtree( T )" );
+    allocate( T.m_num_objects, T.dim() );
+
+    // a mapped tree stores only the used nodes
+    integer nn = min( m_nmax, T.m_nmax );
+    std::copy_n( T.m_father,    nn,                   m_father    );
+    std::copy_n( T.m_child,     nn,                   m_child     );
+    std::copy_n( T.m_ptr_nodes, nn,                   m_ptr_nodes );
+    std::copy_n( T.m_num_nodes, nn,                   m_num_nodes );
     std::copy_n( T.m_id_nodes,  m_num_objects,        m_id_nodes  );
-    std::copy_n( T.m_bbox_tree, m_nmax*m_2dim,        m_bbox_tree );
-    std::copy_n( T.m_bbox_objs, m_num_objects*m_2dim, m_bbox_objs );
+    std::copy_n( T.m_bbox_tree, nn*dim2(),            m_bbox_tree );
+    std::copy_n( T.m_bbox_objs, m_num_objects*dim2(), m_bbox_objs );
 
+    m_num_tree_nodes           = T.m_num_tree_nodes;
     m_max_num_objects_per_node = T.m_max_num_objects_per_node;
     m_bbox_long_edge_ratio     = T.m_bbox_long_edge_ratio;
     m_bbox_overlap_tolerance   = T.m_bbox_overlap_tolerance;
+    m_bbox_min_size_tolerance  = T.m_bbox_min_size_tolerance;
+    m_split_strategy           = T.m_split_strategy;
+    m_use_compact              = T.m_use_compact;
+    m_use_wide                 = T.m_use_wide;
+    m_use_quantized            = T.m_use_quantized;
+    m_build_surface            = T.m_build_surface;
+    m_build_cost               = T.m_build_cost;
+    if ( m_use_compact   ) build_compact();
+    if ( m_use_wide      ) build_wide();
+    if ( m_use_quantized ) build_quantized();
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
+  //
+  // Binary file of a built tree: a header followed by the arrays, each one
+  // starting at a multiple of 64 bytes (so they are aligned when mapped).
+  // Integers and floating point numbers are in the native format, the
+  // header records their size and the byte order.
+  //
+  static char     const AABB_FILE_MAGIC[8]  = { 'A', 'A', 'B', 'B', 'T', 'R', 'E', 'E' };
+  static uint32_t const AABB_FILE_VERSION   = 1;
+  static uint32_t const AABB_FILE_ENDIAN    = 0x01020304;
+  static int64_t  const AABB_FILE_ALIGN     = 64;
+
+  struct AABBtreeFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t real_size;
+    uint32_t integer_size;
+    int64_t  dim;
+    int64_t  num_objects;
+    int64_t  num_tree_nodes;
+    int64_t  max_num_objects_per_node;
+    int64_t  split_strategy;
+    int64_t  layouts;        // bit 0 compact, bit 1 wide, bit 2 quantized
+    double   bbox_long_edge_ratio;
+    double   bbox_overlap_tolerance;
+    double   bbox_min_size_tolerance;
+    double   build_cost;
+    int64_t  offset[7];      // father, child, ptr_nodes, num_nodes, id_nodes, bbox_tree, bbox_objs
+    int64_t  file_size;
+  };
+
+  static
+  int64_t
+  aabb_file_align( int64_t n )
+  { return ( (n + AABB_FILE_ALIGN - 1) / AABB_FILE_ALIGN ) * AABB_FILE_ALIGN; }
+
+  // size in bytes of the arrays of the file
+  template <typename Real>
+  static
+  void
+  aabb_file_sizes( AABBtreeFileHeader const & h, int64_t sizes[7] ) {
+    int64_t isz = int64_t(sizeof(int));
+    int64_t rsz = int64_t(sizeof(Real));
+    sizes[0] = sizes[1] = sizes[2] = sizes[3] = h.num_tree_nodes * isz;
+    sizes[4] = h.num_objects * isz;
+    sizes[5] = h.num_tree_nodes * 2 * h.dim * rsz;
+    sizes[6] = h.num_objects * 2 * h.dim * rsz;
+  }
+
+  // place the arrays after the header
+  static
+  void
+  aabb_file_offsets( AABBtreeFileHeader & h, int64_t const sizes[7] ) {
+    int64_t pos = aabb_file_align( int64_t(sizeof(h)) );
+    for ( int k = 0; k < 7; ++k ) {
+      h.offset[k] = pos;
+      pos = aabb_file_align( pos + sizes[k] );
+    }
+    h.file_size = pos;
+  }
+
   template <typename Real>
+  static
+  void
+  aabb_file_check( AABBtreeFileHeader const & h, int64_t file_size, string const & fname ) {
+    UTILS_ASSERT(
+      std::equal( AABB_FILE_MAGIC, AABB_FILE_MAGIC+8, h.magic ),
+      "AABBtree, file `{}` is not an AABBtree file\n", fname
+    );
+    UTILS_ASSERT(
+      h.version == AABB_FILE_VERSION,
+      "AABBtree, file `{}` has version {}, expected {}\n", fname, h.version, AABB_FILE_VERSION
+    );
+    UTILS_ASSERT(
+      h.endian == AABB_FILE_ENDIAN && h.integer_size == sizeof(int),
+      "AABBtree, file `{}` written on a machine with different byte order or integer size\n", fname
+    );
+    UTILS_ASSERT(
+      h.real_size == sizeof(Real),
+      "AABBtree, file `{}` stores a tree of {} byte reals, expected {}\n", fname, h.real_size, sizeof(Real)
+    );
+    UTILS_ASSERT(
+      h.dim > 0 && h.num_objects >= 0 && h.num_tree_nodes >= 0 &&
+      h.num_tree_nodes <= 2*h.num_objects && h.file_size == file_size,
+      "AABBtree, file `{}` is corrupted or truncated\n", fname
+    );
+    int64_t sizes[7];
+    aabb_file_sizes<Real>( h, sizes );
+    for ( int k = 0; k < 7; ++k )
+      UTILS_ASSERT(
+        h.offset[k] % AABB_FILE_ALIGN == 0 && h.offset[k] + sizes[k] <= file_size,
+        "AABBtree, file `{}` is corrupted or truncated\n", fname
+      );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  AABBtree<Real,DIM>::~AABBtree() { unmap(); }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::unmap() {
+    #ifndef UTILS_OS_WINDOWS
+    if ( m_map_base != nullptr ) munmap( m_map_base, m_map_size );
+    #endif
+    m_map_base = nullptr;
+    m_map_size = 0;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::check_writable( char const where[] ) const {
+    UTILS_ASSERT(
+      m_map_base == nullptr,
+      "AABBtree::{}, the tree is mapped from a file (read only)\n", where
+    );
+    check_full_tree( where );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::check_full_tree( char const where[] ) const {
+    UTILS_ASSERT(
+      !m_compressed,
+      "AABBtree::{}, not available on a compressed tree\n", where
+    );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  // header with the parameters of the tree, sizes and offsets are not set
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::fill_header( void * header ) const {
+    AABBtreeFileHeader & h = *static_cast<AABBtreeFileHeader*>(header);
+    std::memset( &h, 0, sizeof(h) );
+    std::copy_n( AABB_FILE_MAGIC, 8, h.magic );
+    h.version                  = AABB_FILE_VERSION;
+    h.endian                   = AABB_FILE_ENDIAN;
+    h.real_size                = uint32_t(sizeof(Real));
+    h.integer_size             = uint32_t(sizeof(integer));
+    h.max_num_objects_per_node = m_max_num_objects_per_node;
+    h.split_strategy           = integer(m_split_strategy);
+    h.layouts                  = layouts_bits();
+    h.bbox_long_edge_ratio     = double(m_bbox_long_edge_ratio);
+    h.bbox_overlap_tolerance   = double(m_bbox_overlap_tolerance);
+    h.bbox_min_size_tolerance  = double(m_bbox_min_size_tolerance);
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::save( string const & fname ) const {
+
+    check_full_tree( "save" );
+
+    AABBtreeFileHeader h;
+    fill_header( &h );
+    h.dim            = dim();
+    h.num_objects    = m_num_objects;
+    h.num_tree_nodes = m_num_tree_nodes;
+    h.build_cost     = double(m_build_cost);
+
+    int64_t sizes[7];
+    aabb_file_sizes<Real>( h, sizes );
+    aabb_file_offsets( h, sizes );
+
+    std::ofstream file( fname, std::ios::binary );
+    UTILS_ASSERT( file.good(), "AABBtree::save( `{}` ), cannot open the file\n", fname );
+
+    void const * data[7] = {
+      m_father, m_child, m_ptr_nodes, m_num_nodes, m_id_nodes, m_bbox_tree, m_bbox_objs
+    };
+    char const zeros[AABB_FILE_ALIGN] = {0};
+    file.write( reinterpret_cast<char const*>(&h), sizeof(h) );
+    int64_t written = int64_t(sizeof(h));
+    for ( int k = 0; k < 7; ++k ) {
+      file.write( zeros, std::streamsize(h.offset[k] - written) );
+      file.write( static_cast<char const*>(data[k]), std::streamsize(sizes[k]) );
+      written = h.offset[k] + sizes[k];
+    }
+    file.write( zeros, std::streamsize(h.file_size - written) );
+    UTILS_ASSERT( file.good(), "AABBtree::save( `{}` ), write failed\n", fname );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::set_from_header( void const * header, bool mapped ) {
+    AABBtreeFileHeader const & h = *static_cast<AABBtreeFileHeader const*>(header);
+    m_num_tree_nodes           = integer(h.num_tree_nodes);
+    m_max_num_objects_per_node = integer(h.max_num_objects_per_node);
+    m_split_strategy           = SplitStrategy(h.split_strategy);
+    m_bbox_long_edge_ratio     = Real(h.bbox_long_edge_ratio);
+    m_bbox_overlap_tolerance   = Real(h.bbox_overlap_tolerance);
+    m_bbox_min_size_tolerance  = Real(h.bbox_min_size_tolerance);
+    m_use_compact              = (h.layouts & 1) != 0;
+    m_use_wide                 = (h.layouts & 2) != 0;
+    m_use_quantized            = (h.layouts & 4) != 0;
+    if ( mapped ) {
+      // do not touch all the pages of the mapping
+      if ( m_use_compact   ) build_compact();
+      if ( m_use_wide      ) build_wide();
+      if ( m_use_quantized ) build_quantized();
+      m_build_surface.clear();
+    } else {
+      after_build();
+    }
+    m_build_cost = Real(h.build_cost);
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::load( string const & fname ) {
+
+    std::ifstream file( fname, std::ios::binary | std::ios::ate );
+    UTILS_ASSERT( file.good(), "AABBtree::load( `{}` ), cannot open the file\n", fname );
+    int64_t file_size = int64_t(file.tellg());
+    file.seekg( 0 );
+
+    AABBtreeFileHeader h;
+    UTILS_ASSERT(
+      file_size >= int64_t(sizeof(h)) && file.read( reinterpret_cast<char*>(&h), sizeof(h) ),
+      "AABBtree::load( `{}` ), file too short\n", fname
+    );
+    aabb_file_check<Real>( h, file_size, fname );
+
+    unmap();
+    allocate( integer(h.num_objects), integer(h.dim) );
+
+    int64_t sizes[7];
+    aabb_file_sizes<Real>( h, sizes );
+    void * data[7] = {
+      m_father, m_child, m_ptr_nodes, m_num_nodes, m_id_nodes, m_bbox_tree, m_bbox_objs
+    };
+    for ( int k = 0; k < 7; ++k ) {
+      file.seekg( h.offset[k] );
+      file.read( static_cast<char*>(data[k]), std::streamsize(sizes[k]) );
+    }
+    UTILS_ASSERT( file.good(), "AABBtree::load( `{}` ), read failed\n", fname );
+
+    set_from_header( &h, false );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::map_file( string const & fname ) {
+    #ifdef UTILS_OS_WINDOWS
+    load( fname );
+    #else
+    int fd = ::open( fname.c_str(), O_RDONLY );
+    UTILS_ASSERT( fd >= 0, "AABBtree::map_file( `{}` ), cannot open the file\n", fname );
+    struct stat st;
+    bool ok = fstat( fd, &st ) == 0 && st.st_size >= off_t(sizeof(AABBtreeFileHeader));
+    void * base = ok ? mmap( nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0 ) : MAP_FAILED;
+    ::close( fd ); // the mapping stays valid
+    UTILS_ASSERT( base != MAP_FAILED, "AABBtree::map_file( `{}` ), cannot map the file\n", fname );
+
+    AABBtreeFileHeader const & h = *static_cast<AABBtreeFileHeader const*>(base);
+    try {
+      aabb_file_check<Real>( h, int64_t(st.st_size), fname );
+      UTILS_ASSERT(
+        DIM == 0 || h.dim == DIM,
+        "AABBtree::map_file( `{}` ), dim = {}, the tree is compiled for dim = {}\n",
+        fname, h.dim, DIM
+      );
+    } catch ( ... ) {
+      munmap( base, size_t(st.st_size) );
+      throw;
+    }
+
+    // release the memory of the tree, arrays point into the mapping
+    unmap();
+    m_rmem.free();
+    m_imem.free();
+    m_compressed  = false;
+    m_map_base    = base;
+    m_map_size    = size_t(st.st_size);
+    m_dim         = integer(h.dim);
+    m_2dim        = 2*m_dim;
+    m_num_objects = integer(h.num_objects);
+    m_nmax        = integer(h.num_tree_nodes);
+
+    char const * p = static_cast<char const*>(base);
+    // read only, the const_cast is protected by check_writable
+    m_father    = const_cast<integer*>( reinterpret_cast<integer const*>( p + h.offset[0] ) );
+    m_child     = const_cast<integer*>( reinterpret_cast<integer const*>( p + h.offset[1] ) );
+    m_ptr_nodes = const_cast<integer*>( reinterpret_cast<integer const*>( p + h.offset[2] ) );
+    m_num_nodes = const_cast<integer*>( reinterpret_cast<integer const*>( p + h.offset[3] ) );
+    m_id_nodes  = const_cast<integer*>( reinterpret_cast<integer const*>( p + h.offset[4] ) );
+    m_bbox_tree = const_cast<Real*>( reinterpret_cast<Real const*>( p + h.offset[5] ) );
+    m_bbox_objs = const_cast<Real*>( reinterpret_cast<Real const*>( p + h.offset[6] ) );
+
+    m_overlap.setup( dim() );
+    m_compact    = nullptr;
+    m_wide_nodes = 0;
+    set_from_header( &h, true );
+    #endif
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Out of core build.  The first pass builds and spills the subtree of
+  // each chunk keeping only its root bbox.  The roots are the leaves (one
+  // chunk each) of a linear BVH whose nodes come first in the file: the
+  // leaf of a chunk is replaced by the root of its subtree and the other
+  // nodes of the subtree are appended.  The objects of the chunks are
+  // placed in `id_nodes` following the leaves, so the objects of every
+  // subtree are contiguous as in a tree built in memory.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::build_out_of_core(
+    BOX_READER const & read,
+    integer            dim,
+    string     const & fname,
+    integer            chunk_size,
+    ThreadPoolBase   * pool
+  ) {
+    UTILS_ASSERT(
+      dim > 0 && ( DIM == 0 || dim == DIM ) && chunk_size > 0,
+      "AABBtree::build_out_of_core( dim = {}, `{}`, chunk_size = {} ), bad arguments\n",
+      dim, fname, chunk_size
+    );
+
+    integer const dim2 = 2*dim;
+
+    struct Chunk {
+      integer first;     // first object
+      integer num;       // number of objects
+      integer num_nodes; // nodes of the subtree
+      integer pos;       // position of the first object in id_nodes
+      integer leaf;      // leaf of the top tree replaced by the root
+      integer base;      // position of the node 1 of the subtree
+    };
+    vector<Chunk>  chunks;
+    vector<Real>   roots; // bboxes of the roots of the subtrees
+    vector<string> tmp_names;
+    bool           created = false; // `fname` is (partially) written
+
+    try {
+
+      // pass 1: build and spill the subtrees
+      integer n_total = 0;
+      {
+        vector<Real> bb_min( size_t(chunk_size)*dim );
+        vector<Real> bb_max( size_t(chunk_size)*dim );
+        AABBtree<Real,DIM> T;
+        T.m_max_num_objects_per_node = m_max_num_objects_per_node;
+        T.m_split_strategy           = m_split_strategy;
+        T.m_bbox_long_edge_ratio     = m_bbox_long_edge_ratio;
+        T.m_bbox_overlap_tolerance   = m_bbox_overlap_tolerance;
+        T.m_bbox_min_size_tolerance  = m_bbox_min_size_tolerance;
+        bool done = false;
+        while ( !done ) {
+          integer n = 0;
+          while ( n < chunk_size ) {
+            size_t  ofs = size_t(n)*size_t(dim);
+            integer nr  = read( bb_min.data() + ofs, bb_max.data() + ofs, chunk_size-n );
+            UTILS_ASSERT(
+              nr >= 0 && nr <= chunk_size-n,
+              "AABBtree::build_out_of_core, the reader returned {} bboxes, expected at most {}\n",
+              nr, chunk_size-n
+            );
+            if ( nr == 0 ) { done = true; break; }
+            n += nr;
+          }
+          if ( n == 0 ) break;
+          UTILS_ASSERT(
+            n <= std::numeric_limits<integer>::max()/2 - n_total,
+            "AABBtree::build_out_of_core, too many bboxes\n"
+          );
+          T.build( bb_min.data(), dim, bb_max.data(), dim, n, dim, pool );
+          tmp_names.emplace_back( fmt::format( "{}.chunk{}", fname, chunks.size() ) );
+          T.save( tmp_names.back() );
+          chunks.push_back( { n_total, n, T.m_num_tree_nodes, 0, 0, 0 } );
+          roots.insert( roots.end(), T.m_bbox_tree, T.m_bbox_tree + dim2 );
+          n_total += n;
+        }
+      }
+      UTILS_ASSERT( n_total > 0, "AABBtree::build_out_of_core( `{}` ), no bboxes\n", fname );
+
+      // top tree, a leaf for each chunk
+      integer const nchunks = integer(chunks.size());
+      AABBtree<Real,DIM> top;
+      top.set_max_num_objects_per_node( 1 );
+      top.build_lbvh( roots.data(), dim2, roots.data()+dim, dim2, nchunks, dim, pool );
+      integer const ntop = top.m_num_tree_nodes;
+
+      vector<integer> pos( size_t(nchunks+1) );
+      pos[0] = 0;
+      for ( integer r = 0; r < nchunks; ++r ) {
+        Chunk & c = chunks[ top.m_id_nodes[r] ];
+        c.pos    = pos[r];
+        pos[r+1] = pos[r] + c.num;
+      }
+      // SAH cost of the merged tree, the internal nodes of the top tree are empty
+      Real const S0   = bbox_surface( top.m_bbox_tree, top.m_bbox_tree+dim, dim );
+      Real       cost = 0;
+      auto sah = [S0,dim]( Real const bb[], integer num ) {
+        return ( S0 > 0 ? bbox_surface( bb, bb+dim, dim ) / S0 : Real(1) ) * ( 1 + num );
+      };
+      for ( integer id = 0; id < ntop; ++id ) {
+        if ( top.m_child[id] >= 0 ) {
+          top.m_ptr_nodes[id] = pos[ top.m_ptr_nodes[id] ];
+          cost += sah( top.m_bbox_tree + id*dim2, 0 );
+        } else {
+          chunks[ top.m_id_nodes[ top.m_ptr_nodes[id] ] ].leaf = id;
+        }
+      }
+      integer nn = ntop;
+      for ( Chunk & c : chunks ) { c.base = nn; nn += c.num_nodes-1; }
+
+      AABBtreeFileHeader h;
+      fill_header( &h );
+      h.dim            = dim;
+      h.num_objects    = n_total;
+      h.num_tree_nodes = nn;
+      int64_t sizes[7];
+      aabb_file_sizes<Real>( h, sizes );
+      aabb_file_offsets( h, sizes );
+
+      std::fstream file( fname, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc );
+      UTILS_ASSERT( file.good(), "AABBtree::build_out_of_core( `{}` ), cannot open the file\n", fname );
+      created = true;
+      file.seekp( h.file_size-1 );
+      file.put( 0 );
+
+      // write `n` items of `data` at position `ipos` of the array `k`
+      int64_t const item[7] = {
+        sizeof(integer), sizeof(integer), sizeof(integer), sizeof(integer),
+        sizeof(integer), int64_t(dim2*sizeof(Real)), int64_t(dim2*sizeof(Real))
+      };
+      auto put = [&file,&h,&item]( int k, integer ipos, void const * data, integer n ) {
+        file.seekp( h.offset[k] + ipos*item[k] );
+        file.write( static_cast<char const*>(data), std::streamsize(n*item[k]) );
+      };
+
+      // pass 2: renumber the subtrees, one at a time
+      vector<integer>    ibuf;
+      AABBtree<Real,DIM> T;
+      for ( integer ic = 0; ic < nchunks; ++ic ) {
+        Chunk const & c = chunks[ic];
+        T.load( tmp_names[ic] );
+        std::remove( tmp_names[ic].c_str() );
+
+        auto node = [&c]( integer j ) { return j == 0 ? c.leaf : c.base + j - 1; };
+
+        // the root replaces the leaf (same bbox)
+        top.m_child[c.leaf]     = T.m_child[0] < 0 ? T.m_child[0] : node( T.m_child[0] );
+        top.m_ptr_nodes[c.leaf] = T.m_ptr_nodes[0] + c.pos;
+        top.m_num_nodes[c.leaf] = T.m_num_nodes[0];
+
+        integer const nc = c.num_nodes - 1;
+        ibuf.resize( size_t(std::max(nc,c.num)) );
+        for ( integer j = 1; j <= nc; ++j ) ibuf[j-1] = node( T.m_father[j] );
+        put( 0, c.base, ibuf.data(), nc );
+        for ( integer j = 1; j <= nc; ++j ) {
+          integer ch = T.m_child[j];
+          ibuf[j-1] = ch < 0 ? ch : node( ch );
+        }
+        put( 1, c.base, ibuf.data(), nc );
+        for ( integer j = 1; j <= nc; ++j ) ibuf[j-1] = T.m_ptr_nodes[j] + c.pos;
+        put( 2, c.base, ibuf.data(), nc );
+        put( 3, c.base, T.m_num_nodes+1, nc );
+        put( 5, c.base, T.m_bbox_tree+dim2, nc );
+
+        for ( integer i = 0; i < c.num; ++i ) ibuf[i] = T.m_id_nodes[i] + c.first;
+        put( 4, c.pos,   ibuf.data(),   c.num );
+        put( 6, c.first, T.m_bbox_objs, c.num );
+
+        for ( integer j = 0; j <= nc; ++j )
+          cost += sah( T.m_bbox_tree + j*dim2, T.m_num_nodes[j] );
+      }
+
+      // nodes of the top tree
+      put( 0, 0, top.m_father,    ntop );
+      put( 1, 0, top.m_child,     ntop );
+      put( 2, 0, top.m_ptr_nodes, ntop );
+      put( 3, 0, top.m_num_nodes, ntop );
+      put( 5, 0, top.m_bbox_tree, ntop );
+
+      h.build_cost = double(cost);
+      file.seekp( 0 );
+      file.write( reinterpret_cast<char const*>(&h), sizeof(h) );
+      UTILS_ASSERT( file.good(), "AABBtree::build_out_of_core( `{}` ), write failed\n", fname );
+    } catch ( ... ) {
+      // no partial tree is left for a later map_file
+      for ( string const & f : tmp_names ) std::remove( f.c_str() );
+      if ( created ) std::remove( fname.c_str() );
+      throw;
+    }
+
+    map_file( fname );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::build_out_of_core(
+    string const   & fname_bboxes,
+    integer          dim,
+    string const   & fname,
+    integer          chunk_size,
+    ThreadPoolBase * pool
+  ) {
+    std::ifstream file( fname_bboxes, std::ios::binary );
+    UTILS_ASSERT(
+      file.good(),
+      "AABBtree::build_out_of_core( `{}` ), cannot open the file\n", fname_bboxes
+    );
+    vector<Real> bb;
+    BOX_READER read = [&]( Real bb_min[], Real bb_max[], integer nmax ) -> integer {
+      std::streamsize bsz = std::streamsize(2*dim*sizeof(Real));
+      bb.resize( size_t(nmax)*2*dim );
+      file.read( reinterpret_cast<char*>(bb.data()), nmax*bsz );
+      UTILS_ASSERT(
+        file.gcount() % bsz == 0,
+        "AABBtree::build_out_of_core( `{}` ), truncated file\n", fname_bboxes
+      );
+      integer nr = integer(file.gcount() / bsz);
+      for ( integer i = 0; i < nr; ++i ) {
+        std::copy_n( bb.data() + 2*i*dim,     dim, bb_min + i*dim );
+        std::copy_n( bb.data() + (2*i+1)*dim, dim, bb_max + i*dim );
+      }
+      return nr;
+    };
+    build_out_of_core( read, dim, fname, chunk_size, pool );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  typename AABBtree<Real,DIM>::Workspace &
+  AABBtree<Real,DIM>::thread_workspace() {
+    static thread_local Workspace ws;
+    return ws;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
   Real
-  AABBtree<Real>::max_bbox_distance( Real const bbox[], Real const pnt[] ) const {
+  AABBtree<Real,DIM>::max_bbox_distance( Real const bbox[], Real const pnt[] ) const {
     Real res = 0;
-    for ( integer i = 0; i < m_dim; ++i ) {
+    for ( integer i = 0; i < dim(); ++i ) {
       Real r1 = pnt[i] - bbox[i];
-      Real r2 = pnt[i] - bbox[i+m_dim];
+      Real r2 = pnt[i] - bbox[i+dim()];
       Real mx = max(r1*r1,r2*r2);
       res += mx*mx;
     }
@@ -285,33 +887,225 @@ namespace Utils {
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
-  string
-  AABBtree<Real>::info() const {
-    integer nleaf = 0;
-    integer nlong = 0;
+  template <typename Real, int DIM>
+  Real
+  AABBtree<Real,DIM>::sah_cost() const {
+    check_full_tree( "sah_cost" );
+
+    if ( m_num_tree_nodes == 0 ) return 0;
+    Real S0 = bbox_surface( m_bbox_tree, m_bbox_tree+dim(), dim() );
+    Real res = 0;
     for ( integer i = 0; i < m_num_tree_nodes; ++i ) {
-      if      ( m_child[i] < 0     ) ++nleaf;
-      else if ( m_num_nodes[i] > 0 ) ++nlong;
+      Real const * bb = node_bbox( i );
+      Real P = S0 > 0 ? bbox_surface( bb, bb+dim(), dim() ) / S0 : Real(1);
+      res += P * ( 1 + m_num_nodes[i] );
+    }
+    return res;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  size_t
+  AABBtree<Real,DIM>::memory_usage() const {
+    size_t res = m_map_size;
+    if ( !is_mapped() ) {
+      // a compressed tree keeps only the root bbox and the object indexes
+      size_t n_real = size_t(m_nmax) * size_t(dim2());
+      size_t n_int  = size_t(m_num_objects);
+      if ( m_bbox_objs != nullptr ) n_real += size_t(m_num_objects) * size_t(dim2());
+      if ( m_father    != nullptr ) n_int  += size_t(4*m_nmax);
+      res = n_real * sizeof(Real) + n_int * sizeof(integer);
+    }
+    res += m_compact_mem.size() * sizeof(CompactWord) +
+           m_wide_bounds.size() * sizeof(float) +
+           ( m_wide_slot.size() + m_wide_child.size() ) * sizeof(integer) +
+           m_quant_node.size() * sizeof(integer) +
+           m_quant_bounds.size() * sizeof(uint16_t) +
+           m_quant_root.size() * sizeof(Real);
+    return res;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  // bin of a histogram: 0 for 0, k for the values in [2^(k-1),2^k)
+  static
+  void
+  histogram_add( vector<int> & h, int value ) {
+    size_t k = 0;
+    while ( value > 0 ) { ++k; value >>= 1; }
+    if ( h.size() <= k ) h.resize( k+1, 0 );
+    ++h[k];
+  }
+
+  static
+  string
+  histogram_string( vector<int> const & h ) {
+    string res;
+    for ( size_t k = 0; k < h.size(); ++k ) {
+      if ( h[k] == 0 ) continue;
+      if ( !res.empty() ) res += ' ';
+      if ( k < 2 ) res += fmt::format( "{}:{}", k, h[k] );
+      else         res += fmt::format( "{}-{}:{}", 1 << (k-1), (1 << k)-1, h[k] );
     }
+    return res;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  string
+  AABBtree<Real,DIM>::info() const {
     string res = "-------- AABB tree info --------\n";
-    res += fmt::format( "  Dimension                {}\n", m_dim );
+    res += fmt::format( "  Dimension                {}\n", dim() );
     res += fmt::format( "  Number of nodes          {}\n", m_num_tree_nodes );
-    res += fmt::format( "  Number of leaf           {}\n", nleaf );
-    res += fmt::format( "  Number of long node      {}\n", nlong );
+    if ( !m_compressed && m_num_tree_nodes > 0 ) {
+      // depth and occupancy of the leaves, overlap of the children of a node
+      // (volume of the intersection relative to the volume of the father)
+      integer         nleaf      = 0;
+      integer         nlong      = 0;
+      integer         nlong_objs = 0;
+      integer         nleaf_objs = 0;
+      integer         npairs     = 0;
+      double          olap_sum   = 0;
+      double          olap_max   = 0;
+      vector<integer> depth, occupancy;
+      vector<integer> stack;
+      stack.emplace_back(0); // node
+      stack.emplace_back(0); // depth
+      while ( !stack.empty() ) {
+        integer d  = stack.back(); stack.pop_back();
+        integer id = stack.back(); stack.pop_back();
+        integer nc = m_child[id];
+        if ( nc < 0 ) {
+          ++nleaf;
+          nleaf_objs += m_num_nodes[id];
+          if ( depth.size() <= size_t(d) ) depth.resize( size_t(d+1), 0 );
+          ++depth[d];
+          histogram_add( occupancy, m_num_nodes[id] );
+          continue;
+        }
+        if ( m_num_nodes[id] > 0 ) { ++nlong; nlong_objs += m_num_nodes[id]; }
+        Real const * bf = node_bbox( id );
+        Real const * b1 = node_bbox( nc );
+        Real const * b2 = b1 + dim2();
+        double vf = 1, vi = 1;
+        for ( integer j = 0; j < dim(); ++j ) {
+          vf *= double( bf[dim()+j] - bf[j] );
+          vi *= std::max( 0.0, double( min( b1[dim()+j], b2[dim()+j] ) - max( b1[j], b2[j] ) ) );
+        }
+        if ( vf > 0 ) {
+          olap_sum += vi/vf;
+          olap_max  = std::max( olap_max, vi/vf );
+          ++npairs;
+        }
+        stack.emplace_back(nc);   stack.emplace_back(d+1);
+        stack.emplace_back(nc+1); stack.emplace_back(d+1);
+      }
+      integer dmin = 0;
+      double  davg = 0;
+      while ( depth[dmin] == 0 ) ++dmin;
+      string dhist;
+      for ( size_t k = 0; k < depth.size(); ++k ) {
+        davg += double(k) * depth[k];
+        if ( depth[k] > 0 ) dhist += fmt::format( "{}{}:{}", dhist.empty() ? "" : " ", k, depth[k] );
+      }
+      res += fmt::format( "  Number of leaf           {}\n", nleaf );
+      res += fmt::format( "  Number of long node      {}\n", nlong );
+      res += fmt::format( "  objects in long nodes    {}\n", nlong_objs );
+      res += fmt::format(
+        "  leaf depth               min {} avg {:.3} max {}\n",
+        dmin, davg / nleaf, depth.size()-1
+      );
+      res += fmt::format( "  leaf depth histogram     {}\n", dhist );
+      res += fmt::format(
+        "  leaf occupancy           avg {:.3}, histogram {}\n",
+        double(nleaf_objs) / nleaf, histogram_string( occupancy )
+      );
+      res += fmt::format(
+        "  sibling overlap          avg {:.3} max {:.3} of the father volume\n",
+        npairs > 0 ? olap_sum / npairs : 0.0, olap_max
+      );
+    }
     res += fmt::format( "  Number of objects        {}\n", m_num_objects );
     res += fmt::format( "  max_num_objects_per_node {}\n", m_max_num_objects_per_node );
     res += fmt::format( "  bbox_long_edge_ratio     {}\n", m_bbox_long_edge_ratio );
     res += fmt::format( "  bbox_overlap_tolerance   {}\n", m_bbox_overlap_tolerance );
+    res += fmt::format( "  split strategy           {}\n", split_strategy_name() );
+    if ( m_compressed )
+      res += fmt::format(
+        "  compressed               {} bounds{}\n",
+        m_use_compact ? "float" : "16 bit",
+        m_bbox_objs == nullptr ? ", no object bboxes" : ""
+      );
+    else
+      res += fmt::format( "  SAH cost                 {:.4}\n", sah_cost() );
+    res += fmt::format( "  memory                   {} bytes\n", memory_usage() );
     res += "--------------------------------\n";
     return res;
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::BatchStats::add( QueryStats const & s ) {
+    ++num_queries;
+    total_nodes   += s.nodes;
+    total_objects += s.objects;
+    total_hits    += s.hits;
+    max_stack      = std::max( max_stack, s.max_stack );
+    histogram_add( hist_nodes,   s.nodes     );
+    histogram_add( hist_objects, s.objects   );
+    histogram_add( hist_stack,   s.max_stack );
+    histogram_add( hist_hits,    s.hits      );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::BatchStats::merge( BatchStats const & b ) {
+    auto merge_hist = []( vector<integer> & h, vector<integer> const & hb ) {
+      if ( h.size() < hb.size() ) h.resize( hb.size(), 0 );
+      for ( size_t k = 0; k < hb.size(); ++k ) h[k] += hb[k];
+    };
+    num_queries   += b.num_queries;
+    total_nodes   += b.total_nodes;
+    total_objects += b.total_objects;
+    total_hits    += b.total_hits;
+    max_stack      = std::max( max_stack, b.max_stack );
+    merge_hist( hist_nodes,   b.hist_nodes   );
+    merge_hist( hist_objects, b.hist_objects );
+    merge_hist( hist_stack,   b.hist_stack   );
+    merge_hist( hist_hits,    b.hist_hits    );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  string
+  AABBtree<Real,DIM>::BatchStats::info() const {
+    double nq = num_queries > 0 ? double(num_queries) : 1.0;
+    string res = "-------- AABB tree queries --------\n";
+    res += fmt::format( "  queries          {}\n", num_queries );
+    res += fmt::format( "  nodes visited    {:.4} per query\n", total_nodes / nq );
+    res += fmt::format( "  objects tested   {:.4} per query\n", total_objects / nq );
+    res += fmt::format( "  hits             {:.4} per query\n", total_hits / nq );
+    res += fmt::format( "  max stack        {}\n", max_stack );
+    res += fmt::format( "  histogram nodes  {}\n", histogram_string( hist_nodes ) );
+    res += fmt::format( "  histogram tested {}\n", histogram_string( hist_objects ) );
+    res += fmt::format( "  histogram stack  {}\n", histogram_string( hist_stack ) );
+    res += fmt::format( "  histogram hits   {}\n", histogram_string( hist_hits ) );
+    res += "-----------------------------------\n";
+    return res;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::set_max_num_objects_per_node( integer n ) {
+  AABBtree<Real,DIM>::set_max_num_objects_per_node( integer n ) {
     UTILS_ASSERT(
       n > 0 && n <= 4096,
       "AABBtree::set_max_num_objects_per_node( nobj = {} )\n"
@@ -323,9 +1117,9 @@ namespace Utils {
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::set_bbox_long_edge_ratio( Real ratio ) {
+  AABBtree<Real,DIM>::set_bbox_long_edge_ratio( Real ratio ) {
     UTILS_ASSERT(
       ratio > 0 && ratio < 1,
       "AABBtree::set_bbox_long_edge_ratio( ratio = {} )\n"
@@ -337,9 +1131,9 @@ namespace Utils {
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::set_bbox_overlap_tolerance( Real tol ) {
+  AABBtree<Real,DIM>::set_bbox_overlap_tolerance( Real tol ) {
     UTILS_ASSERT(
       tol > 0 && tol < 1,
       "AABBtree::set_bbox_overlap_tolerance( tol = {} )\n"
@@ -351,9 +1145,9 @@ namespace Utils {
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::set_bbox_min_size_tolerance( Real tol ) {
+  AABBtree<Real,DIM>::set_bbox_min_size_tolerance( Real tol ) {
     UTILS_ASSERT(
       tol >= 0,
       "AABBtree::set_bbox_min_size_tolerance( tol = {} )\n"
@@ -365,9 +1159,20 @@ namespace Utils {
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::allocate_bboxes( integer nt, integer no ) {
+    m_rmem.free();
+    m_rmem.allocate( size_t((nt+no)*dim2()) );
+    m_bbox_tree = m_rmem( size_t(nt*dim2()) );
+    m_bbox_objs = no > 0 ? m_rmem( size_t(no*dim2()) ) : nullptr;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::allocate( integer nbox, integer dim ) {
+  AABBtree<Real,DIM>::allocate( integer nbox, integer dim ) {
 
     UTILS_WARNING(
       dim <= 10,
@@ -376,59 +1181,27 @@ namespace Utils {
       dim
     );
 
-    switch ( dim ) {
-    case 1:
-      m_check_overlap            = overlap1;
-      m_check_overlap_with_point = pnt_overlap1;
-      break;
-    case 2:
-      m_check_overlap            = overlap2;
-      m_check_overlap_with_point = pnt_overlap2;
-      break;
-    case 3:
-      m_check_overlap            = overlap3;
-      m_check_overlap_with_point = pnt_overlap3;
-      break;
-    case 4:
-      m_check_overlap            = overlap4;
-      m_check_overlap_with_point = pnt_overlap4;
-      break;
-    case 5:
-      m_check_overlap            = overlap5;
-      m_check_overlap_with_point = pnt_overlap5;
-      break;
-    case 6:
-      m_check_overlap            = overlap6;
-      m_check_overlap_with_point = pnt_overlap6;
-      break;
-    case 7:
-      m_check_overlap            = overlap7;
-      m_check_overlap_with_point = pnt_overlap7;
-      break;
-    case 8:
-      m_check_overlap            = overlap8;
-      m_check_overlap_with_point = pnt_overlap8;
-      break;
-    default:
-      m_check_overlap            = check_overlap;
-      m_check_overlap_with_point = check_overlap_with_point;
-      break;
-    }
+    UTILS_ASSERT(
+      DIM == 0 || dim == DIM,
+      "AABBtree::allocate( nbox, dim={} )\n"
+      "the tree is compiled for dim = {}\n",
+      dim, DIM
+    );
 
-    m_rmem.free();
+    m_overlap.setup( dim );
+
+    unmap();
     m_imem.free();
+    m_compressed = false;
 
     m_dim         = dim;
     m_2dim        = 2*dim;
     m_num_objects = nbox;
     m_nmax        = 2*m_num_objects; // estimate max memory usage
 
-    m_rmem.allocate( size_t((m_nmax+m_num_objects)*m_2dim) );
+    allocate_bboxes( m_nmax, m_num_objects );
     m_imem.allocate( size_t(4*m_nmax+m_num_objects) );
 
-    m_bbox_tree = m_rmem( size_t(m_nmax*m_2dim) );
-    m_bbox_objs = m_rmem( size_t(m_num_objects*m_2dim) );
-
     m_father    = m_imem( size_t(m_nmax) );
     m_child     = m_imem( size_t(m_nmax) );
     m_ptr_nodes = m_imem( size_t(m_nmax) );
@@ -443,77 +1216,494 @@ namespace Utils {
     m_child[0]     = -1;
     m_ptr_nodes[0] = 0;
     m_num_nodes[0] = m_num_objects;
+
+    // compact and wide layout are rebuilt by build()
+    m_compact    = nullptr;
+    m_wide_nodes = 0;
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::add_bboxes(
+  AABBtree<Real,DIM>::add_bboxes(
     Real const bbox_min[], integer ldim0,
     Real const bbox_max[], integer ldim1
   ) {
 
+    check_writable( "add_bboxes" );
+
     UTILS_ASSERT(
-      ldim0 >= m_dim && ldim1 >= m_dim,
+      ldim0 >= dim() && ldim1 >= dim(),
       "AABBtree::add_bboxes( bb_min, ldim0={}, bb_max, ldim1={} )\n"
       "must be ldim0, ldim1 >= dim = {}\n",
-      ldim0, ldim1, m_dim
+      ldim0, ldim1, dim()
     );
 
     Real * bb = m_bbox_objs;
     for ( integer i = 0; i < m_num_objects; ++i ) {
-      for ( integer j = 0; j < m_dim; ++j ) {
+      for ( integer j = 0; j < dim(); ++j ) {
         UTILS_ASSERT(
           bbox_min[j] <= bbox_max[j],
           "AABBtree::add_bboxes, bad bbox N.{} max < min", i
         );
       }
-      std::copy_n( bbox_min, m_dim, bb ); bb += m_dim; bbox_min += ldim0;
-      std::copy_n( bbox_max, m_dim, bb ); bb += m_dim; bbox_max += ldim1;
+      std::copy_n( bbox_min, dim(), bb ); bb += dim(); bbox_min += ldim0;
+      std::copy_n( bbox_max, dim(), bb ); bb += dim(); bbox_max += ldim1;
     }
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::replace_bbox(
+  AABBtree<Real,DIM>::replace_bbox(
     Real const bbox_min[],
     Real const bbox_max[],
     integer    ipos
   ) {
+    check_writable( "replace_bbox" );
     UTILS_ASSERT(
       ipos >= 0 && ipos < m_num_objects,
       "AABBtree::replace_bbox( bb_min, bb_max, ipos = {})"
       " ipos must be in [0,{})\n",
       ipos, m_num_objects
     );
-    Real * bb = m_bbox_objs + ipos*m_2dim;
-    for ( integer j = 0; j < m_dim; ++j ) {
+    Real * bb = m_bbox_objs + ipos*dim2();
+    for ( integer j = 0; j < dim(); ++j ) {
       UTILS_ASSERT(
         bbox_min[j] <= bbox_max[j],
         "AABBtree::replace_bbox, bad bbox N.{} max < min", ipos
       );
     }
-    std::copy_n( bbox_min, m_dim, bb );
-    std::copy_n( bbox_max, m_dim, bb+m_dim );
+    std::copy_n( bbox_min, dim(), bb );
+    std::copy_n( bbox_max, dim(), bb+dim() );
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  //
+  // Binned SAH: the centers of the `n` bboxes in `ids` are put in bins along
+  // each axis, the split plane (bin boundary) minimizing
+  //
+  //   surface(left) * n_left + surface(right) * n_right
+  //
+  // is selected and `ids` partitioned.  Return false if no valid split.
+  //
+  template <typename Real, int DIM>
+  bool
+  AABBtree<Real,DIM>::sah_partition(
+    integer        * ids,
+    integer          n,
+    integer        & n_left,
+    BuildWorkspace & bw
+  ) const {
+
+    integer const NBIN = BuildWorkspace::SAH_NBIN;
+
+    // bounds of the centers (times 2)
+    Real * cmin = bw.sah_cb.data();
+    Real * cmax = cmin + dim();
+    for ( integer i = 0; i < n; ++i ) {
+      Real const * bb = obj_bbox( ids[i] );
+      for ( integer j = 0; j < dim(); ++j ) {
+        Real c = bb[j] + bb[dim()+j];
+        if ( i == 0 || c < cmin[j] ) cmin[j] = c;
+        if ( i == 0 || c > cmax[j] ) cmax[j] = c;
+      }
+    }
+
+    integer * cnt   = bw.sah_cnt.data();
+    Real    * bins  = bw.sah_bins.data();  // bbox of the bins
+    Real    * right = bw.sah_right.data(); // surface*count from the right
+    Real    * acc   = bw.sah_acc.data();   // bbox of the sweep
+
+    integer best_dim = -1;
+    integer best_bin = 0;
+    Real    best     = 0;
+
+    for ( integer idim = 0; idim < dim(); ++idim ) {
+      Real len = cmax[idim] - cmin[idim];
+      if ( len <= 0 ) continue;
+      Real scale = NBIN / len;
+      std::fill( cnt, cnt+NBIN, 0 );
+      for ( integer i = 0; i < n; ++i ) {
+        Real const * bb = obj_bbox( ids[i] );
+        integer k = std::min( NBIN-1, integer( (bb[idim] + bb[dim()+idim] - cmin[idim]) * scale ) );
+        Real * bk = bins + k * dim2();
+        if ( cnt[k]++ == 0 ) {
+          copy_n( bb, dim2(), bk );
+        } else {
+          for ( integer j = 0; j < dim(); ++j ) {
+            if ( bk[j]       > bb[j]       ) bk[j]       = bb[j];
+            if ( bk[dim()+j] < bb[dim()+j] ) bk[dim()+j] = bb[dim()+j];
+          }
+        }
+      }
+      // sweep from the right
+      integer nr = 0;
+      for ( integer k = NBIN-1; k > 0; --k ) {
+        Real const * bk = bins + k * dim2();
+        if ( cnt[k] > 0 ) {
+          if ( nr == 0 ) copy_n( bk, dim2(), acc );
+          else for ( integer j = 0; j < dim(); ++j ) {
+            acc[j]       = min( acc[j],       bk[j]       );
+            acc[dim()+j] = max( acc[dim()+j], bk[dim()+j] );
+          }
+          nr += cnt[k];
+        }
+        right[k] = nr > 0 ? nr * bbox_surface( acc, acc+dim(), dim() ) : 0;
+      }
+      // sweep from the left, split between bin k and k+1
+      integer nl = 0;
+      for ( integer k = 0; k < NBIN-1; ++k ) {
+        Real const * bk = bins + k * dim2();
+        if ( cnt[k] > 0 ) {
+          if ( nl == 0 ) copy_n( bk, dim2(), acc );
+          else for ( integer j = 0; j < dim(); ++j ) {
+            acc[j]       = min( acc[j],       bk[j]       );
+            acc[dim()+j] = max( acc[dim()+j], bk[dim()+j] );
+          }
+          nl += cnt[k];
+        }
+        if ( nl == 0 || nl == n ) continue;
+        Real cost = nl * bbox_surface( acc, acc+dim(), dim() ) + right[k+1];
+        if ( best_dim < 0 || cost < best ) {
+          best_dim = idim;
+          best_bin = k;
+          best     = cost;
+        }
+      }
+    }
+
+    if ( best_dim < 0 ) return false;
+
+    Real scale = NBIN / ( cmax[best_dim] - cmin[best_dim] );
+    integer * mid = std::partition(
+      ids, ids + n,
+      [&]( integer id ) {
+        Real const * bb = obj_bbox( id );
+        integer k = std::min( NBIN-1, integer( (bb[best_dim] + bb[dim()+best_dim] - cmin[best_dim]) * scale ) );
+        return k <= best_bin;
+      }
+    );
+    n_left = integer( mid - ids );
+    return true;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Split the node `id_father` (its objects are partitioned in place).
+  // The pair of children is allocated from `pairs` only when the split
+  // is accepted, `bw` is the scratch of the thread.
+  // Return the index of the left child or -1 if the node is a leaf.
+  //
+  template <typename Real, int DIM>
+  typename AABBtree<Real,DIM>::integer
+  AABBtree<Real,DIM>::split_node(
+    integer          id_father,
+    Real             otol,
+    NodePairs      & pairs,
+    BuildWorkspace & bw
+  ) {
+
+    UTILS_ASSERT_DEBUG(
+      id_father < m_nmax,
+      "AABBtree::build, id_father = {} must be less than m_nmax ={}\n",
+      id_father, m_nmax
+    );
+
+    // set no childer for the moment
+    m_child[id_father] = -1;
+
+    // get rectangles id in parent
+    integer num = m_num_nodes[id_father];
+
+    // if few bbox stop splitting
+    if ( num < m_max_num_objects_per_node ) return -1;
+
+    integer  iptr = m_ptr_nodes[id_father];
+    integer * ptr = m_id_nodes + iptr;
+
+    // split plane on longest axis, use euristic
+    Real const * father_min = node_bbox( id_father );
+    Real const * father_max = father_min + dim();
+
+    integer idim = 0;
+    Real    mx   = father_max[0] - father_min[0];
+    for ( integer i = 1; i < dim(); ++i ) {
+      Real mx1 = father_max[i] - father_min[i];
+      if ( mx < mx1 ) { mx = mx1; idim = i; }
+    }
+
+    // if too small bbox stop splitting
+    if ( mx < m_bbox_min_size_tolerance ) return -1;
+
+    Real tol_len = m_bbox_long_edge_ratio * mx;
+    Real sp      = 0;
+
+    // separate short/long and accumulate short baricenter
+    integer n_long  = 0;
+    integer n_short = 0;
+    while ( n_long + n_short < num ) {
+      integer id = ptr[n_long];
+      UTILS_ASSERT_DEBUG(
+        id < m_num_objects,
+        "AABBtree::build, id = {} must be less than m_num_objects ={}\n",
+        id, m_num_objects
+      );
+      Real const * id_min = obj_bbox( id );
+      Real const * id_max = id_min + dim();
+      Real id_len = id_max[idim] - id_min[idim];
+      if ( id_len > tol_len ) {
+        // found long BBOX, increment n_long and update position
+        ++n_long;
+      } else {
+        // found short BBOX, increment n_short and exchange with bottom
+        ++n_short;
+        swap( ptr[n_long], ptr[num-n_short] );
+        sp += id_max[idim] + id_min[idim];
+      }
+    }
+
+    // if split rectangles do not improve search, stop split at this level
+    if ( n_short < 2 ) return -1;
+
+    integer n_left  = 0;
+    integer n_right = 0;
+    integer * sptr  = ptr + n_long; // short bboxes
+
+    if ( m_split_strategy == SplitStrategy::MEDIAN ) {
+
+      // half of the short rectangles on each side of the median center
+      n_left  = n_short/2;
+      n_right = n_short - n_left;
+      std::nth_element(
+        sptr, sptr + n_left, sptr + n_short,
+        [this,idim]( integer a, integer b ) {
+          Real const * ba = obj_bbox( a );
+          Real const * bb = obj_bbox( b );
+          return ba[idim] + ba[dim()+idim] < bb[idim] + bb[dim()+idim];
+        }
+      );
+
+    } else if ( m_split_strategy == SplitStrategy::BINNED_SAH &&
+                sah_partition( sptr, n_short, n_left, bw ) ) {
+
+      n_right = n_short - n_left;
+
+    } else {
+
+      // select the split position: take the mean of the set of
+      // (non-"long") rectangle centers along axis idim
+      sp /= 2*n_short;
+
+      // partition based on centers
+      while ( n_long + n_left + n_right < num ) {
+        integer id = ptr[n_long+n_left];
+        Real const * id_min = obj_bbox( id );
+        Real const * id_max = id_min + dim();
+        Real id_mid = (id_max[idim] + id_min[idim])/2;
+        if ( id_mid < sp ) {
+          ++n_left; // in right position do nothing
+        } else {
+          ++n_right;
+          swap( ptr[n_long+n_left], ptr[num-n_right] );
+        }
+      }
+    }
+
+    // if cannot improve bbox, stop split at this level!
+    if ( n_left == 0 || n_right == 0 ) return -1;
+
+    // compute bbox of left and right child
+    Real * bb_lr       = bw.bb_lr.data();
+    Real * bb_left_min = bb_lr;
+    Real * bb_left_max = bb_left_min + dim();
+    for ( integer i = 0; i < n_left; ++i ) {
+      integer id = ptr[n_long+i];
+      UTILS_ASSERT_DEBUG(
+        id < m_num_objects,
+        "AABBtree::build, id = {} must be less than m_num_objects ={}\n",
+        id, m_num_objects
+      );
+      Real const * bb_id_min = obj_bbox( id );
+      Real const * bb_id_max = bb_id_min + dim();
+      if ( i == 0 ) {
+        copy_n( bb_id_min, dim2(), bb_left_min );
+      } else {
+        for ( integer j = 0; j < dim(); ++j ) {
+          if ( bb_left_min[j] > bb_id_min[j] ) bb_left_min[j] = bb_id_min[j];
+          if ( bb_left_max[j] < bb_id_max[j] ) bb_left_max[j] = bb_id_max[j];
+        }
+      }
+    }
+
+    Real * bb_right_min = bb_lr + dim2();
+    Real * bb_right_max = bb_right_min + dim();
+    for ( integer i = 0; i < n_right; ++i ) {
+      integer id = ptr[n_long+n_left+i];
+      UTILS_ASSERT_DEBUG(
+        id < m_num_objects,
+        "AABBtree::build, id = {} must be less than m_num_objects ={}\n",
+        id, m_num_objects
+      );
+      Real const * bb_id_min = obj_bbox( id );
+      Real const * bb_id_max = bb_id_min + dim();
+      if ( i == 0 ) {
+        copy_n( bb_id_min, dim2(), bb_right_min );
+      } else {
+        for ( integer j = 0; j < dim(); ++j ) {
+          if ( bb_right_min[j] > bb_id_min[j] ) bb_right_min[j] = bb_id_min[j];
+          if ( bb_right_max[j] < bb_id_max[j] ) bb_right_max[j] = bb_id_max[j];
+        }
+      }
+    }
+
+    // check again if split improve the AABBtree otherwise stop exploration
+    if ( n_left < m_max_num_objects_per_node || n_right < m_max_num_objects_per_node ) {
+      // few nodes, check if improve volume
+      Real vo{1};
+      Real vL{1};
+      Real vR{1};
+      for ( integer j = 0l; j < dim(); ++j ) {
+        Real Lmin = bb_left_min[j];
+        Real Lmax = bb_left_max[j];
+        Real Rmin = bb_right_min[j];
+        Real Rmax = bb_right_max[j];
+        vo *= max(min(Lmax,Rmax) - max(Lmin,Rmin), Real(0));
+        vL *= Lmax - Lmin;
+        vR *= Rmax - Rmin;
+      }
+      // if do not improve volume, stop split at this level!
+      if ( vo > (vL+vR-vo)*otol ) return -1;
+    }
+
+    // child indexing
+    integer id_left  = pairs.get();
+    integer id_right = id_left + 1;
+
+    UTILS_ASSERT_DEBUG(
+      id_right < m_nmax,
+      "AABBtree::build, id_right = {} must be less than m_nmax ={}\n",
+      id_right, m_nmax
+    );
+
+    copy_n( bb_lr, 2*dim2(), m_bbox_tree + id_left * dim2() );
+
+    m_father[id_left]  = id_father;
+    m_father[id_right] = id_father;
+    m_child[id_left]   = -1;
+    m_child[id_right]  = -1;
+    m_child[id_father] = id_left;
+
+    m_num_nodes[id_father] = n_long;
+
+    m_ptr_nodes[id_left]  = iptr + n_long;
+    m_num_nodes[id_left]  = n_left;
+
+    m_ptr_nodes[id_right] = iptr + n_long + n_left;
+    m_num_nodes[id_right] = n_right;
+
+    return id_left;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Split recursively the subtree with root `id_root`.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::build_subtree(
+    integer     id_root,
+    Real        otol,
+    NodePairs & pairs
+  ) {
+    BuildWorkspace  bw( dim2() );
+    vector<integer> stack;
+    stack.emplace_back(id_root);
+    while ( !stack.empty() ) {
+      integer id_father = stack.back(); stack.pop_back();
+      integer id_left   = split_node( id_father, otol, pairs, bw );
+      if ( id_left < 0 ) continue;
+      stack.emplace_back(id_left);
+      stack.emplace_back(id_left+1);
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // In the parallel build the pairs of children are numbered in the order
+  // of completion of the splits.  Renumber the nodes in the order of the
+  // serial build (depth first, right child first), so that the tree does
+  // not depend on the scheduling of the threads.
+  // Unreachable nodes (pairs released by a partial rebuild) are dropped.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::renumber_nodes() {
+    integer const nn = m_num_tree_nodes;
+    vector<integer> perm( size_t(nn), -1 ); // old -> new
+    vector<integer> stack;
+    stack.reserve( size_t(nn) );
+    stack.emplace_back(0);
+    perm[0] = 0;
+    integer n_new = 1;
+    while ( !stack.empty() ) {
+      integer id = stack.back(); stack.pop_back();
+      integer nc = m_child[id];
+      if ( nc < 0 ) continue;
+      perm[nc]   = n_new;
+      perm[nc+1] = n_new+1;
+      n_new += 2;
+      stack.emplace_back(nc);
+      stack.emplace_back(nc+1);
+    }
+    UTILS_ASSERT(
+      n_new <= nn,
+      "AABBtree::renumber_nodes, found {} nodes, expected at most {}\n", n_new, nn
+    );
+
+    vector<integer> ibuf( static_cast<size_t>(nn) );
+    auto permute = [&perm,&ibuf,nn,n_new]( integer * v, bool is_index ) {
+      for ( integer i = 0; i < nn; ++i )
+        if ( perm[i] >= 0 )
+          ibuf[perm[i]] = is_index && v[i] >= 0 ? perm[v[i]] : v[i];
+      copy_n( ibuf.data(), n_new, v );
+    };
+    permute( m_father,    true  );
+    permute( m_child,     true  );
+    permute( m_ptr_nodes, false );
+    permute( m_num_nodes, false );
+
+    vector<Real> rbuf( size_t(n_new*dim2()) );
+    for ( integer i = 0; i < nn; ++i )
+      if ( perm[i] >= 0 )
+        copy_n( m_bbox_tree + i*dim2(), dim2(), rbuf.data() + perm[i]*dim2() );
+    copy_n( rbuf.data(), n_new*dim2(), m_bbox_tree );
+
+    m_num_tree_nodes = n_new;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::build() {
+  AABBtree<Real,DIM>::build( ThreadPoolBase * pool ) {
 
-    Real otol{ Real(pow( m_bbox_overlap_tolerance, m_dim )) };
+    check_writable( "build" );
+
+    Real otol{ Real(pow( m_bbox_overlap_tolerance, dim() )) };
 
     // root contains all rectangles, build its bbox
-    for ( integer j = 0; j < m_dim; ++j ) {
+    for ( integer j = 0; j < dim(); ++j ) {
       Real & minj = m_bbox_tree[j];
-      Real & maxj = m_bbox_tree[m_dim+j];
+      Real & maxj = m_bbox_tree[dim()+j];
       Real const * pmin{m_bbox_objs+j};
-      Real const * pmax{m_bbox_objs+j+m_dim};
+      Real const * pmax{m_bbox_objs+j+dim()};
       minj = *pmin;
       maxj = *pmax;
       UTILS_ASSERT0(
@@ -521,8 +1711,8 @@ namespace Utils {
         "AABBtree::build, bad bbox N.0 max < min"
       );
       for ( integer i = 1; i < m_num_objects; ++i ) {
-        pmin += m_2dim;
-        pmax += m_2dim;
+        pmin += dim2();
+        pmax += dim2();
         UTILS_ASSERT(
           *pmax >= *pmin,
           "AABBtree::build, bad bbox N.{} max < min ({} < {})\n",
@@ -533,533 +1723,2316 @@ namespace Utils {
       }
     }
 
-    // main loop: divide nodes until all constraints satisfied
-    m_stack.clear();
-    m_stack.reserve(2*m_num_objects+1);
-    m_stack.emplace_back(0);
-    m_num_tree_nodes = 1;
+    m_father[0] = -1;
+    m_child[0]  = -1;
 
-    while ( !m_stack.empty() ) {
+    NodePairs pairs;
 
-      // pop node from stack
-      integer id_father = m_stack.back(); m_stack.pop_back();
-      UTILS_ASSERT_DEBUG(
-        id_father < m_nmax,
-        "AABBtree::build, id_father = {} must be less than m_nmax ={}\n",
-        id_father, m_nmax
-      );
+    // small tree or no pool: serial build
+    if ( pool == nullptr || pool->thread_count() < 2 || m_num_objects < 4096 ) {
+      build_subtree( 0, otol, pairs );
+      m_num_tree_nodes = pairs.n_nodes;
+      after_build();
+      return;
+    }
 
-      // set no childer for the moment
-      m_child[id_father] = -1;
+    // split the first levels (one task per node) until there are enough
+    // independent subtrees, then build the subtrees in parallel
+    size_t const    n_subtree = size_t(8*pool->thread_count());
+    vector<integer> front{0}, next;
+    while ( !front.empty() && front.size() < n_subtree ) {
+      for ( integer id : front )
+        pool->run( [this,id,otol,&pairs]() {
+          BuildWorkspace bw( dim2() );
+          split_node( id, otol, pairs, bw );
+        } );
+      pool->wait();
+      next.clear();
+      for ( integer id : front ) {
+        integer nc = m_child[id];
+        if ( nc < 0 ) continue;
+        next.emplace_back(nc);
+        next.emplace_back(nc+1);
+      }
+      front.swap(next);
+    }
+    for ( integer id : front )
+      pool->run( [this,id,otol,&pairs]() { build_subtree( id, otol, pairs ); } );
+    pool->wait();
 
-      // get rectangles id in parent
-      integer num = m_num_nodes[id_father];
+    m_num_tree_nodes = pairs.n_nodes;
+    renumber_nodes();
+    after_build();
+  }
 
-      // if few bbox stop splitting
-      if ( num < m_max_num_objects_per_node ) continue;
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      integer  iptr = m_ptr_nodes[id_father];
-      integer * ptr = m_id_nodes + iptr;
+  //
+  // Morton (Z-order) key of a point normalized in [0,1]^dim
+  //
+  template <typename Real>
+  static
+  uint64_t
+  morton_key( Real const x[], int dim ) {
+    int const nbits = std::max( 1, std::min( 21, 63/dim ) );
+    Real const scale = Real( (uint64_t(1) << nbits) - 1 );
+    uint64_t q[64];
+    for ( int j = 0; j < dim; ++j ) {
+      Real t = std::min( std::max( x[j], Real(0) ), Real(1) );
+      q[j] = uint64_t( t * scale );
+    }
+    uint64_t key = 0;
+    for ( int b = nbits-1; b >= 0; --b )
+      for ( int j = 0; j < dim; ++j )
+        key = (key << 1) | ((q[j] >> b) & 1);
+    return key;
+  }
 
-      // split plane on longest axis, use euristic
-      Real const * father_min = m_bbox_tree + id_father * m_2dim;
-      Real const * father_max = father_min + m_dim;
+  //
+  // Number of leading zero bits of `x` (64 for x == 0)
+  //
+  static
+  inline
+  int
+  clz64( uint64_t x ) {
+    if ( x == 0 ) return 64;
+    #if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll( x );
+    #else
+    int n = 0;
+    while ( (x & (uint64_t(1) << 63)) == 0 ) { x <<= 1; ++n; }
+    return n;
+    #endif
+  }
 
-      integer idim = 0;
-      Real    mx   = father_max[0] - father_min[0];
-      for ( integer i = 1; i < m_dim; ++i ) {
-        Real mx1 = father_max[i] - father_min[i];
-        if ( mx < mx1 ) { mx = mx1; idim = i; }
+  //
+  // LSD radix sort (8 bit digits) of `keys`, `ids` are moved with the keys,
+  // only the lowest `nbits` bits of the keys are used.  Each pass computes
+  // the histograms of the chunks, the offsets (digit major, chunk minor)
+  // and scatters the chunks (stable); passes with a single digit are skipped.
+  //
+  static
+  void
+  radix_sort(
+    vector<uint64_t> & keys,
+    vector<int>      & ids,
+    int                nbits,
+    ThreadPoolBase   * pool
+  ) {
+    size_t const n       = keys.size();
+    size_t const nthread = pool == nullptr ? 1 : size_t( std::max( 1u, pool->thread_count() ) );
+    size_t const nchunk  = nthread == 1 || n < 65536 ? 1 : 4*nthread;
+
+    vector<uint64_t> keys2( n );
+    vector<int>      ids2( n );
+    vector<size_t>   count( 256*nchunk );
+
+    auto for_chunks = [&]( std::function<void(size_t,size_t,size_t)> const & fun ) {
+      if ( nchunk == 1 ) { fun( 0, 0, n ); return; }
+      for ( size_t k = 0; k < nchunk; ++k )
+        pool->run( fun, k, (k*n)/nchunk, ((k+1)*n)/nchunk );
+      pool->wait();
+    };
+
+    for ( int shift = 0; shift < nbits; shift += 8 ) {
+      std::fill( count.begin(), count.end(), 0 );
+      for_chunks( [&]( size_t k, size_t i0, size_t i1 ) {
+        size_t * c = count.data() + 256*k;
+        for ( size_t i = i0; i < i1; ++i ) ++c[ (keys[i] >> shift) & 255 ];
+      } );
+
+      size_t pos = 0;
+      bool   one = false;
+      for ( size_t d = 0; d < 256; ++d ) {
+        size_t pos0 = pos;
+        for ( size_t k = 0; k < nchunk; ++k ) {
+          size_t & c = count[256*k+d];
+          size_t   nc = c;
+          c    = pos;
+          pos += nc;
+        }
+        if ( pos - pos0 == n ) one = true;
       }
+      if ( one ) continue;
+
+      for_chunks( [&]( size_t k, size_t i0, size_t i1 ) {
+        size_t * c = count.data() + 256*k;
+        for ( size_t i = i0; i < i1; ++i ) {
+          size_t p = c[ (keys[i] >> shift) & 255 ]++;
+          keys2[p] = keys[i];
+          ids2[p]  = ids[i];
+        }
+      } );
+      keys.swap( keys2 );
+      ids.swap( ids2 );
+    }
+  }
+
+  //
+  // Linear BVH: objects sorted by the Morton key of their center, then the
+  // split of each internal node of the binary radix tree of the keys is found
+  // independently (Karras, "Maximizing parallelism in the construction of
+  // BVHs, octrees, and k-d trees", 2012); equal keys are ordered by position.
+  // The radix tree is emitted top-down in the node arrays (adjacent children)
+  // stopping at ranges with less than m_max_num_objects_per_node objects,
+  // node bboxes are computed bottom-up.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::build_lbvh( ThreadPoolBase * pool ) {
 
-      // if too small bbox stop splitting
-      if ( mx < m_bbox_min_size_tolerance ) continue;
+    check_writable( "build_lbvh" );
 
-      Real tol_len = m_bbox_long_edge_ratio * mx;
-      Real sp      = 0;
+    UTILS_ASSERT(
+      dim() <= 64,
+      "AABBtree::build_lbvh, dim = {} must be <= 64\n", dim()
+    );
 
-      // separate short/long and accumulate short baricenter
-      integer n_long  = 0;
-      integer n_short = 0;
-      while ( n_long + n_short < num ) {
-        integer id = ptr[n_long];
-        UTILS_ASSERT_DEBUG(
-          id < m_num_objects,
-          "AABBtree::build, id = {} must be less than m_num_objects ={}\n",
-          id, m_num_objects
+    integer const n = m_num_objects;
+
+    m_father[0]    = -1;
+    m_child[0]     = -1;
+    m_ptr_nodes[0] = 0;
+    m_num_nodes[0] = n;
+    m_num_tree_nodes = 1;
+    if ( n == 0 ) { after_build(); return; }
+
+    // bbox of the centers
+    vector<Real> cmin( size_t(dim()), std::numeric_limits<Real>::max() );
+    vector<Real> cmax( size_t(dim()), -std::numeric_limits<Real>::max() );
+    for ( integer i = 0; i < n; ++i ) {
+      Real const * bb = obj_bbox( i );
+      for ( integer j = 0; j < dim(); ++j ) {
+        UTILS_ASSERT(
+          bb[dim()+j] >= bb[j],
+          "AABBtree::build_lbvh, bad bbox N.{} max < min ({} < {})\n",
+          i, bb[dim()+j], bb[j]
         );
-        Real const * id_min = m_bbox_objs + id * m_2dim;
-        Real const * id_max = id_min + m_dim;
-        Real id_len = id_max[idim] - id_min[idim];
-        if ( id_len > tol_len ) {
-          // found long BBOX, increment n_long and update position
-          ++n_long;
-        } else {
-          // found short BBOX, increment n_short and exchange with bottom
-          ++n_short;
-          swap( ptr[n_long], ptr[num-n_short] );
-          sp += id_max[idim] + id_min[idim];
+        Real c = bb[j] + bb[dim()+j];
+        if ( cmin[j] > c ) cmin[j] = c;
+        if ( cmax[j] < c ) cmax[j] = c;
+      }
+    }
+
+    integer const nthread = pool == nullptr ? 1 : integer( std::max( 1u, pool->thread_count() ) );
+    integer const nchunk  = nthread == 1 || n < 16384 ? 1 : 4*nthread;
+    auto for_chunks = [&]( std::function<void(integer,integer)> const & fun ) {
+      if ( nchunk == 1 ) { fun( 0, n ); return; }
+      for ( integer k = 0; k < nchunk; ++k )
+        pool->run( fun, integer( (int64_t(k)*n)/nchunk ), integer( (int64_t(k+1)*n)/nchunk ) );
+      pool->wait();
+    };
+
+    // Morton keys of the centers
+    vector<uint64_t> keys( static_cast<size_t>(n) );
+    vector<integer>  ids( static_cast<size_t>(n) );
+    for_chunks( [&]( integer i0, integer i1 ) {
+      Real c[64];
+      for ( integer i = i0; i < i1; ++i ) {
+        Real const * bb = obj_bbox( i );
+        for ( integer j = 0; j < dim(); ++j ) {
+          Real len = cmax[j] - cmin[j];
+          c[j] = len > 0 ? (bb[j] + bb[dim()+j] - cmin[j]) / len : Real(0);
         }
+        keys[i] = morton_key( c, dim() );
+        ids[i]  = i;
       }
+    } );
+    radix_sort( keys, ids, dim() * std::max( 1, std::min( 21, 63/dim() ) ), pool );
+    copy_n( ids.data(), n, m_id_nodes );
+
+    // common prefix of the keys in position i and j, -1 out of range
+    uint64_t const * K = keys.data();
+    auto delta = [K,n]( integer i, integer j ) -> integer {
+      if ( j < 0 || j >= n ) return -1;
+      if ( K[i] == K[j] ) return 32 + clz64( uint64_t(i ^ j) );
+      return clz64( K[i] ^ K[j] );
+    };
+
+    // split position of the internal nodes of the radix tree
+    vector<integer> split( static_cast<size_t>(n) );
+    for_chunks( [&]( integer i0, integer i1 ) {
+      for ( integer i = i0; i < std::min( i1, n-1 ); ++i ) {
+        integer d    = delta( i, i+1 ) > delta( i, i-1 ) ? 1 : -1;
+        integer dmin = delta( i, i-d );
+        integer lmax = 2;
+        while ( delta( i, i+lmax*d ) > dmin ) lmax *= 2;
+        integer l = 0;
+        for ( integer t = lmax/2; t >= 1; t /= 2 )
+          if ( delta( i, i+(l+t)*d ) > dmin ) l += t;
+        integer j     = i + l*d;
+        integer dnode = delta( i, j );
+        integer s     = 0;
+        integer t     = l;
+        do {
+          t = (t+1)/2;
+          if ( delta( i, i+(s+t)*d ) > dnode ) s += t;
+        } while ( t > 1 );
+        split[i] = i + s*d + std::min( d, integer(0) );
+      }
+    } );
+
+    // emit the nodes, range [ptr,ptr+num) of internal node k of the radix tree
+    integer const   nleaf = std::max( m_max_num_objects_per_node, integer(2) );
+    vector<integer> stack;
+    stack.emplace_back(0); // node
+    stack.emplace_back(0); // internal node of the radix tree
+    integer nn = 1;
+    while ( !stack.empty() ) {
+      integer k  = stack.back(); stack.pop_back();
+      integer id = stack.back(); stack.pop_back();
+      integer num = m_num_nodes[id];
+      if ( num < nleaf ) continue;
+      integer ptr = m_ptr_nodes[id];
+      integer sp  = split[k]; // left [ptr,sp], right [sp+1,ptr+num)
+      integer id_left = nn; nn += 2;
+      m_child[id] = id_left;
+      m_num_nodes[id] = 0;
+      for ( integer c = 0; c < 2; ++c ) {
+        m_father[id_left+c]    = id;
+        m_child[id_left+c]     = -1;
+        m_ptr_nodes[id_left+c] = c == 0 ? ptr    : sp+1;
+        m_num_nodes[id_left+c] = c == 0 ? sp+1-ptr : ptr+num-sp-1;
+        stack.emplace_back(id_left+c);
+        stack.emplace_back(sp+c);
+      }
+    }
+    m_num_tree_nodes = nn;
 
-      // if split rectangles do not improve search, stop split at this level
-      if ( n_short < 2 ) continue;
+    refit_nodes( pool );
+    after_build();
+  }
 
-      // select the split position: take the mean of the set of
-      // (non-"long") rectangle centers along axis idim
-      sp /= 2*n_short;
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      // partition based on centers
-      integer n_left  = 0;
-      integer n_right = 0;
+  //
+  // Build the optional layouts and save the quality of the new tree.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::after_build() {
+    if ( m_use_compact   ) build_compact();
+    if ( m_use_wide      ) build_wide();
+    if ( m_use_quantized ) build_quantized();
+    m_build_surface.resize( size_t(m_num_tree_nodes) );
+    for ( integer i = 0; i < m_num_tree_nodes; ++i ) {
+      Real const * bb = node_bbox( i );
+      m_build_surface[i] = bbox_surface( bb, bb+dim(), dim() );
+    }
+    m_build_cost = sah_cost();
+  }
 
-      while ( n_long + n_left + n_right < num ) {
-        integer id = ptr[n_long+n_left];
-        Real const * id_min = m_bbox_objs + id * m_2dim;
-        Real const * id_max = id_min + m_dim;
-        Real id_mid = (id_max[idim] + id_min[idim])/2;
-        if ( id_mid < sp ) {
-          ++n_left; // in right position do nothing
-        } else {
-          ++n_right;
-          swap( ptr[n_long+n_left], ptr[num-n_right] );
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Release the nodes of the subtree with root `id_root` (their pairs are
+  // reused) and split it again.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::rebuild_subtree(
+    integer     id_root,
+    Real        otol,
+    NodePairs & pairs
+  ) {
+    integer         num = 0;
+    vector<integer> stack;
+    stack.emplace_back(id_root);
+    while ( !stack.empty() ) {
+      integer id = stack.back(); stack.pop_back();
+      num += m_num_nodes[id];
+      integer nc = m_child[id];
+      if ( nc < 0 ) continue;
+      pairs.free_pairs.emplace_back(nc);
+      stack.emplace_back(nc);
+      stack.emplace_back(nc+1);
+    }
+    // objects of the subtree are contiguous starting from m_ptr_nodes[id_root]
+    m_num_nodes[id_root] = num;
+    m_child[id_root]     = -1;
+    build_subtree( id_root, otol, pairs );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::refit_node( integer id ) {
+    Real * bb_min = m_bbox_tree + id * dim2();
+    Real * bb_max = bb_min + dim();
+    bool   first  = true;
+    auto join = [&]( Real const * bb ) {
+      if ( first ) {
+        copy_n( bb, dim2(), bb_min );
+        first = false;
+      } else {
+        for ( integer j = 0; j < dim(); ++j ) {
+          if ( bb_min[j] > bb[j]       ) bb_min[j] = bb[j];
+          if ( bb_max[j] < bb[dim()+j] ) bb_max[j] = bb[dim()+j];
+        }
+      }
+    };
+    integer         num = m_num_nodes[id];
+    integer const * ptr = m_id_nodes + m_ptr_nodes[id];
+    for ( integer ii = 0; ii < num; ++ii ) join( obj_bbox( ptr[ii] ) );
+    integer nc = m_child[id];
+    if ( nc > 0 ) {
+      join( node_bbox( nc ) );
+      join( node_bbox( nc+1 ) );
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // The children have index greater than the father, a backward loop is a
+  // bottom-up visit.  In parallel, the nodes are grouped by depth using
+  // m_father and the levels are processed from the deepest one.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::refit_nodes( ThreadPoolBase * pool ) {
+    integer const nn = m_num_tree_nodes;
+    if ( pool == nullptr || pool->thread_count() < 2 || nn < 8192 ) {
+      for ( integer i = nn-1; i >= 0; --i ) refit_node( i );
+    } else {
+      vector<integer> level( static_cast<size_t>(nn) );
+      integer max_level = 0;
+      level[0] = 0;
+      for ( integer i = 1; i < nn; ++i ) {
+        level[i] = level[m_father[i]] + 1;
+        if ( level[i] > max_level ) max_level = level[i];
+      }
+      // nodes sorted by level (counting sort)
+      vector<integer> ptr( size_t(max_level+2), 0 );
+      for ( integer i = 0; i < nn; ++i ) ++ptr[level[i]+1];
+      for ( integer l = 0; l <= max_level; ++l ) ptr[l+1] += ptr[l];
+      vector<integer> by_level( static_cast<size_t>(nn) ), pos( ptr.begin(), ptr.end()-1 );
+      for ( integer i = 0; i < nn; ++i ) by_level[pos[level[i]]++] = i;
+
+      integer const chunk = 1024;
+      for ( integer l = max_level; l >= 0; --l ) {
+        integer i0 = ptr[l];
+        integer i1 = ptr[l+1];
+        if ( i1 - i0 <= chunk ) {
+          for ( integer i = i0; i < i1; ++i ) refit_node( by_level[i] );
+          continue;
         }
+        for ( integer k = i0; k < i1; k += chunk ) {
+          integer k1 = std::min( k+chunk, i1 );
+          pool->run( [this,&by_level,k,k1]() {
+            for ( integer i = k; i < k1; ++i ) refit_node( by_level[i] );
+          } );
+        }
+        pool->wait();
       }
+    }
+  }
 
-      // if cannot improve bbox, stop split at this level!
-      if ( n_left == 0 || n_right == 0 ) continue;
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      // child indexing
-      integer id_left  = m_num_tree_nodes + 0;
-      integer id_right = m_num_tree_nodes + 1;
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::refit( ThreadPoolBase * pool ) {
+    check_writable( "refit" );
+    refit_nodes( pool );
+    if ( m_use_compact   ) build_compact();
+    if ( m_use_wide      ) build_wide();
+    if ( m_use_quantized ) build_quantized();
+  }
 
-      UTILS_ASSERT_DEBUG(
-        id_right < m_nmax,
-        "AABBtree::build, id_right = {} must be less than m_nmax ={}\n",
-        id_right, m_nmax
-      );
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      // compute bbox of left and right child
-      Real * bb_left_min = m_bbox_tree + id_left * m_2dim;
-      Real * bb_left_max = bb_left_min + m_dim;
-      for ( integer i = 0; i < n_left; ++i ) {
-        integer id = ptr[n_long+i];
-        UTILS_ASSERT_DEBUG(
-          id < m_num_objects,
-          "AABBtree::build, id = {} must be less than m_num_objects ={}\n",
-          id, m_num_objects
-        );
-        Real const * bb_id_min = m_bbox_objs + id * m_2dim;
-        Real const * bb_id_max = bb_id_min + m_dim;
-        if ( i == 0 ) {
-          copy_n( bb_id_min, m_2dim, bb_left_min );
-          //copy_n( bb_id_max, m_dim, left_max );
-        } else {
-          for ( integer j = 0; j < m_dim; ++j ) {
-            if ( bb_left_min[j] > bb_id_min[j] ) bb_left_min[j] = bb_id_min[j];
-            if ( bb_left_max[j] < bb_id_max[j] ) bb_left_max[j] = bb_id_max[j];
-          }
+  template <typename Real, int DIM>
+  typename AABBtree<Real,DIM>::integer
+  AABBtree<Real,DIM>::update( Real max_growth, ThreadPoolBase * pool ) {
+
+    check_writable( "update" );
+
+    if ( m_num_tree_nodes == 0 ) return 0;
+
+    refit( pool );
+
+    // select the subtrees closest to the root that grew too much
+    vector<integer> to_rebuild, stack;
+    integer n_objs = 0;
+    stack.emplace_back(0);
+    while ( !stack.empty() ) {
+      integer id = stack.back(); stack.pop_back();
+      Real const * bb = node_bbox( id );
+      Real S  = bbox_surface( bb, bb+dim(), dim() );
+      Real S0 = m_build_surface[id];
+      if ( S > max_growth * S0 ) {
+        to_rebuild.emplace_back(id);
+        // number of objects in the subtree
+        vector<integer> sub{id};
+        while ( !sub.empty() ) {
+          integer is = sub.back(); sub.pop_back();
+          n_objs += m_num_nodes[is];
+          integer nc = m_child[is];
+          if ( nc > 0 ) { sub.emplace_back(nc); sub.emplace_back(nc+1); }
         }
+        continue;
       }
+      integer nc = m_child[id];
+      if ( nc > 0 ) { stack.emplace_back(nc); stack.emplace_back(nc+1); }
+    }
 
-      Real * bb_right_min = m_bbox_tree + id_right * m_2dim;
-      Real * bb_right_max = bb_right_min + m_dim;
-      for ( integer i = 0; i < n_right; ++i ) {
-        integer id = ptr[n_long+n_left+i];
-        UTILS_ASSERT_DEBUG(
-          id < m_num_objects,
-          "AABBtree::build, id = {} must be less than m_num_objects ={}\n",
-          id, m_num_objects
-        );
-        Real const * bb_id_min = m_bbox_objs + id * m_2dim;
-        Real const * bb_id_max = bb_id_min + m_dim;
-        if ( i == 0 ) {
-          copy_n( bb_id_min, m_2dim, bb_right_min );
-          //copy_n( bb_id_max, m_dim, bb_right_max );
-        } else {
-          for ( integer j = 0; j < m_dim; ++j ) {
-            if ( bb_right_min[j] > bb_id_min[j] ) bb_right_min[j] = bb_id_min[j];
-            if ( bb_right_max[j] < bb_id_max[j] ) bb_right_max[j] = bb_id_max[j];
+    if ( to_rebuild.empty() ) return 0;
+
+    if ( to_rebuild.front() == 0 || 2*n_objs > m_num_objects ) {
+      build( pool );
+      return 1;
+    }
+
+    Real      otol{ Real(pow( m_bbox_overlap_tolerance, dim() )) };
+    NodePairs pairs;
+    pairs.n_nodes = m_num_tree_nodes;
+    for ( integer id : to_rebuild ) rebuild_subtree( id, otol, pairs );
+    m_num_tree_nodes = pairs.n_nodes;
+    renumber_nodes();
+    after_build();
+    return integer( to_rebuild.size() );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::set_compact_layout( bool yes ) {
+    check_full_tree( "set_compact_layout" );
+    m_use_compact = yes;
+    if ( yes && m_num_tree_nodes > 0 ) build_compact();
+    if ( !yes ) {
+      m_compact_mem.clear();
+      m_compact_mem.shrink_to_fit();
+      m_compact = nullptr;
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // node layout (4 bytes words):
+  //
+  //   [0] first child (-1 if leaf)  [1] ptr  [2] num
+  //   [3 ... 3+dim)     min bounds (float, rounded down)
+  //   [3+dim...3+2*dim) max bounds (float, rounded up)
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::build_compact() {
+    integer nw = 3 + dim2();
+    m_compact_stride = nw <= 8 ? 8 : 16*((nw+15)/16);
+
+    integer const nn = m_num_tree_nodes;
+    m_compact_mem.resize( size_t( nn*m_compact_stride + 16 ) );
+
+    // align to 64 bytes
+    CompactWord * base = m_compact_mem.data();
+    size_t        mis  = (reinterpret_cast<uintptr_t>(base) % 64) / sizeof(CompactWord);
+    if ( mis > 0 ) base += 16 - mis;
+    m_compact = base;
+
+    // depth first visit, left subtree first, the children of a node are
+    // allocated in two adjacent slots when the node is visited
+    vector<std::pair<integer,integer>> stack; // (node,slot)
+    stack.reserve( size_t(nn) );
+    stack.emplace_back(0,0);
+    integer n_slot = 1;
+    Real const inf = std::numeric_limits<Real>::infinity();
+    while ( !stack.empty() ) {
+      integer id   = stack.back().first;
+      integer slot = stack.back().second;
+      stack.pop_back();
+
+      CompactWord * w = base + slot * m_compact_stride;
+      integer nc = m_child[id];
+      if ( nc > 0 ) {
+        w[0].i = n_slot;
+        stack.emplace_back( nc+1, n_slot+1 );
+        stack.emplace_back( nc,   n_slot   );
+        n_slot += 2;
+      } else {
+        w[0].i = -1;
+      }
+      w[1].i = m_ptr_nodes[id];
+      w[2].i = m_num_nodes[id];
+      Real const * bb = node_bbox( id );
+      for ( integer j = 0; j < dim(); ++j ) {
+        float lo = float(bb[j]);
+        float hi = float(bb[dim()+j]);
+        if ( Real(lo) > bb[j]       ) lo = std::nextafter( lo, float(-inf) );
+        if ( Real(hi) < bb[dim()+j] ) hi = std::nextafter( hi, float(inf) );
+        w[3+j].f       = lo;
+        w[3+dim()+j].f = hi;
+      }
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // 16 bit coordinate `q` in the interval [lo,hi], the end points are exact.
+  // The same expression is used to encode and decode, so the rounded
+  // outward encoding is conservative for the decoded bounds.
+  //
+  template <typename Real>
+  static
+  inline
+  Real
+  dequantize( uint16_t q, Real lo, Real hi ) {
+    if ( q == 0     ) return lo;
+    if ( q == 65535 ) return hi;
+    return lo + (hi-lo)*Real(q)/Real(65535);
+  }
+
+  template <typename Real>
+  static
+  void
+  quantize_bounds(
+    Real       b_lo,
+    Real       b_hi,
+    Real       lo,
+    Real       hi,
+    uint16_t & q_lo,
+    uint16_t & q_hi
+  ) {
+    Real len = hi - lo;
+    if ( !(len > 0) ) { q_lo = 0; q_hi = 65535; return; }
+    Real t_lo = std::floor( (b_lo-lo)/len*Real(65535) );
+    Real t_hi = std::ceil(  (b_hi-lo)/len*Real(65535) );
+    int32_t i_lo = int32_t( std::min( std::max( t_lo, Real(0) ), Real(65535) ) );
+    int32_t i_hi = int32_t( std::min( std::max( t_hi, Real(0) ), Real(65535) ) );
+    while ( i_lo > 0     && dequantize( uint16_t(i_lo), lo, hi ) > b_lo ) --i_lo;
+    while ( i_hi < 65535 && dequantize( uint16_t(i_hi), lo, hi ) < b_hi ) ++i_hi;
+    q_lo = uint16_t(i_lo);
+    q_hi = uint16_t(i_hi);
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::set_quantized_layout( bool yes ) {
+    check_full_tree( "set_quantized_layout" );
+    m_use_quantized = yes;
+    if ( yes && m_num_tree_nodes > 0 ) build_quantized();
+    if ( !yes ) {
+      m_quant_node.clear();   m_quant_node.shrink_to_fit();
+      m_quant_bounds.clear(); m_quant_bounds.shrink_to_fit();
+      m_quant_root.clear();   m_quant_root.shrink_to_fit();
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Same visit of the compact layout, the children of a slot are encoded
+  // in the decoded bbox of the slot (kept for the whole build).
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::build_quantized() {
+    integer const nn = m_num_tree_nodes;
+    m_quant_node.assign( size_t(3*nn), -1 );
+    m_quant_bounds.assign( size_t(nn*dim2()), 0 );
+    m_quant_root.assign( m_bbox_tree, m_bbox_tree + dim2() );
+
+    vector<Real> decoded( size_t(nn*dim2()) );
+    copy_n( m_bbox_tree, dim2(), decoded.data() );
+
+    vector<std::pair<integer,integer>> stack; // (node,slot)
+    stack.reserve( size_t(nn) );
+    stack.emplace_back(0,0);
+    integer n_slot = 1;
+    while ( !stack.empty() ) {
+      integer id   = stack.back().first;
+      integer slot = stack.back().second;
+      stack.pop_back();
+
+      integer * w  = m_quant_node.data() + 3*slot;
+      integer   nc = m_child[id];
+      w[0] = nc > 0 ? n_slot : -1;
+      w[1] = m_ptr_nodes[id];
+      w[2] = m_num_nodes[id];
+      if ( nc <= 0 ) continue;
+
+      Real const * P = decoded.data() + slot * dim2();
+      for ( integer c = 0; c < 2; ++c ) {
+        integer      s  = n_slot + c;
+        Real const * bb = node_bbox( nc+c );
+        uint16_t   * qb = m_quant_bounds.data() + s * dim2();
+        Real       * D  = decoded.data() + s * dim2();
+        for ( integer j = 0; j < dim(); ++j ) {
+          quantize_bounds( bb[j], bb[dim()+j], P[j], P[dim()+j], qb[j], qb[dim()+j] );
+          D[j]       = dequantize( qb[j],       P[j], P[dim()+j] );
+          D[dim()+j] = dequantize( qb[dim()+j], P[j], P[dim()+j] );
+        }
+      }
+      stack.emplace_back( nc+1, n_slot+1 );
+      stack.emplace_back( nc,   n_slot   );
+      n_slot += 2;
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Traversal of the quantized layout: the stack contains pairs of children
+  // with the decoded bbox of their father (in ws.bounds, after a scratch
+  // area for the father and the child being decoded).
+  //
+  template <typename Real, int DIM>
+  template <typename ADD>
+  bool
+  AABBtree<Real,DIM>::quantized_query(
+    Real const  q[],
+    bool        is_point,
+    bool        refine,
+    Workspace & ws,
+    ADD      && add
+  ) const {
+    Real const * q_min = q;
+    Real const * q_max = is_point ? q : q + dim();
+
+    auto add_node = [&]( integer const * w ) {
+      return add_objects( q, is_point, refine, w[2], m_id_nodes + w[1], ws, add );
+    };
+
+    // root
+    check_node( ws );
+    Real const * root = m_quant_root.data();
+    bool overlap = is_point ? overlap_point( q, root )
+                            : overlap_bbox( root, q );
+    if ( !overlap ) return true;
+    integer const * w0 = m_quant_node.data();
+    if ( !add_node( w0 ) ) return false;
+    if ( w0[0] < 0 ) return true;
+
+    vector<integer> & stack  = ws.stack;
+    vector<Real>    & bounds = ws.bounds;
+    integer const     d2     = dim2();
+    stack.clear();
+    bounds.resize( size_t(2*d2) ); // scratch: father, child
+    // push the bbox in the child scratch area, addressed by offset
+    // because the resize can move the buffer
+    auto push = [&]( integer slot ) {
+      size_t k = bounds.size();
+      bounds.resize( k + size_t(d2) );
+      copy_n( bounds.data() + d2, d2, bounds.data() + k );
+      stack.emplace_back( slot );
+    };
+    copy_n( root, d2, bounds.data() + d2 );
+    push( w0[0] );
+    while ( !stack.empty() ) {
+      integer s = stack.back(); stack.pop_back();
+      Real * P = bounds.data();
+      Real * D = P + d2;
+      copy_n( bounds.end() - d2, d2, P );
+      bounds.resize( bounds.size() - size_t(d2) );
+      for ( integer c = 0; c < 2; ++c ) {
+        uint16_t const * qb = m_quant_bounds.data() + (s+c) * d2;
+        check_node( ws );
+        bool ok = true;
+        for ( integer j = 0; j < dim() && ok; ++j ) {
+          D[j]       = dequantize( qb[j],       P[j], P[dim()+j] );
+          D[dim()+j] = dequantize( qb[dim()+j], P[j], P[dim()+j] );
+          ok = q_max[j] >= D[j] && q_min[j] <= D[dim()+j];
+        }
+        if ( !ok ) continue;
+        integer const * w = m_quant_node.data() + 3*(s+c);
+        if ( !add_node( w ) ) return false;
+        if ( w[0] > 0 ) {
+          push( w[0] );
+          P = bounds.data(); // push can move the scratch area
+          D = P + d2;
+        }
+      }
+    }
+    return true;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Keep the layout used by the queries, copy the object indexes (and bboxes)
+  // and the root bbox in new blocks and release the rest.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::compress( bool keep_object_bboxes ) {
+    check_writable( "compress" );
+    UTILS_ASSERT0(
+      m_num_tree_nodes > 0 && ( m_use_compact || m_use_quantized ),
+      "AABBtree::compress, the tree must be built with the compact or the quantized layout\n"
+    );
+
+    set_wide_layout( false );
+    if ( m_use_compact ) set_quantized_layout( false );
+
+    vector<integer> ids( m_id_nodes, m_id_nodes + m_num_objects );
+    vector<Real>    bbs( m_bbox_tree, m_bbox_tree + dim2() );
+    if ( keep_object_bboxes ) bbs.insert( bbs.end(), m_bbox_objs, m_bbox_objs + m_num_objects*dim2() );
+
+    m_imem.free();
+    allocate_bboxes( 1, keep_object_bboxes ? m_num_objects : 0 );
+    m_imem.allocate( ids.size() );
+    m_id_nodes  = m_imem( ids.size() );
+    copy_n( bbs.data(), bbs.size(), m_bbox_tree );
+    copy_n( ids.data(), ids.size(), m_id_nodes );
+
+    m_father    = nullptr;
+    m_child     = nullptr;
+    m_ptr_nodes = nullptr;
+    m_num_nodes = nullptr;
+    m_nmax      = 1;
+    m_build_surface.clear();
+    m_build_surface.shrink_to_fit();
+    m_compressed = true;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::set_wide_layout( bool yes ) {
+    check_full_tree( "set_wide_layout" );
+    m_use_wide = yes;
+    if ( yes && m_num_tree_nodes > 0 ) build_wide();
+    if ( !yes ) {
+      m_wide_nodes = 0;
+      m_wide_bounds.clear(); m_wide_bounds.shrink_to_fit();
+      m_wide_slot.clear();   m_wide_slot.shrink_to_fit();
+      m_wide_child.clear();  m_wide_child.shrink_to_fit();
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // The wide node of the binary node `n` collects its children, a child
+  // without objects of its own is replaced by its children while there are
+  // at most 4 slots.  The root is checked apart.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::build_wide() {
+    m_wide_nodes = 0;
+    m_wide_bounds.clear();
+    m_wide_slot.clear();
+    m_wide_child.clear();
+    if ( m_num_tree_nodes == 0 || m_child[0] < 0 ) return;
+
+    float const inf = std::numeric_limits<float>::infinity();
+
+    vector<std::pair<integer,integer>> stack; // (binary node,wide node)
+    stack.emplace_back( 0, m_wide_nodes++ );
+    while ( !stack.empty() ) {
+      integer n = stack.back().first;
+      integer w = stack.back().second;
+      stack.pop_back();
+
+      integer slot[4];
+      integer ns = 2;
+      slot[0] = m_child[n];
+      slot[1] = slot[0]+1;
+      for ( integer k = 0; k < ns && ns < 4; ++k ) {
+        integer s = slot[k];
+        if ( m_child[s] > 0 && m_num_nodes[s] == 0 ) {
+          slot[k]    = m_child[s];
+          slot[ns++] = m_child[s]+1;
+          --k; // check again the new slot
+        }
+      }
+
+      m_wide_bounds.resize( size_t(m_wide_nodes*8*dim()), 0 );
+      m_wide_slot.resize( size_t(m_wide_nodes*4), -1 );
+      m_wide_child.resize( size_t(m_wide_nodes*4), -1 );
+
+      float   * bmin = m_wide_bounds.data() + w*8*dim();
+      float   * bmax = bmin + 4*dim();
+      integer * wsl  = m_wide_slot.data() + w*4;
+      for ( integer k = 0; k < 4; ++k ) {
+        if ( k >= ns ) {
+          for ( integer j = 0; j < dim(); ++j ) { bmin[4*j+k] = inf; bmax[4*j+k] = -inf; }
+          continue;
+        }
+        integer s = slot[k];
+        wsl[k] = s;
+        Real const * bb = node_bbox( s );
+        for ( integer j = 0; j < dim(); ++j ) {
+          float lo = float(bb[j]);
+          float hi = float(bb[dim()+j]);
+          if ( Real(lo) > bb[j]       ) lo = std::nextafter( lo, -inf );
+          if ( Real(hi) < bb[dim()+j] ) hi = std::nextafter( hi, inf );
+          bmin[4*j+k] = lo;
+          bmax[4*j+k] = hi;
+        }
+        if ( m_child[s] > 0 ) {
+          m_wide_child[w*4+k] = m_wide_nodes;
+          stack.emplace_back( s, m_wide_nodes++ );
+        }
+      }
+    }
+    m_wide_bounds.resize( size_t(m_wide_nodes*8*dim()), 0 );
+    m_wide_slot.resize( size_t(m_wide_nodes*4), -1 );
+    m_wide_child.resize( size_t(m_wide_nodes*4), -1 );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Traversal of the wide layout: the 4 slots of a node are checked together,
+  // float(q) is compared with float bounds, the rounding is monotone so that
+  // no overlap is lost.
+  //
+  template <typename Real, int DIM>
+  template <typename ADD>
+  bool
+  AABBtree<Real,DIM>::wide_query(
+    Real const  q[],
+    bool        is_point,
+    bool        refine,
+    Workspace & ws,
+    ADD      && add
+  ) const {
+    Real const * q_min = q;
+    Real const * q_max = is_point ? q : q + dim();
+
+    auto add_node = [&]( integer s ) {
+      return add_objects( q, is_point, refine, m_num_nodes[s], m_id_nodes + m_ptr_nodes[s], ws, add );
+    };
+
+    // root
+    check_node( ws );
+    bool overlap = is_point ? overlap_point( q, m_bbox_tree )
+                            : overlap_bbox( m_bbox_tree, q );
+    if ( !overlap ) return true;
+    if ( !add_node( 0 ) ) return false;
+    if ( m_wide_nodes == 0 ) return true;
+
+    vector<integer> & stack = ws.stack;
+    stack.clear();
+    stack.emplace_back(0);
+    while ( !stack.empty() ) {
+      integer w = stack.back(); stack.pop_back();
+      float const * bmin = m_wide_bounds.data() + w*8*dim();
+      float const * bmax = bmin + 4*dim();
+      #ifdef UTILS_AABB_TREE_USE_SSE
+      __m128 m = _mm_cmpeq_ps( _mm_setzero_ps(), _mm_setzero_ps() ); // all ones
+      for ( integer j = 0; j < dim(); ++j ) {
+        __m128 lo = _mm_set1_ps( float(q_min[j]) );
+        __m128 hi = _mm_set1_ps( float(q_max[j]) );
+        m = _mm_and_ps( m, _mm_cmple_ps( _mm_loadu_ps( bmin+4*j ), hi ) );
+        m = _mm_and_ps( m, _mm_cmpge_ps( _mm_loadu_ps( bmax+4*j ), lo ) );
+      }
+      int mask = _mm_movemask_ps( m );
+      #else
+      int mask = 0;
+      for ( integer k = 0; k < 4; ++k ) {
+        bool ok = true;
+        for ( integer j = 0; j < dim() && ok; ++j )
+          ok = bmin[4*j+k] <= float(q_max[j]) && bmax[4*j+k] >= float(q_min[j]);
+        if ( ok ) mask |= 1 << k;
+      }
+      #endif
+      integer const * slot  = m_wide_slot.data()  + w*4;
+      integer const * child = m_wide_child.data() + w*4;
+      for ( integer k = 0; k < 4 && slot[k] >= 0; ++k ) {
+        check_node( ws );
+        if ( (mask >> k) & 1 ) {
+          if ( !add_node( slot[k] ) ) return false;
+          if ( child[k] >= 0 ) stack.emplace_back( child[k] );
+        }
+      }
+    }
+    return true;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  template <typename ADD>
+  bool
+  AABBtree<Real,DIM>::layout_query(
+    Real const  q[],
+    bool        is_point,
+    bool        refine,
+    Workspace & ws,
+    ADD      && add,
+    bool      & completed
+  ) const {
+    UTILS_ASSERT0(
+      !refine || m_bbox_objs != nullptr,
+      "AABBtree, refined query on a compressed tree without object bboxes\n"
+    );
+    if ( m_use_wide && m_num_tree_nodes > 0 && (m_wide_nodes > 0 || m_child[0] < 0) ) {
+      completed = wide_query( q, is_point, refine, ws, add );
+      return true;
+    }
+    if ( m_compact != nullptr ) {
+      completed = compact_query( q, is_point, refine, ws, add );
+      return true;
+    }
+    if ( m_use_quantized && !m_quant_node.empty() ) {
+      completed = quantized_query( q, is_point, refine, ws, add );
+      return true;
+    }
+    return false;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  bool
+  AABBtree<Real,DIM>::layout_visit(
+    Real const                           q[],
+    bool                                 is_point,
+    bool                                 refine,
+    Workspace                          & ws,
+    std::function<bool(integer)> const & visit,
+    bool                               & completed
+  ) const {
+    return layout_query( q, is_point, refine, ws, visit, completed );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Candidates of a node of a layout: the `num` objects in `ptr`, checked
+  // with their bboxes if `refine`; false if `add` stopped the query.
+  //
+  template <typename Real, int DIM>
+  template <typename ADD>
+  bool
+  AABBtree<Real,DIM>::add_objects(
+    Real const      q[],
+    bool            is_point,
+    bool            refine,
+    integer         num,
+    integer const * ptr,
+    Workspace     & ws,
+    ADD           & add
+  ) const {
+    using IS_VOID = typename std::is_void<decltype(add(integer(0)))>::type;
+    for ( integer ii = 0; ii < num; ++ii ) {
+      integer s = ptr[ii];
+      if ( refine ) {
+        Real const * bb_s = obj_bbox( s );
+        check_object( ws );
+        bool olap = is_point ? overlap_point( q, bb_s )
+                             : overlap_bbox( bb_s, q );
+        if ( !olap ) continue;
+      }
+      count_hits( ws, 1 );
+      if ( !call_visitor( IS_VOID(), add, s ) ) return false;
+    }
+    return true;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Traversal of the compact layout, `q` is a point or a bbox [min,max].
+  // `add(id)` is called for each candidate, it can return false to stop
+  // the traversal (the function returns false).
+  //
+  template <typename Real, int DIM>
+  template <typename ADD>
+  bool
+  AABBtree<Real,DIM>::compact_query(
+    Real const  q[],
+    bool        is_point,
+    bool        refine,
+    Workspace & ws,
+    ADD      && add
+  ) const {
+    Real const * q_min = q;
+    Real const * q_max = is_point ? q : q + dim();
+    vector<integer> & stack = ws.stack;
+    stack.clear();
+    stack.emplace_back(0);
+    while ( !stack.empty() ) {
+      CompactWord const * w = m_compact + stack.back() * m_compact_stride;
+      stack.pop_back();
+      check_node( ws );
+      float const * b_min = &w[3].f;
+      float const * b_max = b_min + dim();
+      bool overlap = true;
+      for ( integer j = 0; j < dim() && overlap; ++j )
+        overlap = q_max[j] >= b_min[j] && q_min[j] <= b_max[j];
+      if ( !overlap ) continue;
+      if ( !add_objects( q, is_point, refine, w[2].i, m_id_nodes + w[1].i, ws, add ) ) return false;
+      integer nn = w[0].i;
+      if ( nn > 0 ) { stack.emplace_back(nn+1); stack.emplace_back(nn); }
+    }
+    return true;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect_with_one_point(
+    Real const pnt[],
+    AABB_SET & bb_index,
+    Workspace & ws
+  ) const {
+
+    start_query( ws );
+
+    // quick return on empty inputs
+    if ( m_num_tree_nodes == 0 ) return;
+
+    if ( layout_query( pnt, true, false, ws, [&bb_index]( integer id ) { bb_index.insert(id); } ) ) return;
+
+    // descend tree from root
+    ws.stack.clear();
+    ws.stack.reserve(2*m_num_tree_nodes+1);
+    ws.stack.emplace_back(0);
+    while ( !ws.stack.empty() ) {
+      // pop node from stack
+      integer id_father = ws.stack.back(); ws.stack.pop_back();
+
+      // get BBOX
+      Real const * bb_father = node_bbox( id_father );
+
+      check_node( ws );
+      bool overlap = overlap_point( pnt, bb_father );
+
+      // if do not overlap skip
+      if ( !overlap ) continue;
+
+      // get rectangles id in parent
+      count_hits( ws, m_num_nodes[id_father] );
+      this->get_bbox_indexes_of_a_node( id_father, bb_index );
+
+      integer nn = m_child[id_father];
+      if ( nn > 0 ) { // root == 0, children > 0
+        // push on stack children
+        ws.stack.emplace_back(nn);
+        ws.stack.emplace_back(nn+1);
+      }
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect_with_one_point_and_refine(
+    Real const pnt[],
+    AABB_SET & bb_index,
+    Workspace & ws
+  ) const {
+
+    start_query( ws );
+
+    // quick return on empty inputs
+    if ( m_num_tree_nodes == 0 ) return;
+
+    if ( layout_query( pnt, true, true, ws, [&bb_index]( integer id ) { bb_index.insert(id); } ) ) return;
+
+    // descend tree from root
+    ws.stack.clear();
+    ws.stack.reserve(2*m_num_tree_nodes+1);
+    ws.stack.emplace_back(0);
+    while ( !ws.stack.empty() ) {
+      // pop node from stack
+      integer id_father = ws.stack.back(); ws.stack.pop_back();
+
+      // get BBOX
+      Real const * bb_father = node_bbox( id_father );
+
+      check_node( ws );
+      bool overlap = overlap_point( pnt, bb_father );
+
+      // if do not overlap skip
+      if ( !overlap ) continue;
+
+      // refine candidate
+      integer num = this->m_num_nodes[id_father];
+      integer const * ptr = this->m_id_nodes + this->m_ptr_nodes[id_father];
+      for ( integer ii = 0; ii < num; ++ii ) {
+        integer s = ptr[ii];
+        Real const * bb_s = obj_bbox( s );
+        check_object( ws );
+        bool olap = overlap_point( pnt, bb_s );
+        if ( olap ) { count_hits( ws, 1 ); bb_index.insert(s); }
+      }
+
+      integer nn = m_child[id_father];
+      if ( nn > 0 ) { // root == 0, children > 0
+        // push on stack children
+        ws.stack.emplace_back(nn);
+        ws.stack.emplace_back(nn+1);
+      }
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect_with_one_bbox(
+    Real const bbox[],
+    AABB_SET & bb_index,
+    Workspace & ws
+  ) const {
+    start_query( ws );
+
+    // quick return on empty inputs
+    if ( m_num_tree_nodes == 0 ) return;
+
+    if ( layout_query( bbox, false, false, ws, [&bb_index]( integer id ) { bb_index.insert(id); } ) ) return;
+
+    // descend tree from root
+    ws.stack.clear();
+    ws.stack.reserve(2*m_num_tree_nodes+1);
+    ws.stack.emplace_back(0);
+    while ( !ws.stack.empty() ) {
+      // pop node from stack
+      integer id_father = ws.stack.back(); ws.stack.pop_back();
+
+      // get BBOX
+      Real const * bb_father = node_bbox( id_father );
+
+      check_node( ws );
+      bool overlap = overlap_bbox( bb_father, bbox );
+
+      // if do not overlap skip
+      if ( !overlap ) continue;
+
+      // get rectangles id in parent
+      count_hits( ws, m_num_nodes[id_father] );
+      this->get_bbox_indexes_of_a_node( id_father, bb_index );
+
+      integer nn = m_child[id_father];
+      if ( nn > 0 ) { // root == 0, children > 0
+        // push on stack children
+        ws.stack.emplace_back(nn);
+        ws.stack.emplace_back(nn+1);
+      }
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect_with_one_bbox_and_refine(
+    Real const bbox[],
+    AABB_SET & bb_index,
+    Workspace & ws
+  ) const {
+
+    start_query( ws );
+
+    // quick return on empty inputs
+    if ( m_num_tree_nodes == 0 ) return;
+
+    if ( layout_query( bbox, false, true, ws, [&bb_index]( integer id ) { bb_index.insert(id); } ) ) return;
+
+    // descend tree from root
+    ws.stack.clear();
+    ws.stack.reserve(2*m_num_tree_nodes+1);
+    ws.stack.emplace_back(0);
+    while ( !ws.stack.empty() ) {
+      // pop node from stack
+      integer id_father = ws.stack.back(); ws.stack.pop_back();
+
+      // get BBOX
+      Real const * bb_father = node_bbox( id_father );
+
+      check_node( ws );
+      bool overlap = overlap_bbox( bb_father, bbox );
+
+      // if do not overlap skip
+      if ( !overlap ) continue;
+
+      // refine candidate
+      integer num = this->m_num_nodes[id_father];
+      integer const * ptr = this->m_id_nodes + this->m_ptr_nodes[id_father];
+      for ( integer ii = 0; ii < num; ++ii ) {
+        integer s = ptr[ii];
+        Real const * bb_s = obj_bbox( ptr[ii] );
+        check_object( ws );
+        bool olap = overlap_bbox( bb_s, bbox );
+        if ( olap ) { count_hits( ws, 1 ); bb_index.insert(s); }
+      }
+
+      integer nn = m_child[id_father];
+      if ( nn > 0 ) { // root == 0, children > 0
+        // push on stack children
+        ws.stack.emplace_back(nn);
+        ws.stack.emplace_back(nn+1);
+      }
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect(
+    AABBtree<Real,DIM> const & aabb,
+    AABB_MAP                 & bb_index,
+    Workspace                & ws
+  ) const {
+
+    check_full_tree( "intersect" );
+    aabb.check_full_tree( "intersect" );
+
+    start_query( ws );
+
+    // quick return on empty inputs
+    if ( this->m_num_tree_nodes == 0 || aabb.m_num_tree_nodes == 0 ) return;
+
+    // descend tree from root
+    ws.stack.clear();
+    ws.stack.reserve(m_num_tree_nodes+aabb.m_num_tree_nodes+2);
+    ws.stack.emplace_back(0);
+    ws.stack.emplace_back(0);
+    integer n_stack = 2;
+    while ( !ws.stack.empty() ) {
+      // pop node from stack
+      integer root2  = ws.stack.back(); ws.stack.pop_back();
+      integer sroot1 = ws.stack.back(); ws.stack.pop_back();
+      integer root1  = sroot1 >= 0 ? sroot1 : -1-sroot1;
+
+      // check for intersection
+      Real const * bb_root1 = node_bbox( root1 );
+      Real const * bb_root2 = aabb.node_bbox( root2 );
+
+      check_node( ws );
+      bool overlap = overlap_bbox( bb_root1, bb_root2 );
+
+      // if do not overlap skip
+      if ( !overlap ) continue;
+
+      // check if there are elements to check
+      integer nn1 = this->m_num_nodes[root1];
+      integer nn2 = aabb.m_num_nodes[root2];
+      if ( nn1 > 0 && nn2 > 0 ) {
+        count_hits( ws, nn2 );
+        aabb.get_bbox_indexes_of_a_node( root2, bb_index[root1] );
+      }
+
+      integer id_lr1 = sroot1 >= 0 ? m_child[root1] : -1;
+      integer id_lr2 = aabb.m_child[root2];
+
+      UTILS_ASSERT_DEBUG(
+        n_stack+3 < 2*m_nmax,
+        "AABBtree::intersect, n_stack+2 = {} must be less than 2*m_nmax ={}\n",
+        n_stack+2, 2*m_nmax
+      );
+
+      if ( id_lr1 >= 0 ) {
+        ws.stack.emplace_back(id_lr1);   ws.stack.emplace_back(root2);
+        ws.stack.emplace_back(id_lr1+1); ws.stack.emplace_back(root2);
+        if ( nn1 > 0 ) {
+          ws.stack.emplace_back(-1-root1); ws.stack.emplace_back(root2);
+        }
+      } else if ( id_lr2 >= 0 ) {
+        ws.stack.emplace_back(sroot1); ws.stack.emplace_back(id_lr2);
+        ws.stack.emplace_back(sroot1); ws.stack.emplace_back(id_lr2+1);
+      }
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect_and_refine(
+    AABBtree<Real,DIM> const & aabb,
+    AABB_MAP                 & bb_index,
+    Workspace                & ws
+  ) const {
+
+    check_full_tree( "intersect_and_refine" );
+    aabb.check_full_tree( "intersect_and_refine" );
+
+    start_query( ws );
+
+    // quick return on empty inputs
+    if ( this->m_num_tree_nodes == 0 || aabb.m_num_tree_nodes == 0 ) return;
+
+    // descend tree from root
+    ws.stack.clear();
+    ws.stack.reserve(m_num_tree_nodes+aabb.m_num_tree_nodes+2);
+    ws.stack.emplace_back(0);
+    ws.stack.emplace_back(0);
+    while ( !ws.stack.empty() ) {
+      // pop node from stack
+      integer root2  = ws.stack.back(); ws.stack.pop_back();
+      integer sroot1 = ws.stack.back(); ws.stack.pop_back();
+      integer root1  = sroot1 >= 0 ? sroot1 : -1-sroot1;
+
+      // check for intersection
+      Real const * bb_root1 = node_bbox( root1 );
+      Real const * bb_root2 = aabb.node_bbox( root2 );
+
+      check_node( ws );
+      bool overlap = overlap_bbox( bb_root1, bb_root2 );
+
+      // if do not overlap skip
+      if ( !overlap ) continue;
+
+      // check if there are elements to check
+      integer nn1 = this->m_num_nodes[root1];
+      integer nn2 = aabb.m_num_nodes[root2];
+      if ( nn1 > 0 && nn2 > 0 ) {
+        // construct list of intersecting candidated
+        integer const * ptr1 = this->m_id_nodes + this->m_ptr_nodes[root1];
+        integer const * ptr2 = aabb.m_id_nodes + aabb.m_ptr_nodes[root2];
+        for ( integer ii = 0; ii < nn1; ++ii ) {
+          integer s1 = ptr1[ii];
+          Real const * bb_s1 = obj_bbox( s1 );
+          AABB_SET & BB = bb_index[s1];
+          for ( integer jj = 0; jj < nn2; ++jj ) {
+            integer s2 = ptr2[jj];
+            Real const * bb_s2 = aabb.obj_bbox( s2 );
+            check_object( ws );
+            bool olap = overlap_bbox( bb_s1, bb_s2 );
+            //if ( olap ) bb_index[s1].insert(s2);
+            if ( olap ) { count_hits( ws, 1 ); BB.insert(s2); }
+          }
+        }
+      }
+
+      integer id_lr1 = sroot1 >= 0 ? m_child[root1] : -1;
+      integer id_lr2 = aabb.m_child[root2];
+
+      if ( id_lr1 >= 0 ) {
+        ws.stack.emplace_back(id_lr1);   ws.stack.emplace_back(root2);
+        ws.stack.emplace_back(id_lr1+1); ws.stack.emplace_back(root2);
+        if ( nn1 > 0 ) {
+          ws.stack.emplace_back(-1-root1); ws.stack.emplace_back(root2);
+        }
+      } else if ( id_lr2 >= 0 ) {
+        ws.stack.emplace_back(sroot1); ws.stack.emplace_back(id_lr2);
+        ws.stack.emplace_back(sroot1); ws.stack.emplace_back(id_lr2+1);
+      }
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::collect_with_point(
+    Real const        pnt[],
+    bool              refine,
+    Workspace       & ws,
+    vector<integer> & out
+  ) const {
+    if ( layout_query( pnt, true, refine, ws, [&out]( integer id ) { out.emplace_back(id); } ) ) return;
+    vector<integer> & stack = ws.stack;
+    stack.clear();
+    stack.emplace_back(0);
+    while ( !stack.empty() ) {
+      integer id_father = stack.back(); stack.pop_back();
+      check_node( ws );
+      if ( !overlap_point( pnt, node_bbox( id_father ) ) ) continue;
+      integer         num = m_num_nodes[id_father];
+      integer const * ptr = m_id_nodes + m_ptr_nodes[id_father];
+      if ( refine ) {
+        for ( integer ii = 0; ii < num; ++ii ) {
+          check_object( ws );
+          if ( overlap_point( pnt, obj_bbox( ptr[ii] ) ) ) {
+            count_hits( ws, 1 );
+            out.emplace_back( ptr[ii] );
           }
         }
+      } else {
+        count_hits( ws, num );
+        out.insert( out.end(), ptr, ptr+num );
       }
+      integer nn = m_child[id_father];
+      if ( nn > 0 ) { stack.emplace_back(nn); stack.emplace_back(nn+1); }
+    }
+  }
 
-      // check again if split improve the AABBtree otherwise stop exploration
-      if ( n_left < m_max_num_objects_per_node || n_right < m_max_num_objects_per_node ) {
-        // few nodes, check if improve volume
-        Real vo{1};
-        Real vL{1};
-        Real vR{1};
-        for ( integer j = 0l; j < m_dim; ++j ) {
-          Real Lmin = bb_left_min[j];
-          Real Lmax = bb_left_max[j];
-          Real Rmin = bb_right_min[j];
-          Real Rmax = bb_right_max[j];
-          vo *= max(min(Lmax,Rmax) - max(Lmin,Rmin), Real(0));
-          vL *= Lmax - Lmin;
-          vR *= Rmax - Rmin;
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::collect_with_bbox(
+    Real const        bbox[],
+    bool              refine,
+    Workspace       & ws,
+    vector<integer> & out
+  ) const {
+    if ( layout_query( bbox, false, refine, ws, [&out]( integer id ) { out.emplace_back(id); } ) ) return;
+    vector<integer> & stack = ws.stack;
+    stack.clear();
+    stack.emplace_back(0);
+    while ( !stack.empty() ) {
+      integer id_father = stack.back(); stack.pop_back();
+      check_node( ws );
+      if ( !overlap_bbox( node_bbox( id_father ), bbox ) ) continue;
+      integer         num = m_num_nodes[id_father];
+      integer const * ptr = m_id_nodes + m_ptr_nodes[id_father];
+      if ( refine ) {
+        for ( integer ii = 0; ii < num; ++ii ) {
+          check_object( ws );
+          if ( overlap_bbox( obj_bbox( ptr[ii] ), bbox ) ) {
+            count_hits( ws, 1 );
+            out.emplace_back( ptr[ii] );
+          }
         }
-        // if do not improve volume, stop split at this level!
-        if ( vo > (vL+vR-vo)*otol ) continue;
+      } else {
+        count_hits( ws, num );
+        out.insert( out.end(), ptr, ptr+num );
       }
+      integer nn = m_child[id_father];
+      if ( nn > 0 ) { stack.emplace_back(nn); stack.emplace_back(nn+1); }
+    }
+  }
 
-      // push child nodes onto stack
-      m_father[id_left]  = id_father;
-      m_father[id_right] = id_father;
-      m_child[id_father] = id_left;
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect_with_one_point(
+    Real const        pnt[],
+    vector<integer> & out,
+    Workspace       & ws
+  ) const {
+    start_query( ws );
+    out.clear();
+    if ( m_num_tree_nodes > 0 ) collect_with_point( pnt, false, ws, out );
+  }
 
-      m_num_nodes[id_father] = n_long;
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      m_ptr_nodes[id_left]  = iptr + n_long;
-      m_num_nodes[id_left]  = n_left;
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect_with_one_point_and_refine(
+    Real const        pnt[],
+    vector<integer> & out,
+    Workspace       & ws
+  ) const {
+    start_query( ws );
+    out.clear();
+    if ( m_num_tree_nodes > 0 ) collect_with_point( pnt, true, ws, out );
+  }
 
-      m_ptr_nodes[id_right] = iptr + n_long + n_left;
-      m_num_nodes[id_right] = n_right;
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      m_stack.emplace_back(id_left);
-      m_stack.emplace_back(id_right);
-      m_num_tree_nodes += 2;
-    }
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect_with_one_bbox(
+    Real const        bbox[],
+    vector<integer> & out,
+    Workspace       & ws
+  ) const {
+    start_query( ws );
+    out.clear();
+    if ( m_num_tree_nodes > 0 ) collect_with_bbox( bbox, false, ws, out );
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::intersect_with_one_point(
-    Real const pnt[],
-    AABB_SET & bb_index
+  AABBtree<Real,DIM>::intersect_with_one_bbox_and_refine(
+    Real const        bbox[],
+    vector<integer> & out,
+    Workspace       & ws
   ) const {
+    start_query( ws );
+    out.clear();
+    if ( m_num_tree_nodes > 0 ) collect_with_bbox( bbox, true, ws, out );
+  }
 
-    m_num_check = 0;
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-    // quick return on empty inputs
-    if ( m_num_tree_nodes == 0 ) return;
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect(
+    AABBtree<Real,DIM> const & aabb,
+    AABB_PAIRS               & out,
+    Workspace                & ws
+  ) const {
+    out.clear();
+    visit_tree( aabb, false, [&out]( integer i, integer j ) { out.emplace_back( i, j ); }, ws );
+  }
 
-    // descend tree from root
-    m_stack.clear();
-    m_stack.reserve(2*m_num_tree_nodes+1);
-    m_stack.emplace_back(0);
-    while ( !m_stack.empty() ) {
-      // pop node from stack
-      integer id_father = m_stack.back(); m_stack.pop_back();
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      // get BBOX
-      Real const * bb_father = m_bbox_tree + id_father * m_2dim;
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect_and_refine(
+    AABBtree<Real,DIM> const & aabb,
+    AABB_PAIRS               & out,
+    Workspace                & ws
+  ) const {
+    out.clear();
+    visit_tree( aabb, true, [&out]( integer i, integer j ) { out.emplace_back( i, j ); }, ws );
+  }
 
-      ++m_num_check;
-      bool overlap = m_check_overlap_with_point( pnt, bb_father, m_dim );
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      // if do not overlap skip
-      if ( !overlap ) continue;
+  //
+  // Merge the sorted buffers in `pairs` (sorted, without repetitions)
+  //
+  static
+  void
+  merge_sorted_pairs(
+    vector<vector<std::pair<int,int>>> & buffer,
+    vector<std::pair<int,int>>         & pairs
+  ) {
+    size_t ntot = 0;
+    for ( auto const & b : buffer ) ntot += b.size();
+    pairs.clear();
+    pairs.reserve( ntot );
+    vector<size_t> runs;
+    runs.emplace_back(0);
+    for ( auto & b : buffer ) {
+      if ( b.empty() ) continue;
+      pairs.insert( pairs.end(), b.begin(), b.end() );
+      runs.emplace_back( pairs.size() );
+      vector<std::pair<int,int>>().swap( b );
+    }
+    while ( runs.size() > 2 ) {
+      vector<size_t> merged;
+      merged.emplace_back(0);
+      for ( size_t r = 1; r < runs.size(); r += 2 ) {
+        if ( r+1 < runs.size() ) {
+          std::inplace_merge( pairs.begin()+runs[r-1], pairs.begin()+runs[r], pairs.begin()+runs[r+1] );
+          merged.emplace_back( runs[r+1] );
+        } else {
+          merged.emplace_back( runs[r] );
+        }
+      }
+      runs.swap( merged );
+    }
+    pairs.erase( std::unique( pairs.begin(), pairs.end() ), pairs.end() );
+  }
 
-      // get rectangles id in parent
-      this->get_bbox_indexes_of_a_node( id_father, bb_index );
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      integer nn = m_child[id_father];
-      if ( nn > 0 ) { // root == 0, children > 0
-        // push on stack children
-        m_stack.emplace_back(nn);
-        m_stack.emplace_back(nn+1);
+  //
+  // Expand breadth first the node pairs (sroot1,root2) of the traversal of
+  // `intersect` until there are at least `npairs` of them. The objects of
+  // the expanded pairs are checked here and added to `top`.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::expand_pairs(
+    AABBtree<Real,DIM> const & aabb,
+    bool                       refine,
+    integer                    npairs,
+    vector<integer>          & level,
+    AABB_PAIRS               & top
+  ) const {
+    vector<integer> next;
+    while ( !level.empty() && integer(level.size()/2) < npairs ) {
+      next.clear();
+      for ( size_t k = 0; k < level.size(); k += 2 ) {
+        integer sroot1 = level[k];
+        integer root2  = level[k+1];
+        integer root1  = sroot1 >= 0 ? sroot1 : -1-sroot1;
+        if ( !overlap_bbox( node_bbox( root1 ), aabb.node_bbox( root2 ) ) ) continue;
+
+        integer id_lr1 = sroot1 >= 0 ? m_child[root1] : -1;
+        integer id_lr2 = aabb.m_child[root2];
+        integer nn1 = m_num_nodes[root1];
+        integer nn2 = aabb.m_num_nodes[root2];
+        // with children the objects of root1 are checked by the pair (-1-root1,root2)
+        if ( nn1 > 0 && nn2 > 0 && id_lr1 < 0 ) {
+          integer const * ptr1 = m_id_nodes + m_ptr_nodes[root1];
+          integer const * ptr2 = aabb.m_id_nodes + aabb.m_ptr_nodes[root2];
+          for ( integer ii = 0; ii < nn1; ++ii ) {
+            Real const * bb_s1 = obj_bbox( ptr1[ii] );
+            for ( integer jj = 0; jj < nn2; ++jj ) {
+              if ( refine && !overlap_bbox( bb_s1, aabb.obj_bbox( ptr2[jj] ) ) ) continue;
+              top.emplace_back( ptr1[ii], ptr2[jj] );
+            }
+          }
+        }
+
+        if ( id_lr1 >= 0 ) {
+          next.emplace_back(id_lr1);   next.emplace_back(root2);
+          next.emplace_back(id_lr1+1); next.emplace_back(root2);
+          if ( nn1 > 0 ) { next.emplace_back(-1-root1); next.emplace_back(root2); }
+        } else if ( id_lr2 >= 0 ) {
+          next.emplace_back(sroot1); next.emplace_back(id_lr2);
+          next.emplace_back(sroot1); next.emplace_back(id_lr2+1);
+        }
       }
+      level.swap( next );
     }
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::intersect_with_one_point_and_refine(
-    Real const pnt[],
-    AABB_SET & bb_index
+  AABBtree<Real,DIM>::intersect_pairs(
+    AABBtree<Real,DIM> const & aabb,
+    AABB_PAIRS               & pairs,
+    bool                       refine,
+    ThreadPoolBase           * pool
   ) const {
 
-    m_num_check = 0;
+    check_full_tree( "intersect_pairs" );
+    aabb.check_full_tree( "intersect_pairs" );
+
+    pairs.clear();
+    if ( m_num_tree_nodes == 0 || aabb.m_num_tree_nodes == 0 ) return;
+
+    // (node,object) from the traversal -> (object,object)
+    auto add_to = [this,refine]( AABB_PAIRS & out ) {
+      return [this,refine,&out]( integer i, integer j ) {
+        if ( refine ) { out.emplace_back( i, j ); return; }
+        integer const * ptr = m_id_nodes + m_ptr_nodes[i];
+        for ( integer ii = 0; ii < m_num_nodes[i]; ++ii ) out.emplace_back( ptr[ii], j );
+      };
+    };
+
+    integer nthread = pool == nullptr ? 1 : integer( std::max( 1u, pool->thread_count() ) );
+    if ( nthread == 1 ) {
+      visit_tree_from( aabb, 0, 0, refine, add_to( pairs ), thread_workspace() );
+      std::sort( pairs.begin(), pairs.end() );
+      pairs.erase( std::unique( pairs.begin(), pairs.end() ), pairs.end() );
+      return;
+    }
 
-    // quick return on empty inputs
-    if ( m_num_tree_nodes == 0 ) return;
+    // expand the top levels of the traversal
+    vector<integer> level{ 0, 0 };
+    AABB_PAIRS      top;
+    expand_pairs( aabb, refine, 8*nthread, level, top );
 
-    // descend tree from root
-    m_stack.clear();
-    m_stack.reserve(2*m_num_tree_nodes+1);
-    m_stack.emplace_back(0);
-    while ( !m_stack.empty() ) {
-      // pop node from stack
-      integer id_father = m_stack.back(); m_stack.pop_back();
+    // one task (and one buffer) for each node pair
+    integer            npairs = integer(level.size()/2);
+    vector<AABB_PAIRS> buffer( static_cast<size_t>(npairs+1) );
+    buffer[npairs].swap( top );
 
-      // get BBOX
-      Real const * bb_father = m_bbox_tree + id_father * m_2dim;
+    auto do_pair = [&]( integer k ) {
+      AABB_PAIRS & out = buffer[k];
+      visit_tree_from( aabb, level[2*k], level[2*k+1], refine, add_to( out ), thread_workspace() );
+      std::sort( out.begin(), out.end() );
+    };
 
-      ++m_num_check;
-      bool overlap = m_check_overlap_with_point( pnt, bb_father, m_dim );
+    for ( integer k = 0; k < npairs; ++k ) pool->run( do_pair, k );
+    std::sort( buffer[npairs].begin(), buffer[npairs].end() );
+    pool->wait();
 
-      // if do not overlap skip
-      if ( !overlap ) continue;
+    merge_sorted_pairs( buffer, pairs );
+  }
 
-      // refine candidate
-      integer num = this->m_num_nodes[id_father];
-      integer const * ptr = this->m_id_nodes + this->m_ptr_nodes[id_father];
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Self intersection of the subtree `root`: for each node the pairs of its
+  // objects, its objects against the subtrees of the children and the
+  // subtree of the left child against the one of the right child.
+  // The node pairs (sroot1,root2) of the dual traversals are appended to
+  // `cross`, the pairs inside the nodes to `out`.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::self_pairs_subtree(
+    integer           root,
+    integer           max_depth,
+    bool              refine,
+    vector<integer> & cross,
+    vector<integer> & roots,
+    AABB_PAIRS      & out
+  ) const {
+    vector<std::pair<integer,integer>> stack; // (node,depth)
+    stack.emplace_back( root, 0 );
+    while ( !stack.empty() ) {
+      integer id    = stack.back().first;
+      integer depth = stack.back().second;
+      stack.pop_back();
+      if ( depth >= max_depth ) { roots.emplace_back(id); continue; }
+
+      integer         num = m_num_nodes[id];
+      integer const * ptr = m_id_nodes + m_ptr_nodes[id];
       for ( integer ii = 0; ii < num; ++ii ) {
-        integer s = ptr[ii];
-        Real const * bb_s = m_bbox_objs + s * m_2dim;
-        ++m_num_check;
-        bool olap = m_check_overlap_with_point( pnt, bb_s, m_dim );
-        if ( olap ) bb_index.insert(s);
+        Real const * bb_s1 = obj_bbox( ptr[ii] );
+        for ( integer jj = ii+1; jj < num; ++jj ) {
+          if ( refine && !overlap_bbox( bb_s1, obj_bbox( ptr[jj] ) ) ) continue;
+          out.emplace_back( std::minmax( ptr[ii], ptr[jj] ) );
+        }
       }
 
-      integer nn = m_child[id_father];
-      if ( nn > 0 ) { // root == 0, children > 0
-        // push on stack children
-        m_stack.emplace_back(nn);
-        m_stack.emplace_back(nn+1);
+      integer nn = m_child[id];
+      if ( nn > 0 ) {
+        cross.emplace_back(nn); cross.emplace_back(nn+1);
+        if ( num > 0 ) {
+          cross.emplace_back(-1-id); cross.emplace_back(nn);
+          cross.emplace_back(-1-id); cross.emplace_back(nn+1);
+        }
+        stack.emplace_back( nn,   depth+1 );
+        stack.emplace_back( nn+1, depth+1 );
       }
     }
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::intersect_with_one_bbox(
-    Real const bbox[],
-    AABB_SET & bb_index
+  AABBtree<Real,DIM>::self_intersect_pairs(
+    AABB_PAIRS     & pairs,
+    bool             refine,
+    ThreadPoolBase * pool
   ) const {
-    m_num_check = 0;
 
-    // quick return on empty inputs
+    check_full_tree( "self_intersect_pairs" );
+
+    pairs.clear();
     if ( m_num_tree_nodes == 0 ) return;
 
-    // descend tree from root
-    m_stack.clear();
-    m_stack.reserve(2*m_num_tree_nodes+1);
-    m_stack.emplace_back(0);
-    while ( !m_stack.empty() ) {
-      // pop node from stack
-      integer id_father = m_stack.back(); m_stack.pop_back();
+    // (node,object) or (object,object) of disjoint subtrees -> ordered pair
+    auto add_to = [this,refine]( AABB_PAIRS & out ) {
+      return [this,refine,&out]( integer i, integer j ) {
+        if ( refine ) { out.emplace_back( std::minmax( i, j ) ); return; }
+        integer const * ptr = m_id_nodes + m_ptr_nodes[i];
+        for ( integer ii = 0; ii < m_num_nodes[i]; ++ii ) out.emplace_back( std::minmax( ptr[ii], j ) );
+      };
+    };
+
+    integer nthread = pool == nullptr ? 1 : integer( std::max( 1u, pool->thread_count() ) );
+    if ( nthread == 1 ) {
+      vector<integer> cross, roots;
+      self_pairs_subtree( 0, std::numeric_limits<integer>::max(), refine, cross, roots, pairs );
+      Workspace & ws = thread_workspace();
+      for ( size_t k = 0; k < cross.size(); k += 2 )
+        visit_tree_from( *this, cross[k], cross[k+1], refine, add_to( pairs ), ws );
+      std::sort( pairs.begin(), pairs.end() );
+      pairs.erase( std::unique( pairs.begin(), pairs.end() ), pairs.end() );
+      return;
+    }
 
-      // get BBOX
-      Real const * bb_father = m_bbox_tree + id_father * m_2dim;
+    // the first levels give subtrees (self tasks) and node pairs
+    // (dual traversal tasks, expanded until there are enough of them)
+    integer ntask     = 8*nthread;
+    integer max_depth = 0;
+    while ( (integer(1) << max_depth) < ntask ) ++max_depth;
+
+    vector<integer> cross, roots;
+    AABB_PAIRS      top;
+    self_pairs_subtree( 0, max_depth, refine, cross, roots, top );
+    expand_pairs( *this, refine, ntask, cross, top );
+    for ( auto & p : top ) if ( p.first > p.second ) std::swap( p.first, p.second );
+
+    integer            nroots = integer(roots.size());
+    integer            npairs = integer(cross.size()/2);
+    vector<AABB_PAIRS> buffer( static_cast<size_t>(nroots+npairs+1) );
+    buffer.back().swap( top );
+
+    auto do_root = [&]( integer k ) {
+      AABB_PAIRS & out = buffer[k];
+      vector<integer> cr, rt;
+      self_pairs_subtree( roots[k], std::numeric_limits<integer>::max(), refine, cr, rt, out );
+      Workspace & ws = thread_workspace();
+      for ( size_t j = 0; j < cr.size(); j += 2 )
+        visit_tree_from( *this, cr[j], cr[j+1], refine, add_to( out ), ws );
+      std::sort( out.begin(), out.end() );
+    };
+
+    auto do_pair = [&]( integer k ) {
+      AABB_PAIRS & out = buffer[nroots+k];
+      visit_tree_from( *this, cross[2*k], cross[2*k+1], refine, add_to( out ), thread_workspace() );
+      std::sort( out.begin(), out.end() );
+    };
+
+    for ( integer k = 0; k < nroots; ++k ) pool->run( do_root, k );
+    for ( integer k = 0; k < npairs; ++k ) pool->run( do_pair, k );
+    std::sort( buffer.back().begin(), buffer.back().end() );
+    pool->wait();
+
+    merge_sorted_pairs( buffer, pairs );
+  }
 
-      ++m_num_check;
-      bool overlap = m_check_overlap( bb_father, bbox, m_dim );
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      // if do not overlap skip
-      if ( !overlap ) continue;
+  //
+  // Queries are sorted by Morton code of their center (nearby queries visit
+  // the same nodes) and split in chunks, each chunk collect its candidates in
+  // a local buffer; then offsets are computed and the buffers are copied.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::batch_query(
+    integer                                                   nq,
+    std::function<void(integer,Real[])>               const & center,
+    std::function<void(integer,Workspace&,vector<integer>&)> const & query,
+    vector<integer>                                         & offset,
+    vector<integer>                                         & index,
+    ThreadPoolBase                                          * pool,
+    BatchStats                                              * stats
+  ) const {
 
-      // get rectangles id in parent
-      this->get_bbox_indexes_of_a_node( id_father, bb_index );
+    offset.assign( size_t(nq+1), 0 );
+    index.clear();
+    if ( nq == 0 || m_num_tree_nodes == 0 ) return;
 
-      integer nn = m_child[id_father];
-      if ( nn > 0 ) { // root == 0, children > 0
-        // push on stack children
-        m_stack.emplace_back(nn);
-        m_stack.emplace_back(nn+1);
+    UTILS_ASSERT(
+      dim() <= 64,
+      "AABBtree::batch_query, dim = {} must be <= 64\n", dim()
+    );
+
+    // sort queries by Morton code inside the root bbox
+    vector<std::pair<uint64_t,integer>> order( static_cast<size_t>(nq) );
+    {
+      Real const * rmin = m_bbox_tree;
+      Real const * rmax = m_bbox_tree + dim();
+      Real c[64];
+      for ( integer i = 0; i < nq; ++i ) {
+        center( i, c );
+        for ( integer j = 0; j < dim(); ++j ) {
+          Real len = rmax[j] - rmin[j];
+          c[j] = len > 0 ? (c[j] - rmin[j]) / len : Real(0);
+        }
+        order[i] = std::make_pair( morton_key( c, dim() ), i );
+      }
+      std::sort( order.begin(), order.end() );
+    }
+
+    // chunks of queries
+    integer nthread = pool == nullptr ? 1 : integer( std::max( 1u, pool->thread_count() ) );
+    integer nchunk  = std::min( nq, nthread == 1 ? 1 : 8*nthread );
+    vector<vector<integer>> ids( static_cast<size_t>(nchunk) );
+    vector<BatchStats>      chunk_stats( stats == nullptr ? 0 : static_cast<size_t>(nchunk) );
+
+    auto do_chunk = [&]( integer k ) {
+      Workspace ws;
+      ws.collect_stats = stats != nullptr;
+      vector<integer> & out = ids[k];
+      integer i0 = integer( (int64_t(k)*nq)/nchunk );
+      integer i1 = integer( (int64_t(k+1)*nq)/nchunk );
+      for ( integer i = i0; i < i1; ++i ) {
+        integer iq = order[i].second;
+        size_t  n0 = out.size();
+        start_query( ws );
+        query( iq, ws, out );
+        std::sort( out.begin()+n0, out.end() );
+        offset[iq+1] = integer( out.size() - n0 );
+        if ( ws.collect_stats ) chunk_stats[k].add( ws.stats );
+      }
+    };
+
+    if ( pool == nullptr || nchunk == 1 ) {
+      for ( integer k = 0; k < nchunk; ++k ) do_chunk( k );
+    } else {
+      for ( integer k = 0; k < nchunk; ++k ) pool->run( do_chunk, k );
+      pool->wait();
+    }
+    for ( BatchStats const & b : chunk_stats ) stats->merge( b );
+
+    // offsets in query order
+    for ( integer i = 0; i < nq; ++i ) offset[i+1] += offset[i];
+    index.resize( size_t(offset[nq]) );
+
+    // scatter the buffers
+    auto do_copy = [&]( integer k ) {
+      integer const * src = ids[k].data();
+      integer i0 = integer( (int64_t(k)*nq)/nchunk );
+      integer i1 = integer( (int64_t(k+1)*nq)/nchunk );
+      for ( integer i = i0; i < i1; ++i ) {
+        integer iq = order[i].second;
+        integer n  = offset[iq+1] - offset[iq];
+        std::copy_n( src, n, index.data() + offset[iq] );
+        src += n;
       }
+    };
+
+    if ( pool == nullptr || nchunk == 1 ) {
+      for ( integer k = 0; k < nchunk; ++k ) do_copy( k );
+    } else {
+      for ( integer k = 0; k < nchunk; ++k ) pool->run( do_copy, k );
+      pool->wait();
     }
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::intersect_with_one_bbox_and_refine(
-    Real const bbox[],
-    AABB_SET & bb_index
+  AABBtree<Real,DIM>::intersect_with_points(
+    Real const        pnts[],
+    integer           ldim,
+    integer           npts,
+    vector<integer> & offset,
+    vector<integer> & index,
+    bool              refine,
+    ThreadPoolBase  * pool,
+    BatchStats      * stats
   ) const {
+    UTILS_ASSERT(
+      ldim >= dim() && npts >= 0,
+      "AABBtree::intersect_with_points( pnts, ldim={}, npts={}, ... )\n"
+      "must be ldim >= dim = {} and npts >= 0\n",
+      ldim, npts, dim()
+    );
+    batch_query(
+      npts,
+      [&]( integer i, Real c[] ) { std::copy_n( pnts + i*ldim, dim(), c ); },
+      [&]( integer i, Workspace & ws, vector<integer> & out ) {
+        collect_with_point( pnts + i*ldim, refine, ws, out );
+      },
+      offset, index, pool, stats
+    );
+  }
 
-    m_num_check = 0;
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-    // quick return on empty inputs
-    if ( m_num_tree_nodes == 0 ) return;
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::intersect_with_bboxes(
+    Real const        bb_min[], integer ldim0,
+    Real const        bb_max[], integer ldim1,
+    integer           nbox,
+    vector<integer> & offset,
+    vector<integer> & index,
+    bool              refine,
+    ThreadPoolBase  * pool,
+    BatchStats      * stats
+  ) const {
+    UTILS_ASSERT(
+      ldim0 >= dim() && ldim1 >= dim() && nbox >= 0,
+      "AABBtree::intersect_with_bboxes( bb_min, ldim0={}, bb_max, ldim1={}, nbox={}, ... )\n"
+      "must be ldim0, ldim1 >= dim = {} and nbox >= 0\n",
+      ldim0, ldim1, nbox, dim()
+    );
+    batch_query(
+      nbox,
+      [&]( integer i, Real c[] ) {
+        for ( integer j = 0; j < dim(); ++j )
+          c[j] = ( bb_min[i*ldim0+j] + bb_max[i*ldim1+j] ) / 2;
+      },
+      [&]( integer i, Workspace & ws, vector<integer> & out ) {
+        Real bbox[128]; // [min,max] as stored in the tree
+        std::copy_n( bb_min + i*ldim0, dim(), bbox );
+        std::copy_n( bb_max + i*ldim1, dim(), bbox + dim() );
+        collect_with_bbox( bbox, refine, ws, out );
+      },
+      offset, index, pool, stats
+    );
+  }
 
-    // descend tree from root
-    m_stack.clear();
-    m_stack.reserve(2*m_num_tree_nodes+1);
-    m_stack.emplace_back(0);
-    while ( !m_stack.empty() ) {
-      // pop node from stack
-      integer id_father = m_stack.back(); m_stack.pop_back();
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      // get BBOX
-      Real const * bb_father = m_bbox_tree + id_father * m_2dim;
+  template <typename Real, int DIM>
+  Real
+  AABBtree<Real,DIM>::pnt_bbox_distance( Real const pnt[], Real const bbox[] ) const {
+    Real res = 0;
+    for ( integer i = 0; i < dim(); ++i ) {
+      Real d = max( max( bbox[i] - pnt[i], pnt[i] - bbox[dim()+i] ), Real(0) );
+      res += d*d;
+    }
+    return sqrt(res);
+  }
 
-      ++m_num_check;
-      bool overlap = m_check_overlap( bb_father, bbox, m_dim );
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-      // if do not overlap skip
-      if ( !overlap ) continue;
+  //
+  // Best first search: the heap contains nodes (key = distance from the
+  // bbox), objects not yet evaluated (key = distance from the bbox of the
+  // object, a lower bound) and evaluated objects (key = exact distance).
+  // An evaluated object on top of the heap is closer than anything else.
+  //
+  template <typename Real, int DIM>
+  void
+  AABBtree<Real,DIM>::k_nearest(
+    Real const                        pnt[],
+    integer                           k,
+    DISTANCE_FUN              const & dist,
+    vector<std::pair<Real,integer>> & res,
+    Real                              max_dist,
+    Workspace                       & ws
+  ) const {
 
-      // refine candidate
-      integer num = this->m_num_nodes[id_father];
-      integer const * ptr = this->m_id_nodes + this->m_ptr_nodes[id_father];
-      for ( integer ii = 0; ii < num; ++ii ) {
-        integer s = ptr[ii];
-        Real const * bb_s = m_bbox_objs + ptr[ii] * m_2dim;
-        ++m_num_check;
-        bool olap = m_check_overlap( bb_s, bbox, m_dim );
-        if ( olap ) bb_index.insert(s);
+    check_full_tree( "k_nearest" );
+
+    enum { NODE = 0, OBJECT = 1, EXACT = 2 };
+
+    using ENTRY = std::tuple<Real,integer,integer>;
+    std::greater<ENTRY> cmp; // min heap
+
+    start_query( ws );
+    res.clear();
+    if ( m_num_tree_nodes == 0 || k <= 0 ) return;
+
+    vector<ENTRY> & heap = ws.heap;
+    heap.clear();
+
+    auto push = [&heap,&cmp,max_dist]( Real d, integer i, integer kind ) {
+      if ( d > max_dist ) return;
+      heap.emplace_back( d, i, kind );
+      std::push_heap( heap.begin(), heap.end(), cmp );
+    };
+
+    check_node( ws, heap.size()+1 );
+    push( pnt_bbox_distance( pnt, m_bbox_tree ), 0, NODE );
+
+    while ( !heap.empty() ) {
+      std::pop_heap( heap.begin(), heap.end(), cmp );
+      ENTRY e = heap.back(); heap.pop_back();
+      Real    d = std::get<0>(e);
+      integer i = std::get<1>(e);
+      switch ( std::get<2>(e) ) {
+      case EXACT:
+        res.emplace_back( d, i );
+        count_hits( ws, 1 );
+        if ( integer(res.size()) == k ) return;
+        break;
+      case OBJECT:
+        if ( dist ) {
+          // the order of the heap is exact only if `dist` is not below the
+          // distance of the bbox of the object (up to rounding)
+          Real de = dist( i );
+          UTILS_ASSERT_DEBUG(
+            de >= d - 100*std::numeric_limits<Real>::epsilon()*(1+d),
+            "AABBtree::k_nearest, dist({}) = {} is less than the distance {} of its bbox\n",
+            i, de, d
+          );
+          push( de, i, EXACT );
+        } else {
+          push( d, i, EXACT ); // bbox distance is exact
+        }
+        break;
+      default: // NODE
+        {
+          integer         num = m_num_nodes[i];
+          integer const * ptr = m_id_nodes + m_ptr_nodes[i];
+          for ( integer ii = 0; ii < num; ++ii ) {
+            check_object( ws );
+            push( pnt_bbox_distance( pnt, obj_bbox( ptr[ii] ) ), ptr[ii], OBJECT );
+          }
+          integer nn = m_child[i];
+          if ( nn > 0 ) {
+            check_node( ws, heap.size()+1, 2 );
+            push( pnt_bbox_distance( pnt, node_bbox( nn ) ),   nn,   NODE );
+            push( pnt_bbox_distance( pnt, node_bbox( nn+1 ) ), nn+1, NODE );
+          }
+        }
+        break;
       }
+    }
+  }
 
-      integer nn = m_child[id_father];
-      if ( nn > 0 ) { // root == 0, children > 0
-        // push on stack children
-        m_stack.emplace_back(nn);
-        m_stack.emplace_back(nn+1);
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real, int DIM>
+  typename AABBtree<Real,DIM>::integer
+  AABBtree<Real,DIM>::closest_object(
+    Real const           pnt[],
+    DISTANCE_FUN const & dist,
+    Real               & d_min,
+    Real                 max_dist,
+    Workspace          & ws
+  ) const {
+    vector<std::pair<Real,integer>> res;
+    res.reserve(1);
+    k_nearest( pnt, 1, dist, res, max_dist, ws );
+    if ( res.empty() ) { d_min = Utils::Inf<Real>(); return -1; }
+    d_min = res.front().first;
+    return res.front().second;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Slab test: clip [t_min,t_max] with the slabs of the bbox,
+  // `t_enter` is the parameter where the ray enter the bbox.
+  //
+  template <typename Real, int DIM>
+  bool
+  AABBtree<Real,DIM>::ray_bbox(
+    Real const   orig[],
+    Real const   dir[],
+    Real const   inv_dir[],
+    Real const   bbox[],
+    Real         t_min,
+    Real         t_max,
+    Real       & t_enter
+  ) const {
+    for ( integer i = 0; i < dim(); ++i ) {
+      Real bmin = bbox[i];
+      Real bmax = bbox[dim()+i];
+      if ( dir[i] == 0 ) {
+        // ray parallel to the slab
+        if ( orig[i] < bmin || orig[i] > bmax ) return false;
+        continue;
       }
+      Real t0 = (bmin-orig[i])*inv_dir[i];
+      Real t1 = (bmax-orig[i])*inv_dir[i];
+      if ( t0 > t1 ) std::swap( t0, t1 );
+      if ( t0 > t_min ) t_min = t0;
+      if ( t1 < t_max ) t_max = t1;
+      if ( t_min > t_max ) return false;
     }
+    t_enter = t_min;
+    return true;
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
-  void
-  AABBtree<Real>::intersect(
-    AABBtree<Real> const & aabb,
-    AABB_MAP             & bb_index
-  ) const {
+  template <typename Real, int DIM>
+  Real const *
+  AABBtree<Real,DIM>::segment_dir( Real const pa[], Real const pb[], Workspace & ws ) const {
+    ws.ray.resize( dim2() ); // ray_cast store the inverse direction after dir
+    for ( integer i = 0; i < dim(); ++i ) ws.ray[i] = pb[i] - pa[i];
+    return ws.ray.data();
+  }
 
-    m_num_check = 0;
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-    // quick return on empty inputs
-    if ( this->m_num_tree_nodes == 0 || aabb.m_num_tree_nodes == 0 ) return;
+  //
+  // Depth first traversal, the nearest child is visited first and a node
+  // is skipped when the ray enter its bbox after the closest hit found.
+  //
+  template <typename Real, int DIM>
+  typename AABBtree<Real,DIM>::integer
+  AABBtree<Real,DIM>::ray_cast(
+    Real const          orig[],
+    Real const          dir[],
+    Real                t_min,
+    Real                t_max,
+    RAY_HIT_FUN const & hit,
+    bool                any_hit,
+    Real              & t_hit,
+    Workspace         & ws
+  ) const {
 
-    // descend tree from root
-    m_stack.clear();
-    m_stack.reserve(m_num_tree_nodes+aabb.m_num_tree_nodes+2);
-    m_stack.emplace_back(0);
-    m_stack.emplace_back(0);
-    integer n_stack = 2;
-    while ( !m_stack.empty() ) {
-      // pop node from stack
-      integer root2  = m_stack.back(); m_stack.pop_back();
-      integer sroot1 = m_stack.back(); m_stack.pop_back();
-      integer root1  = sroot1 >= 0 ? sroot1 : -1-sroot1;
+    check_full_tree( "ray_cast" );
 
-      // check for intersection
-      Real const * bb_root1 = this->m_bbox_tree + root1 * m_2dim;
-      Real const * bb_root2 = aabb.m_bbox_tree + root2 * m_2dim;
+    start_query( ws );
+    t_hit        = Utils::Inf<Real>();
+    if ( m_num_tree_nodes == 0 || t_min > t_max ) return -1;
 
-      ++m_num_check;
-      bool overlap = m_check_overlap( bb_root1, bb_root2, m_dim );
+    ws.ray.resize( dim2() );
+    Real * inv_dir = ws.ray.data() + dim();
+    for ( integer i = 0; i < dim(); ++i )
+      inv_dir[i] = dir[i] == 0 ? Real(0) : 1/dir[i];
 
-      // if do not overlap skip
-      if ( !overlap ) continue;
+    auto & stack = ws.heap;
+    stack.clear();
 
-      // check if there are elements to check
-      integer nn1 = this->m_num_nodes[root1];
-      integer nn2 = aabb.m_num_nodes[root2];
-      if ( nn1 > 0 && nn2 > 0 ) aabb.get_bbox_indexes_of_a_node( root2, bb_index[root1] );
+    Real    t_best  = t_max;
+    integer id_best = -1;
+    Real    t_enter;
 
-      integer id_lr1 = sroot1 >= 0 ? m_child[root1] : -1;
-      integer id_lr2 = aabb.m_child[root2];
+    check_node( ws, stack.size()+1 );
+    if ( !ray_bbox( orig, dir, inv_dir, m_bbox_tree, t_min, t_best, t_enter ) ) return -1;
+    stack.emplace_back( t_enter, 0, 0 );
 
-      UTILS_ASSERT_DEBUG(
-        n_stack+3 < 2*m_nmax,
-        "AABBtree::intersect, n_stack+2 = {} must be less than 2*m_nmax ={}\n",
-        n_stack+2, 2*m_nmax
-      );
+    while ( !stack.empty() ) {
+      Real    t_node = std::get<0>(stack.back());
+      integer id     = std::get<1>(stack.back());
+      stack.pop_back();
+      if ( t_node > t_best ) continue; // a closer hit was found
 
-      if ( id_lr1 >= 0 ) {
-        m_stack.emplace_back(id_lr1);   m_stack.emplace_back(root2);
-        m_stack.emplace_back(id_lr1+1); m_stack.emplace_back(root2);
-        if ( nn1 > 0 ) {
-          m_stack.emplace_back(-1-root1); m_stack.emplace_back(root2);
+      integer         num = m_num_nodes[id];
+      integer const * ptr = m_id_nodes + m_ptr_nodes[id];
+      for ( integer ii = 0; ii < num; ++ii ) {
+        integer s = ptr[ii];
+        check_object( ws );
+        if ( !ray_bbox( orig, dir, inv_dir, obj_bbox( s ), t_min, t_best, t_enter ) ) continue;
+        Real t = t_enter;
+        if ( hit && !hit( s, t ) ) continue;
+        if ( t < t_min || t > t_best ) continue;
+        t_best  = t;
+        id_best = s;
+        count_hits( ws, 1 );
+        if ( any_hit ) { t_hit = t_best; return id_best; }
+      }
+
+      integer nn = m_child[id];
+      if ( nn > 0 ) {
+        Real t_l, t_r;
+        check_node( ws, stack.size()+1, 2 );
+        bool ok_l = ray_bbox( orig, dir, inv_dir, node_bbox( nn ),   t_min, t_best, t_l );
+        bool ok_r = ray_bbox( orig, dir, inv_dir, node_bbox( nn+1 ), t_min, t_best, t_r );
+        if ( ok_l && ok_r ) {
+          // far child first, the near one is on top of the stack
+          if ( t_l <= t_r ) { stack.emplace_back( t_r, nn+1, 0 ); stack.emplace_back( t_l, nn, 0 ); }
+          else              { stack.emplace_back( t_l, nn, 0 ); stack.emplace_back( t_r, nn+1, 0 ); }
+        } else if ( ok_l ) {
+          stack.emplace_back( t_l, nn, 0 );
+        } else if ( ok_r ) {
+          stack.emplace_back( t_r, nn+1, 0 );
         }
-      } else if ( id_lr2 >= 0 ) {
-        m_stack.emplace_back(sroot1); m_stack.emplace_back(id_lr2);
-        m_stack.emplace_back(sroot1); m_stack.emplace_back(id_lr2+1);
       }
     }
+    if ( id_best >= 0 ) t_hit = t_best;
+    return id_best;
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::intersect_and_refine(
-    AABBtree<Real> const & aabb,
-    AABB_MAP             & bb_index
+  AABBtree<Real,DIM>::intersect_with_ray(
+    Real const   orig[],
+    Real const   dir[],
+    Real         t_min,
+    Real         t_max,
+    AABB_SET   & bb_index,
+    Workspace  & ws
   ) const {
 
-    m_num_check = 0;
+    check_full_tree( "intersect_with_ray" );
 
-    // quick return on empty inputs
-    if ( this->m_num_tree_nodes == 0 || aabb.m_num_tree_nodes == 0 ) return;
-
-    // descend tree from root
-    m_stack.clear();
-    m_stack.reserve(m_num_tree_nodes+aabb.m_num_tree_nodes+2);
-    m_stack.emplace_back(0);
-    m_stack.emplace_back(0);
-    while ( !m_stack.empty() ) {
-      // pop node from stack
-      integer root2  = m_stack.back(); m_stack.pop_back();
-      integer sroot1 = m_stack.back(); m_stack.pop_back();
-      integer root1  = sroot1 >= 0 ? sroot1 : -1-sroot1;
+    start_query( ws );
+    bb_index.clear();
+    if ( m_num_tree_nodes == 0 || t_min > t_max ) return;
 
-      // check for intersection
-      Real const * bb_root1 = this->m_bbox_tree + root1 * m_2dim;
-      Real const * bb_root2 = aabb.m_bbox_tree + root2 * m_2dim;
+    ws.ray.resize( dim2() );
+    Real * inv_dir = ws.ray.data() + dim();
+    for ( integer i = 0; i < dim(); ++i )
+      inv_dir[i] = dir[i] == 0 ? Real(0) : 1/dir[i];
 
-      ++m_num_check;
-      bool overlap = m_check_overlap( bb_root1, bb_root2, m_dim );
+    vector<integer> & stack = ws.stack;
+    stack.clear();
+    stack.emplace_back(0);
 
-      // if do not overlap skip
-      if ( !overlap ) continue;
+    Real t_enter;
+    while ( !stack.empty() ) {
+      integer id = stack.back(); stack.pop_back();
+      check_node( ws );
+      if ( !ray_bbox( orig, dir, inv_dir, node_bbox( id ), t_min, t_max, t_enter ) ) continue;
 
-      // check if there are elements to check
-      integer nn1 = this->m_num_nodes[root1];
-      integer nn2 = aabb.m_num_nodes[root2];
-      if ( nn1 > 0 && nn2 > 0 ) {
-        // construct list of intersecting candidated
-        integer const * ptr1 = this->m_id_nodes + this->m_ptr_nodes[root1];
-        integer const * ptr2 = aabb.m_id_nodes + aabb.m_ptr_nodes[root2];
-        for ( integer ii = 0; ii < nn1; ++ii ) {
-          integer s1 = ptr1[ii];
-          Real const * bb_s1 = m_bbox_objs + s1 * m_2dim;
-          AABB_SET & BB = bb_index[s1];
-          for ( integer jj = 0; jj < nn2; ++jj ) {
-            integer s2 = ptr2[jj];
-            Real const * bb_s2 = aabb.m_bbox_objs + s2 * m_2dim;
-            ++m_num_check;
-            bool olap = m_check_overlap( bb_s1, bb_s2, m_dim );
-            //if ( olap ) bb_index[s1].insert(s2);
-            if ( olap ) BB.insert(s2);
-          }
+      integer         num = m_num_nodes[id];
+      integer const * ptr = m_id_nodes + m_ptr_nodes[id];
+      for ( integer ii = 0; ii < num; ++ii ) {
+        integer s = ptr[ii];
+        check_object( ws );
+        if ( ray_bbox( orig, dir, inv_dir, obj_bbox( s ), t_min, t_max, t_enter ) ) {
+          count_hits( ws, 1 );
+          bb_index.insert(s);
         }
       }
 
-      integer id_lr1 = sroot1 >= 0 ? m_child[root1] : -1;
-      integer id_lr2 = aabb.m_child[root2];
-
-      if ( id_lr1 >= 0 ) {
-        m_stack.emplace_back(id_lr1);   m_stack.emplace_back(root2);
-        m_stack.emplace_back(id_lr1+1); m_stack.emplace_back(root2);
-        if ( nn1 > 0 ) {
-          m_stack.emplace_back(-1-root1); m_stack.emplace_back(root2);
-        }
-      } else if ( id_lr2 >= 0 ) {
-        m_stack.emplace_back(sroot1); m_stack.emplace_back(id_lr2);
-        m_stack.emplace_back(sroot1); m_stack.emplace_back(id_lr2+1);
-      }
+      integer nn = m_child[id];
+      if ( nn > 0 ) { stack.emplace_back(nn); stack.emplace_back(nn+1); }
     }
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::pnt_bbox_minmax(
+  AABBtree<Real,DIM>::pnt_bbox_minmax(
     Real const pnt[],
     Real const bbox[],
     Real     & dmin2,
     Real     & dmax2
   ) const {
-    Real const * bb_max = bbox+m_dim;
+    Real const * bb_max = bbox+dim();
     Real const * bb_min = bbox;
     dmin2 = 0;
     dmax2 = 0;
-    for ( integer i = 0; i < m_dim; ++i ) {
+    for ( integer i = 0; i < dim(); ++i ) {
       // check overlap
       Real pi    = pnt[i];
       Real dpmin = 0;
@@ -1075,15 +4048,20 @@ namespace Utils {
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::min_distance_candidates(
+  AABBtree<Real,DIM>::min_distance_candidates(
     Real const pnt[],
-    AABB_SET & bb_index
-  ) const {;
+    AABB_SET & bb_index,
+    Workspace & ws
+  ) const {
+
+    check_full_tree( "min_distance_candidates" );
 
     Real dst2_min, dst2_max;
 
+    start_query( ws );
+
     // quick return on empty inputs
     bb_index.clear();
     if ( this->m_num_tree_nodes == 0 ) return;
@@ -1091,16 +4069,17 @@ namespace Utils {
     Real min_max_distance2 = Utils::Inf<Real>();
 
     // descend tree from root
-    m_stack.clear();
-    m_stack.reserve(m_num_tree_nodes+1);
-    m_stack.emplace_back(0);
-    while ( !m_stack.empty() ) {
+    ws.stack.clear();
+    ws.stack.reserve(m_num_tree_nodes+1);
+    ws.stack.emplace_back(0);
+    while ( !ws.stack.empty() ) {
       // pop node from stack
-      integer id_father = m_stack.back(); m_stack.pop_back();
+      integer id_father = ws.stack.back(); ws.stack.pop_back();
 
       // get BBOX
       // check for intersection
-      Real const * father_bbox = this->m_bbox_tree + id_father * m_2dim;
+      Real const * father_bbox = node_bbox( id_father );
+      check_node( ws );
       this->pnt_bbox_minmax( pnt, father_bbox, dst2_min, dst2_max );
 
       if ( dst2_min <= min_max_distance2 ) {
@@ -1111,27 +4090,29 @@ namespace Utils {
         integer nn = m_child[id_father];
         if ( nn > 0 ) { // root == 0, children > 0
           // push on stack childrens
-          m_stack.emplace_back(nn);
-          m_stack.emplace_back(nn+1);
+          ws.stack.emplace_back(nn);
+          ws.stack.emplace_back(nn+1);
         }
       }
     }
 
     // descend tree from root
-    m_stack.clear();
-    m_stack.emplace_back(0);
-    while ( !m_stack.empty() ) {
+    ws.stack.clear();
+    ws.stack.emplace_back(0);
+    while ( !ws.stack.empty() ) {
       // pop node from stack
-      integer id_father = m_stack.back(); m_stack.pop_back();
-      Real const * father_bbox = this->m_bbox_tree + id_father * m_2dim;
+      integer id_father = ws.stack.back(); ws.stack.pop_back();
+      Real const * father_bbox = node_bbox( id_father );
+      check_node( ws );
       this->pnt_bbox_minmax( pnt, father_bbox, dst2_min, dst2_max );
       if ( dst2_min <= min_max_distance2 ) {
+        count_hits( ws, m_num_nodes[id_father] );
         this->get_bbox_indexes_of_a_node( id_father, bb_index );
         integer nn = m_child[id_father];
         if ( nn > 0 ) { // root == 0, children > 0
           // push on stack childrens
-          m_stack.emplace_back(nn);
-          m_stack.emplace_back(nn+1);
+          ws.stack.emplace_back(nn);
+          ws.stack.emplace_back(nn+1);
         }
       }
     }
@@ -1139,12 +4120,14 @@ namespace Utils {
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::get_bbox_indexes_of_a_node(
+  AABBtree<Real,DIM>::get_bbox_indexes_of_a_node(
     integer    i_pos,
     AABB_SET & bb_index
   ) const {
+    check_full_tree( "get_bbox_indexes_of_a_node" );
+
     UTILS_ASSERT(
       i_pos >= 0 && i_pos < m_num_tree_nodes,
       "AABBtree::get_bbox_indexes_of_a_node( i_pos={}, bb_index ) i_pos must be >= 0 and < {}\n",
@@ -1157,9 +4140,11 @@ namespace Utils {
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
-  typename AABBtree<Real>::integer
-  AABBtree<Real>::num_tree_nodes( integer nmin ) const {
+  template <typename Real, int DIM>
+  typename AABBtree<Real,DIM>::integer
+  AABBtree<Real,DIM>::num_tree_nodes( integer nmin ) const {
+    check_full_tree( "num_tree_nodes" );
+
     integer n = 0;
     for ( integer i = 0; i < m_num_tree_nodes; ++i )
       if ( m_num_nodes[i] >= nmin ) ++n;
@@ -1168,46 +4153,55 @@ namespace Utils {
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::get_root_bbox( Real bb_min[], Real bb_max[] ) const {
-    std::copy_n( m_bbox_tree,       m_dim, bb_min );
-    std::copy_n( m_bbox_tree+m_dim, m_dim, bb_max );
+  AABBtree<Real,DIM>::get_root_bbox( Real bb_min[], Real bb_max[] ) const {
+    std::copy_n( m_bbox_tree,       dim(), bb_min );
+    std::copy_n( m_bbox_tree+dim(), dim(), bb_max );
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
-  template <typename Real>
+  template <typename Real, int DIM>
   void
-  AABBtree<Real>::get_bboxes_of_the_tree(
+  AABBtree<Real,DIM>::get_bboxes_of_the_tree(
     Real bbox_min[], integer ldim0,
     Real bbox_max[], integer ldim1,
     integer nmin
   ) const {
+    check_full_tree( "get_bboxes_of_the_tree" );
+
     UTILS_ASSERT(
-      ldim0 >= m_dim && ldim1 >= m_dim,
+      ldim0 >= dim() && ldim1 >= dim(),
       "AABBtree::get_bboxes_of_the_tree(\n"
       "  bbox_min, ldim0={},\n"
       "  bbox_max, ldim1={},\n"
       "  nmin={} )\n"
       "must be nmin >= 0 and ldim0:1 >= {}\n",
-      ldim0, ldim1, nmin, m_dim
+      ldim0, ldim1, nmin, dim()
     );
 
     for ( integer i = 0; i < m_num_tree_nodes; ++i ) {
       if ( m_num_nodes[i] >= nmin ) {
-        Real const * b_min = m_bbox_tree + i * m_2dim;
-        Real const * b_max = b_min + m_dim;
-        std::copy_n( b_min, m_dim, bbox_min ); bbox_min += ldim0;
-        std::copy_n( b_max, m_dim, bbox_max ); bbox_max += ldim1;
+        Real const * b_min = node_bbox( i );
+        Real const * b_max = b_min + dim();
+        std::copy_n( b_min, dim(), bbox_min ); bbox_min += ldim0;
+        std::copy_n( b_max, dim(), bbox_max ); bbox_max += ldim1;
       }
     }
   }
 
   // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
 
+  template class AABBoverlap<float,0>;
+  template class AABBoverlap<double,0>;
+
   template class AABBtree<float>;
   template class AABBtree<double>;
+  template class AABBtree<float,2>;
+  template class AABBtree<float,3>;
+  template class AABBtree<double,2>;
+  template class AABBtree<double,3>;
 
 }
 
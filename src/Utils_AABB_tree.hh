@@ -31,6 +31,9 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <tuple>
+#include <type_traits>
+#include <functional>
 
 namespace Utils {
 
@@ -39,6 +42,88 @@ namespace Utils {
   using std::set;
   using std::map;
 
+  //!
+  //! Overlap tests of the bboxes of `AABBtree<Real,DIM>` (`dim` minima
+  //! followed by `dim` maxima).  With `DIM > 0` they are loops over `DIM`
+  //! inlined in the traversals.
+  //!
+  template <typename Real, int DIM>
+  class AABBoverlap {
+  public:
+    using integer = int;
+
+    void setup( integer ) { }
+
+    static
+    bool
+    bbox( Real const bb1[], Real const bb2[] ) {
+      for ( integer j = 0; j < DIM; ++j )
+        if ( bb1[j] > bb2[DIM+j] || bb1[DIM+j] < bb2[j] ) return false;
+      return true;
+    }
+
+    static
+    bool
+    point( Real const pnt[], Real const bb[] ) {
+      for ( integer j = 0; j < DIM; ++j )
+        if ( pnt[j] > bb[DIM+j] || pnt[j] < bb[j] ) return false;
+      return true;
+    }
+  };
+
+  //!
+  //! With the dimension at run time (`DIM = 0`) `setup` selects a test
+  //! unrolled for the dimension, called through a function pointer.
+  //!
+  template <typename Real>
+  class AABBoverlap<Real,0> {
+  public:
+    using integer = int;
+
+  private:
+    using OVERLAP_FUN = bool (*) ( Real const bbox1[], Real const bbox2[], integer dim );
+
+    OVERLAP_FUN m_check_overlap{nullptr};
+    OVERLAP_FUN m_check_overlap_with_point{nullptr};
+    integer     m_dim{0};
+
+    static bool overlap1( Real const bbox1[], Real const bbox2[], integer dim );
+    static bool overlap2( Real const bbox1[], Real const bbox2[], integer dim );
+    static bool overlap3( Real const bbox1[], Real const bbox2[], integer dim );
+    static bool overlap4( Real const bbox1[], Real const bbox2[], integer dim );
+    static bool overlap5( Real const bbox1[], Real const bbox2[], integer dim );
+    static bool overlap6( Real const bbox1[], Real const bbox2[], integer dim );
+    static bool overlap7( Real const bbox1[], Real const bbox2[], integer dim );
+    static bool overlap8( Real const bbox1[], Real const bbox2[], integer dim );
+
+    static bool pnt_overlap1( Real const pnt[], Real const bbox2[], integer dim );
+    static bool pnt_overlap2( Real const pnt[], Real const bbox2[], integer dim );
+    static bool pnt_overlap3( Real const pnt[], Real const bbox2[], integer dim );
+    static bool pnt_overlap4( Real const pnt[], Real const bbox2[], integer dim );
+    static bool pnt_overlap5( Real const pnt[], Real const bbox2[], integer dim );
+    static bool pnt_overlap6( Real const pnt[], Real const bbox2[], integer dim );
+    static bool pnt_overlap7( Real const pnt[], Real const bbox2[], integer dim );
+    static bool pnt_overlap8( Real const pnt[], Real const bbox2[], integer dim );
+
+    static bool check_overlap( Real const bb1[], Real const bb2[], integer dim );
+    static bool check_overlap_with_point( Real const bb1[], Real const pnt[], integer dim );
+
+  public:
+
+    void setup( integer dim );
+
+    bool
+    bbox( Real const bb1[], Real const bb2[] ) const
+    { return m_check_overlap( bb1, bb2, m_dim ); }
+
+    bool
+    point( Real const pnt[], Real const bb[] ) const
+    { return m_check_overlap_with_point( pnt, bb, m_dim ); }
+  };
+
+  extern template class AABBoverlap<float,0>;
+  extern template class AABBoverlap<double,0>;
+
   /*\
    |      _        _    ____  ____  _
    |     / \      / \  | __ )| __ )| |_ _ __ ___  ___
@@ -47,13 +132,101 @@ namespace Utils {
    |  /_/   \_\/_/   \_\____/|____/ \__|_|  \___|\___|
   \*/
 
-  template <typename Real>
+  //!
+  //! Static AABB tree of `dim` dimensional bboxes.
+  //!
+  //! `DIM` fixes the dimension at compile time: the bbox stride is a
+  //! constant and the overlap tests are inlined in the traversals (see
+  //! `AABBoverlap`), `DIM = 0` (default) takes the dimension at run time
+  //! from `allocate`.
+  //!
+  template <typename Real, int DIM = 0>
   class AABBtree {
   public:
 
     using integer  = int;
     using AABB_SET = set<integer>;
     using AABB_MAP = map<integer,AABB_SET>;
+    using AABB_PAIRS = vector<std::pair<integer,integer>>;
+
+    //!
+    //! How a node is split in `build`:
+    //!
+    //! - HEURISTIC  : longest axis, at the mean of the bbox centers
+    //! - MEDIAN     : longest axis, at the median of the bbox centers
+    //! - BINNED_SAH : axis and position minimizing the surface area heuristic
+    //!
+    using SplitStrategy = enum class AABBtree_split : integer { HEURISTIC, MEDIAN, BINNED_SAH };
+
+    //!
+    //! Counters of a query, filled only if `Workspace::collect_stats` is set.
+    //! For tree-tree queries nodes and objects are pairs.
+    //!
+    class QueryStats {
+    public:
+      integer nodes{0};     //!< node bboxes checked
+      integer objects{0};   //!< object bboxes checked
+      integer max_stack{0}; //!< max size of the traversal stack
+      integer hits{0};      //!< objects (or pairs) returned
+    };
+
+    //!
+    //! Counters of a batch of queries: totals and histograms, bin 0 counts
+    //! the zeros and bin `k > 0` the values in `[2^(k-1),2^k)`.
+    //!
+    class BatchStats {
+    public:
+      integer         num_queries{0};
+      int64_t         total_nodes{0};
+      int64_t         total_objects{0};
+      int64_t         total_hits{0};
+      integer         max_stack{0};
+      vector<integer> hist_nodes;
+      vector<integer> hist_objects;
+      vector<integer> hist_stack;
+      vector<integer> hist_hits;
+
+      void   add( QueryStats const & s );
+      void   merge( BatchStats const & b );
+      void   clear() { *this = BatchStats(); }
+      string info() const;
+    };
+
+    //!
+    //! Traversal stack and statistic of a query.
+    //! Queries are reentrant: each thread uses its own workspace
+    //! (thread local by default, or given by the caller).
+    //!
+    class Workspace {
+    public:
+      vector<integer> stack;
+      integer         num_check{0};         //!< bbox checks done by the last query
+      bool            collect_stats{false}; //!< fill `stats` (small overhead)
+      QueryStats      stats;                //!< counters of the last query
+      //! priority queue of nearest queries (distance, node or object, kind),
+      //! traversal stack of ray queries (entry parameter, node, 0)
+      vector<std::tuple<Real,integer,integer>> heap;
+      vector<Real> ray;    //!< direction and inverse direction of ray queries
+      vector<Real> bounds; //!< decoded node bounds of quantized layout queries
+    };
+
+    //! exact distance of the object `id` from the query point
+    using DISTANCE_FUN = std::function<Real(integer id)>;
+
+    //!
+    //! Exact intersection of the object `id` with the ray.
+    //! On input `t` is the parameter where the ray enter the bbox of the
+    //! object, return true and the parameter of the hit in `t` if the
+    //! object is hit.
+    //!
+    using RAY_HIT_FUN = std::function<bool(integer id, Real & t)>;
+
+    //!
+    //! Source of bboxes for `build_out_of_core`: store up to `nmax` bboxes
+    //! in `bb_min` and `bb_max` (`dim` values per bbox) and return how many,
+    //! 0 when there are no more bboxes.
+    //!
+    using BOX_READER = std::function<integer(Real bb_min[], Real bb_max[], integer nmax)>;
 
   private:
 
@@ -74,8 +247,6 @@ namespace Utils {
     Real    * m_bbox_tree{nullptr}; // m_nmax*m_2dim
     Real    * m_bbox_objs{nullptr}; // m_num_objects*m_2dim
 
-    mutable vector<integer> m_stack;
-
     integer m_nmax{0};
 
     // parameters
@@ -84,48 +255,417 @@ namespace Utils {
     Real    m_bbox_overlap_tolerance{Real(0.1)};
     Real    m_bbox_min_size_tolerance{Real(0)};
 
-    // statistic
-    mutable integer m_num_check = 0;
+    SplitStrategy m_split_strategy{SplitStrategy::HEURISTIC};
 
-    using OVERLAP_FUN = bool (*) ( Real const bbox1[], Real const bbox2[], integer dim );
+    // compact layout: one node = child, ptr, num and float bounds packed
+    // in 32 bytes (dim <= 2) or in 64 bytes blocks, depth first order
+    union CompactWord { float f; integer i; };
 
-    OVERLAP_FUN m_check_overlap{nullptr};
-    OVERLAP_FUN m_check_overlap_with_point{nullptr};
+    bool                m_use_compact{false};
+    vector<CompactWord> m_compact_mem;
+    CompactWord const * m_compact{nullptr}; // 64 byte aligned in m_compact_mem
+    integer             m_compact_stride{0};
 
-    static bool overlap1( Real const bbox1[], Real const bbox2[], integer dim );
-    static bool overlap2( Real const bbox1[], Real const bbox2[], integer dim );
-    static bool overlap3( Real const bbox1[], Real const bbox2[], integer dim );
-    static bool overlap4( Real const bbox1[], Real const bbox2[], integer dim );
-    static bool overlap5( Real const bbox1[], Real const bbox2[], integer dim );
-    static bool overlap6( Real const bbox1[], Real const bbox2[], integer dim );
-    static bool overlap7( Real const bbox1[], Real const bbox2[], integer dim );
-    static bool overlap8( Real const bbox1[], Real const bbox2[], integer dim );
+    void build_compact();
 
-    static bool pnt_overlap1( Real const pnt[], Real const bbox2[], integer dim );
-    static bool pnt_overlap2( Real const pnt[], Real const bbox2[], integer dim );
-    static bool pnt_overlap3( Real const pnt[], Real const bbox2[], integer dim );
-    static bool pnt_overlap4( Real const pnt[], Real const bbox2[], integer dim );
-    static bool pnt_overlap5( Real const pnt[], Real const bbox2[], integer dim );
-    static bool pnt_overlap6( Real const pnt[], Real const bbox2[], integer dim );
-    static bool pnt_overlap7( Real const pnt[], Real const bbox2[], integer dim );
-    static bool pnt_overlap8( Real const pnt[], Real const bbox2[], integer dim );
+    template <typename ADD>
+    bool compact_query( Real const q[], bool is_point, bool refine, Workspace & ws, ADD && add ) const;
 
-    static bool check_overlap( Real const bb1[], Real const bb2[], integer dim );
-    static bool check_overlap_with_point( Real const bb1[], Real const pnt[], integer dim );
+    // wide layout: each node has 4 slots (children and grandchildren of a
+    // binary node) with float bounds in SoA form, tested with one SIMD compare
+    bool            m_use_wide{false};
+    integer         m_wide_nodes{0};
+    vector<float>   m_wide_bounds; // node w: min[dim][4] then max[dim][4]
+    vector<integer> m_wide_slot;   // node w: 4 binary nodes (-1 empty slot)
+    vector<integer> m_wide_child;  // node w: 4 wide nodes of the slots (-1 leaf)
+
+    void build_wide();
+
+    template <typename ADD>
+    bool wide_query( Real const q[], bool is_point, bool refine, Workspace & ws, ADD && add ) const;
+
+    // quantized layout: depth first order with adjacent children, a node
+    // stores its bounds as 16 bit fractions of the (decoded) bbox of the father
+    bool             m_use_quantized{false};
+    vector<integer>  m_quant_node;   // slot s: first child slot (-1 leaf), ptr, num
+    vector<uint16_t> m_quant_bounds; // slot s: min[dim] then max[dim]
+    vector<Real>     m_quant_root;   // bbox of the root
+
+    void build_quantized();
+
+    template <typename ADD>
+    bool quantized_query( Real const q[], bool is_point, bool refine, Workspace & ws, ADD && add ) const;
+
+    // candidates of a layout node, false if `add` stopped the query
+    template <typename ADD>
+    bool add_objects( Real const q[], bool is_point, bool refine, integer num, integer const * ptr, Workspace & ws, ADD & add ) const;
+
+    // use the wide, compact or quantized layout if available, return false otherwise;
+    // `add(id)` can return false to stop the traversal, then `completed` is false
+    template <typename ADD>
+    bool layout_query( Real const q[], bool is_point, bool refine, Workspace & ws, ADD && add, bool & completed ) const;
+
+    template <typename ADD>
+    bool
+    layout_query( Real const q[], bool is_point, bool refine, Workspace & ws, ADD && add ) const {
+      bool completed;
+      return layout_query( q, is_point, refine, ws, add, completed );
+    }
+
+    // `layout_query` for the visitor queries (defined with the layouts)
+    bool
+    layout_visit(
+      Real const                           q[],
+      bool                                 is_point,
+      bool                                 refine,
+      Workspace                          & ws,
+      std::function<bool(integer)> const & visit,
+      bool                               & completed
+    ) const;
+
+    AABBoverlap<Real,DIM> m_overlap;
+
+    bool
+    overlap_bbox( Real const bb1[], Real const bb2[] ) const
+    { return m_overlap.bbox( bb1, bb2 ); }
+
+    bool
+    overlap_point( Real const pnt[], Real const bbox[] ) const
+    { return m_overlap.point( pnt, bbox ); }
+
+    // bounds of node/object `i`, the stride is a constant when DIM > 0
+    Real const * node_bbox( integer i ) const { return m_bbox_tree + i * dim2(); }
+    Real const * obj_bbox ( integer i ) const { return m_bbox_objs + i * dim2(); }
+
+    // allocate `nt` node and `no` object bboxes
+    void allocate_bboxes( integer nt, integer no );
 
     Real max_bbox_distance( Real const bbox[], Real const pnt[] ) const;
+    Real pnt_bbox_distance( Real const pnt[], Real const bbox[] ) const;
+
+    bool
+    ray_bbox(
+      Real const   orig[],
+      Real const   dir[],
+      Real const   inv_dir[],
+      Real const   bbox[],
+      Real         t_min,
+      Real         t_max,
+      Real       & t_enter
+    ) const;
+
+    integer
+    ray_cast(
+      Real const          orig[],
+      Real const          dir[],
+      Real                t_min,
+      Real                t_max,
+      RAY_HIT_FUN const & hit,
+      bool                any_hit,
+      Real              & t_hit,
+      Workspace         & ws
+    ) const;
+
+    Real const * segment_dir( Real const pa[], Real const pb[], Workspace & ws ) const;
+
+    static Workspace & thread_workspace();
+
+    // tree mapped from file (read only)
+    void * m_map_base{nullptr};
+    size_t m_map_size{0};
+
+    // node arrays released by `compress` (read only)
+    bool m_compressed{false};
+
+    void unmap();
+    void check_writable( char const where[] ) const;
+    void check_full_tree( char const where[] ) const;
+    void set_from_header( void const * header, bool mapped );
+    void fill_header( void * header ) const;
+
+    integer
+    layouts_bits() const {
+      return (m_use_compact ? 1 : 0) | (m_use_wide ? 2 : 0) | (m_use_quantized ? 4 : 0);
+    }
+
+    // build: pairs of children are reused (partial rebuild) or new ones
+    class NodePairs {
+    public:
+      std::atomic<integer> n_nodes{1};
+      vector<integer>      free_pairs; // only for serial builds
+
+      integer
+      get() {
+        if ( free_pairs.empty() ) return n_nodes.fetch_add(2);
+        integer id = free_pairs.back(); free_pairs.pop_back();
+        return id;
+      }
+    };
+
+    // build: scratch of the splits, one for each thread, reused for all its nodes
+    class BuildWorkspace {
+    public:
+      static integer const SAH_NBIN = 16;
+
+      vector<Real>    bb_lr;     // bboxes of the left and right child
+      vector<Real>    sah_cb;    // bounds of the centers (times 2)
+      vector<Real>    sah_acc;   // bbox of the sweep
+      vector<Real>    sah_bins;  // bboxes of the bins
+      vector<Real>    sah_right; // surface*count from the right
+      vector<integer> sah_cnt;   // objects in the bins
+
+      explicit
+      BuildWorkspace( integer d2 )
+      : bb_lr( size_t(2*d2) )
+      , sah_cb( size_t(d2) )
+      , sah_acc( size_t(d2) )
+      , sah_bins( size_t(SAH_NBIN*d2) )
+      , sah_right( size_t(SAH_NBIN) )
+      , sah_cnt( size_t(SAH_NBIN) )
+      {}
+    };
+
+    vector<Real> m_build_surface; // surface of the nodes after the build
+    Real         m_build_cost{0}; // sah_cost() after the build
+
+    integer split_node( integer id_father, Real otol, NodePairs & pairs, BuildWorkspace & bw );
+    void    build_subtree( integer id_root, Real otol, NodePairs & pairs );
+    void    rebuild_subtree( integer id_root, Real otol, NodePairs & pairs );
+    void    renumber_nodes();
+    void    after_build();
+    void    refit_node( integer id );
+    void    refit_nodes( ThreadPoolBase * pool );
+    bool    sah_partition( integer * ids, integer n, integer & n_left, BuildWorkspace & bw ) const;
+
+    // append to `out` the candidates of a single query (no allocation)
+    void collect_with_point( Real const pnt[], bool refine, Workspace & ws, vector<integer> & out ) const;
+    void collect_with_bbox( Real const bbox[], bool refine, Workspace & ws, vector<integer> & out ) const;
+
+    // the dynamic tree counts its checks with the same helpers
+    template <typename> friend class AABBtreeDynamic;
+
+    // counters of the bbox checks, the statistic only if requested
+    static
+    void
+    start_query( Workspace & ws ) {
+      ws.num_check = 0;
+      if ( ws.collect_stats ) { ws.stats = QueryStats(); ws.stack.clear(); }
+    }
+
+    static
+    void
+    check_node( Workspace & ws, size_t stack_size, integer n = 1 ) {
+      ws.num_check += n;
+      if ( ws.collect_stats ) {
+        ws.stats.nodes += n;
+        if ( integer(stack_size) > ws.stats.max_stack ) ws.stats.max_stack = integer(stack_size);
+      }
+    }
+
+    static void check_node( Workspace & ws ) { check_node( ws, ws.stack.size()+1 ); }
+
+    static
+    void
+    check_object( Workspace & ws )
+    { ++ws.num_check; if ( ws.collect_stats ) ++ws.stats.objects; }
+
+    static
+    void
+    count_hits( Workspace & ws, integer n )
+    { if ( ws.collect_stats ) ws.stats.hits += n; }
+
+    // visitor returning void never stop the query
+    template <typename VISIT, typename... ARGS>
+    static
+    bool
+    call_visitor( std::true_type, VISIT & visit, ARGS... args )
+    { visit( args... ); return true; }
+
+    template <typename VISIT, typename... ARGS>
+    static
+    bool
+    call_visitor( std::false_type, VISIT & visit, ARGS... args )
+    { return bool( visit( args... ) ); }
+
+    template <typename VISIT>
+    bool visit_query( Real const q[], bool is_point, bool refine, VISIT && visit, Workspace & ws ) const;
+
+    template <typename VISIT>
+    bool
+    visit_tree( AABBtree<Real,DIM> const & aabb, bool refine, VISIT && visit, Workspace & ws ) const {
+      check_full_tree( "intersect" );
+      aabb.check_full_tree( "intersect" );
+      start_query( ws );
+      if ( m_num_tree_nodes == 0 || aabb.m_num_tree_nodes == 0 ) return true;
+      return visit_tree_from( aabb, 0, 0, refine, visit, ws );
+    }
+
+    void
+    expand_pairs(
+      AABBtree<Real,DIM> const & aabb,
+      bool                       refine,
+      integer                    npairs,
+      vector<integer>          & level,
+      AABB_PAIRS               & top
+    ) const;
+
+    void
+    self_pairs_subtree(
+      integer           root,
+      integer           max_depth,
+      bool              refine,
+      vector<integer> & cross,
+      vector<integer> & roots,
+      AABB_PAIRS      & out
+    ) const;
+
+    // dual traversal starting from the pair (sroot1,root2) of the stack of `intersect`
+    template <typename VISIT>
+    bool
+    visit_tree_from(
+      AABBtree<Real,DIM> const & aabb,
+      integer                    sroot1,
+      integer                    root2,
+      bool                       refine,
+      VISIT                   && visit,
+      Workspace                & ws
+    ) const;
+
+    void
+    batch_query(
+      integer                                        nq,
+      std::function<void(integer,Real[])>    const & center,
+      std::function<void(integer,Workspace&,vector<integer>&)> const & query,
+      vector<integer>                              & offset,
+      vector<integer>                              & index,
+      ThreadPoolBase                               * pool,
+      BatchStats                                   * stats
+    ) const;
 
   public:
 
     AABBtree() = default;
 
-    AABBtree( AABBtree<Real> const & t );
+    AABBtree( AABBtree<Real,DIM> const & t );
+
+    ~AABBtree();
+
+    //!
+    //! Save the built tree (node and bbox arrays, parameters) in a versioned
+    //! binary file, arrays are aligned to 64 bytes. The file is readable only
+    //! on machines with the same byte order and `sizeof(Real)`.
+    //!
+    void save( string const & fname ) const;
+
+    //! load a tree saved with `save` (the tree can be modified and rebuilt)
+    void load( string const & fname );
+
+    //!
+    //! Map a tree saved with `save` in memory (read only, zero copy): the
+    //! pages are loaded on demand and shared among the processes mapping the
+    //! same file. Queries work as usual, `add_bboxes`, `replace_bbox`,
+    //! `build`, `refit` and `update` are not allowed until a new `allocate`.
+    //! On Windows the file is loaded.
+    //!
+    void map_file( string const & fname );
+
+    bool is_mapped() const { return m_map_base != nullptr; }
+
+    //!
+    //! Build the tree of a set of bboxes too large for the memory and write
+    //! it to `fname` in the format of `save`.  The bboxes are read from
+    //! `read` in chunks of `chunk_size`, the subtree of each chunk is built
+    //! (with the parameters of this tree, in parallel if `pool` is not null)
+    //! and spilled to a temporary file `fname.chunkN`, then the subtrees
+    //! are merged under a linear BVH of their roots while writing the file.
+    //! The memory used is about the one of a tree of `chunk_size` objects.
+    //! Object `i` is the `i`-th bbox read, at the end the file is mapped
+    //! by this tree (`map_file`).
+    //!
+    void
+    build_out_of_core(
+      BOX_READER const & read,
+      integer            dim,
+      string     const & fname,
+      integer            chunk_size = 1000000,
+      ThreadPoolBase   * pool       = nullptr
+    );
+
+    //!
+    //! As above, reading the bboxes from the binary file `fname_bboxes`
+    //! (for each bbox `dim` min and `dim` max values of type `Real`).
+    //!
+    void
+    build_out_of_core(
+      string const   & fname_bboxes,
+      integer          dim,
+      string const   & fname,
+      integer          chunk_size = 1000000,
+      ThreadPoolBase * pool       = nullptr
+    );
 
     void set_max_num_objects_per_node( integer n );
     void set_bbox_long_edge_ratio( Real ratio );
     void set_bbox_overlap_tolerance( Real tol );
     void set_bbox_min_size_tolerance( Real tol );
 
+    //!
+    //! Use (or not) the compact node layout for point and bbox queries:
+    //! nodes in depth first order with adjacent children, each node in one
+    //! cache line with bounds stored as float (rounded outward).
+    //! For `double` trees the bounds are conservative, so queries without
+    //! refinement can return some more candidates.
+    //!
+    void set_compact_layout( bool yes );
+    bool compact_layout() const { return m_use_compact; }
+
+    //!
+    //! Use (or not) the 4-wide layout for point and bbox queries: a node
+    //! stores the float bounds of up to 4 descendants in SoA form and they
+    //! are checked with a single SSE comparison per dimension (scalar
+    //! fallback without SSE).  Has precedence over the compact layout,
+    //! same remark on the candidates of `double` trees.
+    //!
+    void set_wide_layout( bool yes );
+    bool wide_layout() const { return m_use_wide; }
+
+    //!
+    //! Use (or not) the quantized node layout for point and bbox queries:
+    //! nodes in depth first order with adjacent children, the bounds of a
+    //! node are stored as 16 bit fractions of the bbox of its father,
+    //! rounded outward (`2*dim` shorts and 3 integers per node).
+    //! The wide and compact layouts have precedence.  Queries without
+    //! refinement can return some more candidates.
+    //!
+    void set_quantized_layout( bool yes );
+    bool quantized_layout() const { return m_use_quantized; }
+
+    //!
+    //! Release the full precision nodes of a built tree, keeping only the
+    //! compact (float bounds) or, if not set, the quantized layout; with
+    //! `keep_object_bboxes = false` also the bboxes of the objects are
+    //! released.  The tree becomes read only: point and bbox queries work,
+    //! with sets, vectors, visitors or in batch (refined ones only if the
+    //! object bboxes are kept), the other queries and `save` are not allowed
+    //! until a new `allocate`.
+    //!
+    void compress( bool keep_object_bboxes = true );
+
+    bool is_compressed() const { return m_compressed; }
+
+    void          set_split_strategy( SplitStrategy s ) { m_split_strategy = s; }
+    SplitStrategy split_strategy() const { return m_split_strategy; }
+
+    char const *
+    split_strategy_name() const {
+      switch ( m_split_strategy ) {
+        case SplitStrategy::MEDIAN:     return "median";
+        case SplitStrategy::BINNED_SAH: return "binned SAH";
+        default:                        break;
+      }
+      return "heuristic";
+    }
+
     void allocate( integer nbox, integer dim );
 
     void
@@ -141,35 +681,507 @@ namespace Utils {
       integer    ipos
     );
 
-    void build();
+    //!
+    //! Build the tree of the bboxes added.
+    //! If `pool` is not null the subtrees are split in parallel,
+    //! the resulting tree is the same of the serial build.
+    //!
+    void build( ThreadPoolBase * pool = nullptr );
 
     void
     build(
       Real const bb_min[], integer ldim0,
       Real const bb_max[], integer ldim1,
       integer nbox,
-      integer dim
+      integer dim,
+      ThreadPoolBase * pool = nullptr
     ) {
       allocate( nbox, dim );
       add_bboxes( bb_min, ldim0, bb_max, ldim1 );
-      build();
+      build( pool );
     }
 
-    void intersect_with_one_point( Real const pnt[], AABB_SET & bb_index ) const;
-    void intersect_with_one_bbox( Real const bbox[], AABB_SET & bb_index ) const;
-    void intersect( AABBtree<Real> const & aabb, AABB_MAP & bb_index ) const;
+    //!
+    //! Build the tree of the bboxes added as a linear BVH: the objects are
+    //! sorted by the Morton code of their bbox center (radix sort) and the
+    //! nodes are the binary radix tree of the codes, ranges with less than
+    //! `max_num_objects_per_node` objects are leaves.  Linear cost and much
+    //! faster than `build` for large sets, compare `sah_cost` for the quality.
+    //! If `pool` is not null codes, sort, splits and bboxes are computed
+    //! in parallel, the tree does not depend on the number of threads.
+    //!
+    void build_lbvh( ThreadPoolBase * pool = nullptr );
+
+    void
+    build_lbvh(
+      Real const bb_min[], integer ldim0,
+      Real const bb_max[], integer ldim1,
+      integer nbox,
+      integer dim,
+      ThreadPoolBase * pool = nullptr
+    ) {
+      allocate( nbox, dim );
+      add_bboxes( bb_min, ldim0, bb_max, ldim1 );
+      build_lbvh( pool );
+    }
+
+    //!
+    //! Update the bbox of the nodes bottom-up after `replace_bbox`,
+    //! the structure of the tree is not changed.
+    //! If `pool` is not null the nodes of a level are refitted in parallel.
+    //!
+    void refit( ThreadPoolBase * pool = nullptr );
+
+    //!
+    //! Refit the tree, then rebuild the subtrees whose surface grew more
+    //! than `max_growth` times the surface after the build.
+    //! If the root (or more than half of the objects) must be rebuilt
+    //! a full build is done.
+    //!
+    //! \return the number of subtrees rebuilt (0 = refit only)
+    //!
+    integer update( Real max_growth = Real(1.5), ThreadPoolBase * pool = nullptr );
+
+    //! `sah_cost()` of the tree after the last build
+    Real build_sah_cost() const { return m_build_cost; }
+
+    void intersect_with_one_point( Real const pnt[], AABB_SET & bb_index, Workspace & ws ) const;
+    void intersect_with_one_bbox( Real const bbox[], AABB_SET & bb_index, Workspace & ws ) const;
+    void intersect( AABBtree<Real,DIM> const & aabb, AABB_MAP & bb_index, Workspace & ws ) const;
+
+    void intersect_with_one_point_and_refine( Real const pnt[], AABB_SET & bb_index, Workspace & ws ) const;
+    void intersect_with_one_bbox_and_refine( Real const bbox[], AABB_SET & bb_index, Workspace & ws ) const;
+    void intersect_and_refine( AABBtree<Real,DIM> const & aabb, AABB_MAP & bb_index, Workspace & ws ) const;
+
+    void min_distance_candidates( Real const pnt[], AABB_SET & bb_index, Workspace & ws ) const;
 
-    void intersect_with_one_point_and_refine( Real const pnt[], AABB_SET & bb_index ) const;
-    void intersect_with_one_bbox_and_refine( Real const bbox[], AABB_SET & bb_index ) const;
-    void intersect_and_refine( AABBtree<Real> const & aabb, AABB_MAP & bb_index ) const;
+    // same queries using the workspace of the calling thread
+
+    void
+    intersect_with_one_point( Real const pnt[], AABB_SET & bb_index ) const
+    { intersect_with_one_point( pnt, bb_index, thread_workspace() ); }
+
+    void
+    intersect_with_one_bbox( Real const bbox[], AABB_SET & bb_index ) const
+    { intersect_with_one_bbox( bbox, bb_index, thread_workspace() ); }
+
+    void
+    intersect( AABBtree<Real,DIM> const & aabb, AABB_MAP & bb_index ) const
+    { intersect( aabb, bb_index, thread_workspace() ); }
+
+    void
+    intersect_with_one_point_and_refine( Real const pnt[], AABB_SET & bb_index ) const
+    { intersect_with_one_point_and_refine( pnt, bb_index, thread_workspace() ); }
+
+    void
+    intersect_with_one_bbox_and_refine( Real const bbox[], AABB_SET & bb_index ) const
+    { intersect_with_one_bbox_and_refine( bbox, bb_index, thread_workspace() ); }
+
+    void
+    intersect_and_refine( AABBtree<Real,DIM> const & aabb, AABB_MAP & bb_index ) const
+    { intersect_and_refine( aabb, bb_index, thread_workspace() ); }
+
+    void
+    min_distance_candidates( Real const pnt[], AABB_SET & bb_index ) const
+    { min_distance_candidates( pnt, bb_index, thread_workspace() ); }
+
+    //!
+    //! Visitor queries: `visit(id)` is called for each object found (for the
+    //! tree-tree queries `visit(id1,id2)`, `id1` is a node of this tree if not
+    //! refined as in `AABB_MAP`). If `visit` return a `bool` the query stop
+    //! when it return false. Nothing is allocated.  Point and bbox queries
+    //! use the wide, compact or quantized layout if set (also on a compressed
+    //! tree), the tree-tree queries the binary tree only.
+    //!
+    //! \return false if the query was stopped by the visitor
+    //!
+    template <typename VISIT>
+    bool
+    intersect_with_one_point( Real const pnt[], VISIT && visit, Workspace & ws ) const
+    { return visit_query( pnt, true, false, visit, ws ); }
+
+    template <typename VISIT>
+    bool
+    intersect_with_one_bbox( Real const bbox[], VISIT && visit, Workspace & ws ) const
+    { return visit_query( bbox, false, false, visit, ws ); }
+
+    template <typename VISIT>
+    bool
+    intersect( AABBtree<Real,DIM> const & aabb, VISIT && visit, Workspace & ws ) const
+    { return visit_tree( aabb, false, visit, ws ); }
+
+    template <typename VISIT>
+    bool
+    intersect_with_one_point_and_refine( Real const pnt[], VISIT && visit, Workspace & ws ) const
+    { return visit_query( pnt, true, true, visit, ws ); }
+
+    template <typename VISIT>
+    bool
+    intersect_with_one_bbox_and_refine( Real const bbox[], VISIT && visit, Workspace & ws ) const
+    { return visit_query( bbox, false, true, visit, ws ); }
+
+    template <typename VISIT>
+    bool
+    intersect_and_refine( AABBtree<Real,DIM> const & aabb, VISIT && visit, Workspace & ws ) const
+    { return visit_tree( aabb, true, visit, ws ); }
+
+    template <typename VISIT>
+    bool
+    intersect_with_one_point( Real const pnt[], VISIT && visit ) const
+    { return visit_query( pnt, true, false, visit, thread_workspace() ); }
+
+    template <typename VISIT>
+    bool
+    intersect_with_one_bbox( Real const bbox[], VISIT && visit ) const
+    { return visit_query( bbox, false, false, visit, thread_workspace() ); }
+
+    template <typename VISIT>
+    bool
+    intersect( AABBtree<Real,DIM> const & aabb, VISIT && visit ) const
+    { return visit_tree( aabb, false, visit, thread_workspace() ); }
+
+    template <typename VISIT>
+    bool
+    intersect_with_one_point_and_refine( Real const pnt[], VISIT && visit ) const
+    { return visit_query( pnt, true, true, visit, thread_workspace() ); }
+
+    template <typename VISIT>
+    bool
+    intersect_with_one_bbox_and_refine( Real const bbox[], VISIT && visit ) const
+    { return visit_query( bbox, false, true, visit, thread_workspace() ); }
+
+    template <typename VISIT>
+    bool
+    intersect_and_refine( AABBtree<Real,DIM> const & aabb, VISIT && visit ) const
+    { return visit_tree( aabb, true, visit, thread_workspace() ); }
+
+    //!
+    //! Same queries with the result in a flat vector (cleared, unsorted),
+    //! the vector can be reused to avoid allocations.
+    //!
+    void intersect_with_one_point( Real const pnt[], vector<integer> & out, Workspace & ws ) const;
+    void intersect_with_one_bbox( Real const bbox[], vector<integer> & out, Workspace & ws ) const;
+    void intersect( AABBtree<Real,DIM> const & aabb, AABB_PAIRS & out, Workspace & ws ) const;
+
+    void intersect_with_one_point_and_refine( Real const pnt[], vector<integer> & out, Workspace & ws ) const;
+    void intersect_with_one_bbox_and_refine( Real const bbox[], vector<integer> & out, Workspace & ws ) const;
+    void intersect_and_refine( AABBtree<Real,DIM> const & aabb, AABB_PAIRS & out, Workspace & ws ) const;
+
+    void
+    intersect_with_one_point( Real const pnt[], vector<integer> & out ) const
+    { intersect_with_one_point( pnt, out, thread_workspace() ); }
+
+    void
+    intersect_with_one_bbox( Real const bbox[], vector<integer> & out ) const
+    { intersect_with_one_bbox( bbox, out, thread_workspace() ); }
+
+    void
+    intersect( AABBtree<Real,DIM> const & aabb, AABB_PAIRS & out ) const
+    { intersect( aabb, out, thread_workspace() ); }
+
+    void
+    intersect_with_one_point_and_refine( Real const pnt[], vector<integer> & out ) const
+    { intersect_with_one_point_and_refine( pnt, out, thread_workspace() ); }
+
+    void
+    intersect_with_one_bbox_and_refine( Real const bbox[], vector<integer> & out ) const
+    { intersect_with_one_bbox_and_refine( bbox, out, thread_workspace() ); }
+
+    void
+    intersect_and_refine( AABBtree<Real,DIM> const & aabb, AABB_PAIRS & out ) const
+    { intersect_and_refine( aabb, out, thread_workspace() ); }
+
+    //!
+    //! Pairs `(i,j)` of objects of this tree and of `aabb` with overlapping
+    //! bboxes (`refine`) or stored in overlapping nodes, sorted and without
+    //! repetitions, the result does not depend on the number of threads.
+    //!
+    //! With a pool the first levels of the dual traversal are expanded until
+    //! there are enough node pairs, each node pair is traversed by a task
+    //! filling its own buffer, buffers are merged at the end.
+    //!
+    void
+    intersect_pairs(
+      AABBtree<Real,DIM> const & aabb,
+      AABB_PAIRS               & pairs,
+      bool                       refine = true,
+      ThreadPoolBase           * pool   = nullptr
+    ) const;
+
+    //!
+    //! Pairs `(i,j)`, `i < j`, of objects of this tree with overlapping
+    //! bboxes (`refine`) or stored in overlapping nodes, sorted. Each
+    //! unordered pair is visited once: the objects of a node are paired
+    //! among them, with the subtrees of the children and the subtrees of
+    //! two siblings are intersected. The pool is used as in `intersect_pairs`.
+    //!
+    void
+    self_intersect_pairs(
+      AABB_PAIRS     & pairs,
+      bool             refine = true,
+      ThreadPoolBase * pool   = nullptr
+    ) const;
+
+    //!
+    //! Batch of point queries, result in CSR form: the candidates of the
+    //! point `i` are `index[offset[i]]...index[offset[i+1]-1]` (sorted).
+    //!
+    //! \param pnts   points, point `i` starts at `pnts[i*ldim]`
+    //! \param ldim   leading dimension of `pnts` (>= dim)
+    //! \param npts   number of points
+    //! \param offset vector of size `npts+1`
+    //! \param index  candidates of all the points
+    //! \param refine if true check also the bbox of the objects
+    //! \param pool   if not null the batch is split on the threads of the pool
+    //! \param stats  if not null the counters of the queries are added to it
+    //!
+    void
+    intersect_with_points(
+      Real const        pnts[],
+      integer           ldim,
+      integer           npts,
+      vector<integer> & offset,
+      vector<integer> & index,
+      bool              refine = false,
+      ThreadPoolBase  * pool   = nullptr,
+      BatchStats      * stats  = nullptr
+    ) const;
+
+    //!
+    //! Batch of bbox queries, bboxes are passed as in `add_bboxes`,
+    //! result in CSR form as in `intersect_with_points`.
+    //!
+    void
+    intersect_with_bboxes(
+      Real const        bb_min[], integer ldim0,
+      Real const        bb_max[], integer ldim1,
+      integer           nbox,
+      vector<integer> & offset,
+      vector<integer> & index,
+      bool              refine = false,
+      ThreadPoolBase  * pool   = nullptr,
+      BatchStats      * stats  = nullptr
+    ) const;
+
+    //!
+    //! The `k` objects closest to `pnt` (best first search).
+    //!
+    //! \param pnt      query point
+    //! \param k        number of objects searched
+    //! \param dist     exact distance of an object from `pnt`, if empty
+    //!                 the distance from the bbox of the object is used.
+    //!                 `dist(ipos)` must be >= the distance of `pnt` from
+    //!                 the bbox of object `ipos` (checked in debug builds),
+    //!                 otherwise the result can miss closer objects
+    //! \param res      (distance,id) pairs sorted by distance, at most `k`
+    //! \param max_dist search only objects with distance <= max_dist
+    //!
+    void
+    k_nearest(
+      Real const                       pnt[],
+      integer                          k,
+      DISTANCE_FUN             const & dist,
+      vector<std::pair<Real,integer>> & res,
+      Real                             max_dist,
+      Workspace                      & ws
+    ) const;
+
+    void
+    k_nearest(
+      Real const                       pnt[],
+      integer                          k,
+      DISTANCE_FUN             const & dist,
+      vector<std::pair<Real,integer>> & res,
+      Real                             max_dist = Utils::Inf<Real>()
+    ) const
+    { k_nearest( pnt, k, dist, res, max_dist, thread_workspace() ); }
+
+    //!
+    //! The object closest to `pnt`, `dist` as in `k_nearest`.
+    //!
+    //! \return the id of the object (-1 if none within `max_dist`)
+    //!
+    integer
+    closest_object(
+      Real const           pnt[],
+      DISTANCE_FUN const & dist,
+      Real               & d_min,
+      Real                 max_dist,
+      Workspace          & ws
+    ) const;
+
+    integer
+    closest_object(
+      Real const           pnt[],
+      DISTANCE_FUN const & dist,
+      Real               & d_min,
+      Real                 max_dist = Utils::Inf<Real>()
+    ) const
+    { return closest_object( pnt, dist, d_min, max_dist, thread_workspace() ); }
+
+    //!
+    //! First object hit by the ray `orig + t * dir` with `t` in `[t_min,t_max]`.
+    //! Nodes are visited front to back and pruned by the closest hit found.
+    //!
+    //! \param hit   exact intersection test, if empty the bbox of the
+    //!              objects are used
+    //! \param t_hit parameter of the hit
+    //! \return the id of the object hit (-1 if none)
+    //!
+    integer
+    ray_first_hit(
+      Real const          orig[],
+      Real const          dir[],
+      Real                t_min,
+      Real                t_max,
+      RAY_HIT_FUN const & hit,
+      Real              & t_hit,
+      Workspace         & ws
+    ) const
+    { return ray_cast( orig, dir, t_min, t_max, hit, false, t_hit, ws ); }
+
+    integer
+    ray_first_hit(
+      Real const          orig[],
+      Real const          dir[],
+      Real                t_min,
+      Real                t_max,
+      RAY_HIT_FUN const & hit,
+      Real              & t_hit
+    ) const
+    { return ray_cast( orig, dir, t_min, t_max, hit, false, t_hit, thread_workspace() ); }
+
+    //!
+    //! As `ray_first_hit` but stop at the first object hit (not the closest),
+    //! for visibility tests.
+    //!
+    integer
+    ray_any_hit(
+      Real const          orig[],
+      Real const          dir[],
+      Real                t_min,
+      Real                t_max,
+      RAY_HIT_FUN const & hit,
+      Real              & t_hit,
+      Workspace         & ws
+    ) const
+    { return ray_cast( orig, dir, t_min, t_max, hit, true, t_hit, ws ); }
+
+    integer
+    ray_any_hit(
+      Real const          orig[],
+      Real const          dir[],
+      Real                t_min,
+      Real                t_max,
+      RAY_HIT_FUN const & hit,
+      Real              & t_hit
+    ) const
+    { return ray_cast( orig, dir, t_min, t_max, hit, true, t_hit, thread_workspace() ); }
+
+    //!
+    //! Objects whose bbox is crossed by the ray `orig + t * dir`
+    //! with `t` in `[t_min,t_max]`.
+    //!
+    void
+    intersect_with_ray(
+      Real const   orig[],
+      Real const   dir[],
+      Real         t_min,
+      Real         t_max,
+      AABB_SET   & bb_index,
+      Workspace  & ws
+    ) const;
+
+    void
+    intersect_with_ray(
+      Real const   orig[],
+      Real const   dir[],
+      Real         t_min,
+      Real         t_max,
+      AABB_SET   & bb_index
+    ) const
+    { intersect_with_ray( orig, dir, t_min, t_max, bb_index, thread_workspace() ); }
+
+    //!
+    //! Segment queries: the ray `pa + t * (pb-pa)` with `t` in `[0,1]`.
+    //!
+    integer
+    segment_first_hit(
+      Real const          pa[],
+      Real const          pb[],
+      RAY_HIT_FUN const & hit,
+      Real              & t_hit,
+      Workspace         & ws
+    ) const
+    { return ray_cast( pa, segment_dir( pa, pb, ws ), 0, 1, hit, false, t_hit, ws ); }
+
+    integer
+    segment_first_hit(
+      Real const          pa[],
+      Real const          pb[],
+      RAY_HIT_FUN const & hit,
+      Real              & t_hit
+    ) const
+    { return segment_first_hit( pa, pb, hit, t_hit, thread_workspace() ); }
+
+    integer
+    segment_any_hit(
+      Real const          pa[],
+      Real const          pb[],
+      RAY_HIT_FUN const & hit,
+      Real              & t_hit,
+      Workspace         & ws
+    ) const
+    { return ray_cast( pa, segment_dir( pa, pb, ws ), 0, 1, hit, true, t_hit, ws ); }
+
+    integer
+    segment_any_hit(
+      Real const          pa[],
+      Real const          pb[],
+      RAY_HIT_FUN const & hit,
+      Real              & t_hit
+    ) const
+    { return segment_any_hit( pa, pb, hit, t_hit, thread_workspace() ); }
+
+    void
+    intersect_with_segment(
+      Real const   pa[],
+      Real const   pb[],
+      AABB_SET   & bb_index,
+      Workspace  & ws
+    ) const
+    { intersect_with_ray( pa, segment_dir( pa, pb, ws ), 0, 1, bb_index, ws ); }
+
+    void
+    intersect_with_segment(
+      Real const   pa[],
+      Real const   pb[],
+      AABB_SET   & bb_index
+    ) const
+    { intersect_with_segment( pa, pb, bb_index, thread_workspace() ); }
 
-    void min_distance_candidates( Real const pnt[], AABB_SET & bb_index ) const;
     void pnt_bbox_minmax( Real const pnt[], Real const bbox[], Real & dmin, Real & dmax ) const;
 
-    integer dim()            const { return m_dim; }
+    integer dim()            const { return DIM > 0 ? DIM : m_dim; }
+    integer dim2()           const { return DIM > 0 ? 2*DIM : m_2dim; }
     integer num_objects()    const { return m_num_objects; }
     integer num_tree_nodes() const { return m_num_tree_nodes; }
-    integer num_check()      const { return m_num_check; }
+
+    //!
+    //! Queries called without a workspace share one thread local workspace
+    //! for all the trees of this type: the three functions below are not
+    //! per-tree state, they refer to the last such query of the calling
+    //! thread, on any tree. For per-query counters pass a `Workspace`.
+    //!
+
+    //! bbox checks of the last query of the calling thread without a workspace
+    static integer num_check() { return thread_workspace().num_check; }
+
+    //! collect (or not) the counters of the queries of the calling thread without a workspace
+    static void collect_thread_stats( bool yes ) { thread_workspace().collect_stats = yes; }
+
+    //! counters of the last query of the calling thread without a workspace
+    static QueryStats const & thread_query_stats() { return thread_workspace().stats; }
 
     integer num_tree_nodes( integer nmin ) const;
 
@@ -184,6 +1196,21 @@ namespace Utils {
 
     void get_bbox_indexes_of_a_node( integer i_pos, AABB_SET & bb_index ) const;
 
+    //!
+    //! Quality of the tree: expected number of bbox checks of a refined query
+    //! with a random ray, sum over the nodes of
+    //! `surface(node)/surface(root)*(1+objects in node)`.
+    //!
+    Real sah_cost() const;
+
+    //! bytes of the node and bbox arrays (or of the mapped file) and of the optional layouts
+    size_t memory_usage() const;
+
+    //!
+    //! Parameters and structure of the tree: depth and occupancy of the
+    //! leaves and mean overlap of the children of a node (volume of the
+    //! intersection over the volume of the father).
+    //!
     string info() const;
   };
 
@@ -191,9 +1218,142 @@ namespace Utils {
   // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   */
 
+  /*
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+  */
+
+  template <typename Real, int DIM>
+  template <typename VISIT>
+  bool
+  AABBtree<Real,DIM>::visit_query(
+    Real const  q[],
+    bool        is_point,
+    bool        refine,
+    VISIT    && visit,
+    Workspace & ws
+  ) const {
+    using IS_VOID = typename std::is_void<decltype(visit(integer(0)))>::type;
+
+    start_query( ws );
+    if ( m_num_tree_nodes == 0 ) return true;
+
+    // the layouts (the only nodes of a compressed tree) are in the .cc
+    bool completed = true;
+    if ( layout_visit(
+           q, is_point, refine, ws,
+           [&visit]( integer s ) { return call_visitor( IS_VOID(), visit, s ); },
+           completed
+         ) ) return completed;
+
+    vector<integer> & stack = ws.stack;
+    stack.clear();
+    stack.emplace_back(0);
+    while ( !stack.empty() ) {
+      integer id_father = stack.back(); stack.pop_back();
+      Real const * bb_father = node_bbox( id_father );
+      check_node( ws );
+      bool overlap = is_point ? overlap_point( q, bb_father )
+                              : overlap_bbox( bb_father, q );
+      if ( !overlap ) continue;
+
+      integer         num = m_num_nodes[id_father];
+      integer const * ptr = m_id_nodes + m_ptr_nodes[id_father];
+      for ( integer ii = 0; ii < num; ++ii ) {
+        integer s = ptr[ii];
+        if ( refine ) {
+          Real const * bb_s = obj_bbox( s );
+          check_object( ws );
+          bool olap = is_point ? overlap_point( q, bb_s )
+                               : overlap_bbox( bb_s, q );
+          if ( !olap ) continue;
+        }
+        count_hits( ws, 1 );
+        if ( !call_visitor( IS_VOID(), visit, s ) ) return false;
+      }
+
+      integer nn = m_child[id_father];
+      if ( nn > 0 ) { stack.emplace_back(nn); stack.emplace_back(nn+1); }
+    }
+    return true;
+  }
+
+  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+  template <typename Real, int DIM>
+  template <typename VISIT>
+  bool
+  AABBtree<Real,DIM>::visit_tree_from(
+    AABBtree<Real,DIM> const & aabb,
+    integer                    sroot1,
+    integer                    root2,
+    bool                       refine,
+    VISIT                   && visit,
+    Workspace                & ws
+  ) const {
+    using IS_VOID = typename std::is_void<decltype(visit(integer(0),integer(0)))>::type;
+
+    // same traversal of `intersect`, a negative first node means that only
+    // its objects must be checked (children already pushed)
+    vector<integer> & stack = ws.stack;
+    stack.clear();
+    stack.emplace_back(sroot1);
+    stack.emplace_back(root2);
+    while ( !stack.empty() ) {
+      root2  = stack.back(); stack.pop_back();
+      sroot1 = stack.back(); stack.pop_back();
+      integer root1 = sroot1 >= 0 ? sroot1 : -1-sroot1;
+
+      check_node( ws );
+      bool overlap = overlap_bbox( node_bbox( root1 ), aabb.node_bbox( root2 ) );
+      if ( !overlap ) continue;
+
+      integer id_lr1 = sroot1 >= 0 ? m_child[root1] : -1;
+      integer id_lr2 = aabb.m_child[root2];
+      integer nn1 = m_num_nodes[root1];
+      integer nn2 = aabb.m_num_nodes[root2];
+      // with children the objects of root1 are checked by the pair (-1-root1,root2)
+      if ( nn1 > 0 && nn2 > 0 && id_lr1 < 0 ) {
+        integer const * ptr1 = m_id_nodes + m_ptr_nodes[root1];
+        integer const * ptr2 = aabb.m_id_nodes + aabb.m_ptr_nodes[root2];
+        if ( refine ) {
+          for ( integer ii = 0; ii < nn1; ++ii ) {
+            integer      s1    = ptr1[ii];
+            Real const * bb_s1 = obj_bbox( s1 );
+            for ( integer jj = 0; jj < nn2; ++jj ) {
+              integer s2 = ptr2[jj];
+              check_object( ws );
+              if ( !overlap_bbox( bb_s1, aabb.obj_bbox( s2 ) ) ) continue;
+              count_hits( ws, 1 );
+              if ( !call_visitor( IS_VOID(), visit, s1, s2 ) ) return false;
+            }
+          }
+        } else {
+          for ( integer jj = 0; jj < nn2; ++jj ) {
+            count_hits( ws, 1 );
+            if ( !call_visitor( IS_VOID(), visit, root1, ptr2[jj] ) ) return false;
+          }
+        }
+      }
+
+      if ( id_lr1 >= 0 ) {
+        stack.emplace_back(id_lr1);   stack.emplace_back(root2);
+        stack.emplace_back(id_lr1+1); stack.emplace_back(root2);
+        if ( nn1 > 0 ) { stack.emplace_back(-1-root1); stack.emplace_back(root2); }
+      } else if ( id_lr2 >= 0 ) {
+        stack.emplace_back(sroot1); stack.emplace_back(id_lr2);
+        stack.emplace_back(sroot1); stack.emplace_back(id_lr2+1);
+      }
+    }
+    return true;
+  }
+
   #ifndef UTILS_OS_WINDOWS
   extern template class AABBtree<float>;
   extern template class AABBtree<double>;
+  extern template class AABBtree<float,2>;
+  extern template class AABBtree<float,3>;
+  extern template class AABBtree<double,2>;
+  extern template class AABBtree<double,3>;
   #endif
 
 }
@@ -0,0 +1,596 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2026                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+///
+/// file: Utils_AABB_tree_dynamic.cc
+///
+
+#include "Utils_AABB_tree_dynamic.hh"
+#include <algorithm>
+
+namespace Utils {
+
+  using std::max;
+  using std::min;
+  using std::copy_n;
+
+  template <typename Real>
+  AABBtreeDynamic<Real>::AABBtreeDynamic( integer dim, Real fat_margin )
+  : m_dim(dim)
+  , m_2dim(2*dim)
+  {
+    UTILS_ASSERT(
+      dim > 0,
+      "AABBtreeDynamic( dim = {}, ... ) dim must be > 0\n", dim
+    );
+    set_fat_margin( fat_margin );
+    m_overlap.setup( dim );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  typename AABBtreeDynamic<Real>::Workspace &
+  AABBtreeDynamic<Real>::thread_workspace() {
+    static thread_local Workspace ws;
+    return ws;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::set_fat_margin( Real margin ) {
+    UTILS_ASSERT(
+      margin >= 0,
+      "AABBtreeDynamic::set_fat_margin( margin = {} ) margin must be >= 0\n",
+      margin
+    );
+    m_fat_margin = margin;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // sum of the measure of the faces (perimeter in 2D, area in 3D)
+  // of a bbox with sides `side(0)`, ..., `side(dim-1)`
+  //
+  template <typename Real, typename SIDE>
+  static
+  Real
+  faces_measure( int dim, SIDE const & side ) {
+    if ( dim == 1 ) return side(0);
+    Real res = 0;
+    for ( int j = 0; j < dim; ++j ) {
+      Real f = 1;
+      for ( int k = 0; k < dim; ++k )
+        if ( k != j ) f *= side(k);
+      res += f;
+    }
+    return res;
+  }
+
+  template <typename Real>
+  Real
+  AABBtreeDynamic<Real>::surface( Real const bb[] ) const {
+    integer const d = m_dim;
+    return faces_measure<Real>( d, [bb,d]( integer k ) { return bb[d+k] - bb[k]; } );
+  }
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::union_of( Real const bb1[], Real const bb2[], Real res[] ) const {
+    for ( integer j = 0; j < m_dim; ++j ) {
+      res[j]       = min( bb1[j],       bb2[j]       );
+      res[m_dim+j] = max( bb1[m_dim+j], bb2[m_dim+j] );
+    }
+  }
+
+  // the sides of the union are computed on the fly (no shared scratch)
+  template <typename Real>
+  Real
+  AABBtreeDynamic<Real>::surface_of_union( Real const bb1[], Real const bb2[] ) const {
+    integer const d = m_dim;
+    return faces_measure<Real>(
+      d,
+      [bb1,bb2,d]( integer k ) { return max( bb1[d+k], bb2[d+k] ) - min( bb1[k], bb2[k] ); }
+    );
+  }
+
+  template <typename Real>
+  bool
+  AABBtreeDynamic<Real>::contains( Real const outer[], Real const inner[] ) const {
+    for ( integer j = 0; j < m_dim; ++j )
+      if ( inner[j] < outer[j] || inner[m_dim+j] > outer[m_dim+j] ) return false;
+    return true;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  typename AABBtreeDynamic<Real>::integer
+  AABBtreeDynamic<Real>::allocate_node() {
+    integer n;
+    if ( m_free >= 0 ) {
+      n      = m_free;
+      m_free = m_parent[n];
+    } else {
+      n = integer( m_parent.size() );
+      m_bbox.resize( m_bbox.size() + size_t(m_2dim) );
+      m_tight.resize( m_tight.size() + size_t(m_2dim) );
+      m_parent.emplace_back(-1);
+      m_child1.emplace_back(-1);
+      m_child2.emplace_back(-1);
+      m_height.emplace_back(0);
+      m_id.emplace_back(-1);
+    }
+    m_parent[n] = -1;
+    m_child1[n] = -1;
+    m_child2[n] = -1;
+    m_height[n] = 0;
+    m_id[n]     = -1;
+    return n;
+  }
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::free_node( integer n ) {
+    m_parent[n] = m_free;
+    m_height[n] = -1;
+    m_free      = n;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::set_fat_bbox(
+    integer    leaf,
+    Real const bb_min[],
+    Real const bb_max[]
+  ) {
+    Real * tight = m_tight.data() + leaf * m_2dim;
+    Real * fat   = bbox( leaf );
+    for ( integer j = 0; j < m_dim; ++j ) {
+      UTILS_ASSERT(
+        bb_min[j] <= bb_max[j],
+        "AABBtreeDynamic, bad bbox max < min ({} < {})\n", bb_max[j], bb_min[j]
+      );
+      tight[j]       = bb_min[j];
+      tight[m_dim+j] = bb_max[j];
+      fat[j]         = bb_min[j] - m_fat_margin;
+      fat[m_dim+j]   = bb_max[j] + m_fat_margin;
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // The leaf becomes the sibling of the node minimizing the increase of
+  // surface of the tree (branch and bound descent as in Box2D).
+  //
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::insert_leaf( integer leaf ) {
+
+    if ( m_root < 0 ) {
+      m_root         = leaf;
+      m_parent[leaf] = -1;
+      return;
+    }
+
+    integer idx = m_root;
+    while ( !is_leaf(idx) ) {
+      integer c1 = m_child1[idx];
+      integer c2 = m_child2[idx];
+
+      Real area     = surface( bbox(idx) );
+      Real combined = surface_of_union( bbox(idx), bbox(leaf) );
+
+      // cost of creating a new parent for this node and the new leaf
+      Real cost = 2 * combined;
+
+      // minimum cost of pushing the leaf further down the tree
+      Real inheritance = 2 * ( combined - area );
+
+      Real cost1 = surface_of_union( bbox(leaf), bbox(c1) ) + inheritance;
+      Real cost2 = surface_of_union( bbox(leaf), bbox(c2) ) + inheritance;
+      if ( !is_leaf(c1) ) cost1 -= surface( bbox(c1) );
+      if ( !is_leaf(c2) ) cost2 -= surface( bbox(c2) );
+
+      if ( cost < cost1 && cost < cost2 ) break;
+
+      idx = cost1 < cost2 ? c1 : c2;
+    }
+
+    integer sibling    = idx;
+    integer old_parent = m_parent[sibling];
+    integer new_parent = allocate_node(); // may reallocate the vectors
+
+    m_parent[new_parent] = old_parent;
+    m_height[new_parent] = m_height[sibling] + 1;
+    union_of( bbox(leaf), bbox(sibling), bbox(new_parent) );
+
+    if ( old_parent >= 0 ) {
+      if ( m_child1[old_parent] == sibling ) m_child1[old_parent] = new_parent;
+      else                                   m_child2[old_parent] = new_parent;
+    } else {
+      m_root = new_parent;
+    }
+    m_child1[new_parent] = sibling;
+    m_child2[new_parent] = leaf;
+    m_parent[sibling]    = new_parent;
+    m_parent[leaf]       = new_parent;
+
+    fix_upward( m_parent[leaf] );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::remove_leaf( integer leaf ) {
+
+    if ( leaf == m_root ) { m_root = -1; return; }
+
+    integer parent       = m_parent[leaf];
+    integer grand_parent = m_parent[parent];
+    integer sibling      = m_child1[parent] == leaf ? m_child2[parent] : m_child1[parent];
+
+    if ( grand_parent >= 0 ) {
+      // destroy parent and connect sibling to grand parent
+      if ( m_child1[grand_parent] == parent ) m_child1[grand_parent] = sibling;
+      else                                    m_child2[grand_parent] = sibling;
+      m_parent[sibling] = grand_parent;
+      free_node( parent );
+      fix_upward( grand_parent );
+    } else {
+      m_root            = sibling;
+      m_parent[sibling] = -1;
+      free_node( parent );
+    }
+    m_parent[leaf] = -1;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // rebalance, update heights and bboxes from node `n` to the root
+  //
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::fix_upward( integer n ) {
+    while ( n >= 0 ) {
+      n = balance( n );
+      integer c1 = m_child1[n];
+      integer c2 = m_child2[n];
+      m_height[n] = 1 + max( m_height[c1], m_height[c2] );
+      union_of( bbox(c1), bbox(c2), bbox(n) );
+      n = m_parent[n];
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // Rotate up the higher child of `a` if the tree is unbalanced,
+  // return the index of the new root of the subtree.
+  //
+  //       a              c
+  //      / \            / \    c higher than b
+  //     b   c    ->    a   f (or g)
+  //        / \        / \      f higher than g
+  //       f   g      b   g (or f)
+  //
+  template <typename Real>
+  typename AABBtreeDynamic<Real>::integer
+  AABBtreeDynamic<Real>::balance( integer a ) {
+
+    if ( is_leaf(a) || m_height[a] < 2 ) return a;
+
+    integer b   = m_child1[a];
+    integer c   = m_child2[a];
+    integer bal = m_height[c] - m_height[b];
+
+    // rotate up the child `up`, `other` is the child that stays under `a`
+    auto rotate = [this,a]( integer up, integer other, bool up_is_child2 ) -> integer {
+      integer f = m_child1[up];
+      integer g = m_child2[up];
+
+      // swap a and up
+      m_child1[up] = a;
+      m_parent[up] = m_parent[a];
+      m_parent[a]  = up;
+
+      // the old parent of a must point to up
+      integer p = m_parent[up];
+      if ( p >= 0 ) {
+        if ( m_child1[p] == a ) m_child1[p] = up;
+        else                    m_child2[p] = up;
+      } else {
+        m_root = up;
+      }
+
+      // the higher grandchild stays with up, the other goes to a
+      integer keep = f, give = g;
+      if ( m_height[f] <= m_height[g] ) { keep = g; give = f; }
+      m_child2[up]   = keep;
+      m_parent[give] = a;
+      if ( up_is_child2 ) m_child2[a] = give;
+      else                m_child1[a] = give;
+
+      union_of( bbox(other), bbox(give), bbox(a) );
+      union_of( bbox(a), bbox(keep), bbox(up) );
+      m_height[a]  = 1 + max( m_height[other], m_height[give] );
+      m_height[up] = 1 + max( m_height[a], m_height[keep] );
+      return up;
+    };
+
+    if ( bal >  1 ) return rotate( c, b, true  );
+    if ( bal < -1 ) return rotate( b, c, false );
+    return a;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  typename AABBtreeDynamic<Real>::integer
+  AABBtreeDynamic<Real>::insert(
+    Real const bb_min[],
+    Real const bb_max[],
+    integer    id
+  ) {
+    integer leaf = allocate_node();
+    set_fat_bbox( leaf, bb_min, bb_max );
+    m_id[leaf] = id;
+    insert_leaf( leaf );
+    ++m_num_objects;
+    return leaf;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::remove( integer h ) {
+    UTILS_ASSERT(
+      h >= 0 && h < integer(m_parent.size()) && m_height[h] == 0,
+      "AABBtreeDynamic::remove( h = {} ) bad handle\n", h
+    );
+    remove_leaf( h );
+    free_node( h );
+    --m_num_objects;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  bool
+  AABBtreeDynamic<Real>::move(
+    integer    h,
+    Real const bb_min[],
+    Real const bb_max[]
+  ) {
+    UTILS_ASSERT(
+      h >= 0 && h < integer(m_parent.size()) && m_height[h] == 0,
+      "AABBtreeDynamic::move( h = {}, ... ) bad handle\n", h
+    );
+    Real * tight = m_tight.data() + h * m_2dim;
+    copy_n( bb_min, m_dim, tight );
+    copy_n( bb_max, m_dim, tight+m_dim );
+    if ( contains( bbox(h), tight ) ) return false;
+    remove_leaf( h );
+    set_fat_bbox( h, bb_min, bb_max );
+    insert_leaf( h );
+    return true;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::clear() {
+    m_bbox.clear();
+    m_tight.clear();
+    m_parent.clear();
+    m_child1.clear();
+    m_child2.clear();
+    m_height.clear();
+    m_id.clear();
+    m_root        = -1;
+    m_free        = -1;
+    m_num_objects = 0;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  //
+  // with `refine` a leaf is checked with the bbox of the object
+  // instead of the fat bbox
+  //
+  template <typename Real>
+  template <typename VISIT>
+  void
+  AABBtreeDynamic<Real>::visit_query(
+    Real const  q[],
+    bool        is_point,
+    bool        refine,
+    VISIT    && visit,
+    Workspace & ws
+  ) const {
+    using TREE = AABBtree<Real>;
+
+    TREE::start_query( ws );
+    if ( m_root < 0 ) return;
+
+    vector<integer> & stack = ws.stack;
+    stack.clear();
+    stack.emplace_back( m_root );
+    while ( !stack.empty() ) {
+      integer n = stack.back(); stack.pop_back();
+      Real const * b;
+      if ( refine && is_leaf(n) ) {
+        b = m_tight.data() + n * m_2dim;
+        TREE::check_object( ws );
+      } else {
+        b = bbox(n);
+        TREE::check_node( ws );
+      }
+      bool overlap = is_point ? m_overlap.point( q, b ) : m_overlap.bbox( b, q );
+      if ( !overlap ) continue;
+      if ( is_leaf(n) ) {
+        TREE::count_hits( ws, 1 );
+        visit( m_id[n] );
+      } else {
+        stack.emplace_back( m_child1[n] );
+        stack.emplace_back( m_child2[n] );
+      }
+    }
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::intersect_with_one_point(
+    Real const  pnt[],
+    AABB_SET  & bb_index,
+    Workspace & ws
+  ) const {
+    visit_query( pnt, true, false, [&bb_index]( integer id ) { bb_index.insert( id ); }, ws );
+  }
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::intersect_with_one_bbox(
+    Real const  bbox_q[],
+    AABB_SET  & bb_index,
+    Workspace & ws
+  ) const {
+    visit_query( bbox_q, false, false, [&bb_index]( integer id ) { bb_index.insert( id ); }, ws );
+  }
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::intersect_with_one_point_and_refine(
+    Real const  pnt[],
+    AABB_SET  & bb_index,
+    Workspace & ws
+  ) const {
+    visit_query( pnt, true, true, [&bb_index]( integer id ) { bb_index.insert( id ); }, ws );
+  }
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::intersect_with_one_bbox_and_refine(
+    Real const  bbox_q[],
+    AABB_SET  & bb_index,
+    Workspace & ws
+  ) const {
+    visit_query( bbox_q, false, true, [&bb_index]( integer id ) { bb_index.insert( id ); }, ws );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  Real
+  AABBtreeDynamic<Real>::surface_ratio() const {
+    if ( m_root < 0 ) return 0;
+    Real S0 = surface( bbox(m_root) );
+    if ( S0 <= 0 ) return 0;
+    Real S = 0;
+    for ( integer n = 0; n < integer(m_height.size()); ++n )
+      if ( m_height[n] > 0 ) S += surface( bbox(n) );
+    return S / S0;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  void
+  AABBtreeDynamic<Real>::validate() const {
+    if ( m_root < 0 ) {
+      UTILS_ASSERT0( m_num_objects == 0, "AABBtreeDynamic::validate, empty tree with objects\n" );
+      return;
+    }
+    UTILS_ASSERT0( m_parent[m_root] == -1, "AABBtreeDynamic::validate, root with a parent\n" );
+    integer         n_leaf = 0;
+    vector<integer> stack{ m_root };
+    vector<Real>    bb( static_cast<size_t>(m_2dim) );
+    while ( !stack.empty() ) {
+      integer n = stack.back(); stack.pop_back();
+      if ( is_leaf(n) ) {
+        UTILS_ASSERT( m_height[n] == 0, "AABBtreeDynamic::validate, leaf {} height {}\n", n, m_height[n] );
+        UTILS_ASSERT(
+          contains( bbox(n), m_tight.data() + n * m_2dim ),
+          "AABBtreeDynamic::validate, leaf {} fat bbox do not contain the object\n", n
+        );
+        ++n_leaf;
+        continue;
+      }
+      integer c1 = m_child1[n];
+      integer c2 = m_child2[n];
+      UTILS_ASSERT(
+        m_parent[c1] == n && m_parent[c2] == n,
+        "AABBtreeDynamic::validate, bad parent of the children of {}\n", n
+      );
+      UTILS_ASSERT(
+        m_height[n] == 1 + max( m_height[c1], m_height[c2] ),
+        "AABBtreeDynamic::validate, bad height of node {}\n", n
+      );
+      union_of( bbox(c1), bbox(c2), bb.data() );
+      UTILS_ASSERT(
+        std::equal( bb.begin(), bb.end(), bbox(n) ),
+        "AABBtreeDynamic::validate, bad bbox of node {}\n", n
+      );
+      stack.emplace_back(c1);
+      stack.emplace_back(c2);
+    }
+    UTILS_ASSERT(
+      n_leaf == m_num_objects,
+      "AABBtreeDynamic::validate, found {} leaves, expected {}\n", n_leaf, m_num_objects
+    );
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template <typename Real>
+  string
+  AABBtreeDynamic<Real>::info() const {
+    string res = "---- AABB dynamic tree info ----\n";
+    res += fmt::format( "  Dimension                {}\n", m_dim );
+    res += fmt::format( "  Number of objects        {}\n", m_num_objects );
+    res += fmt::format( "  Number of nodes          {}\n", m_root < 0 ? 0 : 2*m_num_objects-1 );
+    res += fmt::format( "  Height                   {}\n", height() );
+    res += fmt::format( "  fat margin               {}\n", m_fat_margin );
+    res += fmt::format( "  surface ratio            {:.4}\n", surface_ratio() );
+    res += "--------------------------------\n";
+    return res;
+  }
+
+  // . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . . .
+
+  template class AABBtreeDynamic<float>;
+  template class AABBtreeDynamic<double>;
+
+}
+
+///
+/// eof: Utils_AABB_tree_dynamic.cc
+///
@@ -0,0 +1,176 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2026                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+///
+/// file: Utils_AABB_tree_dynamic.hh
+///
+#pragma once
+
+#ifndef UTILS_AABB_TREE_DYNAMIC_dot_HH
+#define UTILS_AABB_TREE_DYNAMIC_dot_HH
+
+#include "Utils_AABB_tree.hh"
+
+namespace Utils {
+
+  //!
+  //! Dynamic AABB tree: objects can be inserted, removed and moved
+  //! in O(log n) without rebuilding the tree.
+  //!
+  //! - leaves store a "fat" bbox (the bbox of the object enlarged by
+  //!   `fat_margin`), a move inside the fat bbox does not touch the tree;
+  //! - a new leaf is inserted as sibling of the node minimizing the
+  //!   increase of surface (perimeter in 2D, area in 3D);
+  //! - the tree is kept balanced with AVL-like rotations on the path
+  //!   from the modified leaf to the root.
+  //!
+  //! Objects are identified by the handle returned by `insert`, the
+  //! queries return the user `id` given to `insert`.
+  //!
+  template <typename Real>
+  class AABBtreeDynamic {
+  public:
+
+    using integer   = int;
+    using AABB_SET  = set<integer>;
+    using Workspace = typename AABBtree<Real>::Workspace;
+
+  private:
+
+    integer m_dim{0};
+    integer m_2dim{0};
+    Real    m_fat_margin{0};
+
+    // nodes, free nodes are linked by m_parent
+    vector<Real>    m_bbox;     // fat bbox of the node [min,max]
+    vector<Real>    m_tight;    // bbox of the object (leaves only)
+    vector<integer> m_parent;
+    vector<integer> m_child1;   // -1 for leaves
+    vector<integer> m_child2;
+    vector<integer> m_height;   // 0 for leaves, -1 for free nodes
+    vector<integer> m_id;       // user id (leaves only)
+
+    integer m_root{-1};
+    integer m_free{-1};
+    integer m_num_objects{0};
+
+    AABBoverlap<Real,0> m_overlap;
+
+    Real       * bbox( integer n )       { return m_bbox.data() + n * m_2dim; }
+    Real const * bbox( integer n ) const { return m_bbox.data() + n * m_2dim; }
+
+    bool is_leaf( integer n ) const { return m_child1[n] < 0; }
+
+    Real surface( Real const bb[] ) const;
+    Real surface_of_union( Real const bb1[], Real const bb2[] ) const;
+    void union_of( Real const bb1[], Real const bb2[], Real res[] ) const;
+    bool contains( Real const outer[], Real const inner[] ) const;
+
+    integer allocate_node();
+    void    free_node( integer n );
+    void    insert_leaf( integer leaf );
+    void    remove_leaf( integer leaf );
+    integer balance( integer a );
+    void    fix_upward( integer n );
+    void    set_fat_bbox( integer leaf, Real const bb_min[], Real const bb_max[] );
+
+    static Workspace & thread_workspace();
+
+    // single traversal of the point/bbox queries, `visit` gets the leaves
+    template <typename VISIT>
+    void visit_query( Real const q[], bool is_point, bool refine, VISIT && visit, Workspace & ws ) const;
+
+  public:
+
+    explicit
+    AABBtreeDynamic( integer dim, Real fat_margin = 0 );
+
+    //! enlargement of the bbox stored in the leaves (new objects only)
+    void set_fat_margin( Real margin );
+    Real fat_margin() const { return m_fat_margin; }
+
+    //!
+    //! Insert a new object with bbox `[bb_min,bb_max]` and user `id`.
+    //!
+    //! \return the handle of the object
+    //!
+    integer insert( Real const bb_min[], Real const bb_max[], integer id );
+
+    //! remove the object with handle `h`
+    void remove( integer h );
+
+    //!
+    //! Change the bbox of the object with handle `h`.
+    //! The tree is updated only if the new bbox exit from the fat bbox.
+    //!
+    //! \return true if the tree was modified
+    //!
+    bool move( integer h, Real const bb_min[], Real const bb_max[] );
+
+    //! user id of the object with handle `h`
+    integer id( integer h ) const { return m_id[h]; }
+
+    void clear();
+
+    void intersect_with_one_point( Real const pnt[], AABB_SET & bb_index, Workspace & ws ) const;
+    void intersect_with_one_bbox( Real const bbox[], AABB_SET & bb_index, Workspace & ws ) const;
+    void intersect_with_one_point_and_refine( Real const pnt[], AABB_SET & bb_index, Workspace & ws ) const;
+    void intersect_with_one_bbox_and_refine( Real const bbox[], AABB_SET & bb_index, Workspace & ws ) const;
+
+    void
+    intersect_with_one_point( Real const pnt[], AABB_SET & bb_index ) const
+    { intersect_with_one_point( pnt, bb_index, thread_workspace() ); }
+
+    void
+    intersect_with_one_bbox( Real const bbox[], AABB_SET & bb_index ) const
+    { intersect_with_one_bbox( bbox, bb_index, thread_workspace() ); }
+
+    void
+    intersect_with_one_point_and_refine( Real const pnt[], AABB_SET & bb_index ) const
+    { intersect_with_one_point_and_refine( pnt, bb_index, thread_workspace() ); }
+
+    void
+    intersect_with_one_bbox_and_refine( Real const bbox[], AABB_SET & bb_index ) const
+    { intersect_with_one_bbox_and_refine( bbox, bb_index, thread_workspace() ); }
+
+    integer dim()         const { return m_dim; }
+    integer num_objects() const { return m_num_objects; }
+    integer height()      const { return m_root < 0 ? 0 : m_height[m_root]; }
+
+    //! sum of the surfaces of the internal nodes over the surface of the root
+    Real surface_ratio() const;
+
+    //! check the invariants of the tree (links, bboxes, heights)
+    void validate() const;
+
+    string info() const;
+  };
+
+  #ifndef UTILS_OS_WINDOWS
+  extern template class AABBtreeDynamic<float>;
+  extern template class AABBtreeDynamic<double>;
+  #endif
+
+}
+
+#endif
+
+///
+/// eof: Utils_AABB_tree_dynamic.hh
+///
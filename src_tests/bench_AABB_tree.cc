@@ -0,0 +1,469 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2022                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+//
+// Benchmark of AABBtree.
+//
+// For each box distribution (uniform, clustered, elongated, mesh-like) and
+// number of boxes, each builder and each value of the tree parameters
+// measure build time, memory, quality (SAH cost) and, for point, box,
+// nearest and tree-tree queries, the throughput and the bbox checks done
+// (`num_check`) per query.
+//
+// usage: bench_AABB_tree [--full] [--csv|--json] [--dist=NAME] [--builder=NAME]
+//                        [--n=N] [--reps=N]
+//
+//   --full         1e3 ... 1e7 boxes and full sweep of
+//                  max_num_objects_per_node and bbox_long_edge_ratio
+//   --csv          comma separated output
+//   --json         one json object for each run
+//   --dist=NAME    run only the distributions whose name contains NAME
+//   --builder=NAME run only the builders whose name contains NAME
+//   --n=N          run only with N boxes
+//   --reps=N       repetitions of the build, the median is reported
+//
+
+#include "Utils_AABB_tree.hh"
+
+#include <cstring>
+#include <random>
+
+using std::string;
+using std::vector;
+
+using real_type = double;
+using integer   = int;
+using AABBtree  = Utils::AABBtree<real_type>;
+
+static integer const dim = 3;
+
+/*\
+ |   ___  _    _       _ _         _   _
+ |  |   \(_)__| |_ _ _(_) |__ _  _| |_(_)___ _ _  ___
+ |  | |) | (_-<  _| '_| | '_ \ || |  _| / _ \ ' \(_-<
+ |  |___/|_/__/\__|_| |_|_.__/\_,_|\__|_\___/_||_/__/
+\*/
+
+//
+// n boxes in [0,100]^3, min and max corners stored with leading dimension 3
+//
+class Boxes {
+public:
+  string            name;
+  vector<real_type> bb_min;
+  vector<real_type> bb_max;
+
+  integer size() const { return integer(bb_min.size()/dim); }
+
+  void
+  add( real_type const a[], real_type const b[] ) {
+    for ( integer j = 0; j < dim; ++j ) {
+      bb_min.emplace_back( std::min( a[j], b[j] ) );
+      bb_max.emplace_back( std::max( a[j], b[j] ) );
+    }
+  }
+};
+
+using Generator = std::function<void(integer,std::mt19937&,Boxes&)>;
+
+// cubes of random size, edge ~ mean distance of the centers
+static
+void
+uniform( integer n, std::mt19937 & gen, Boxes & B ) {
+  std::uniform_real_distribution<real_type> U(0,100);
+  real_type h = 100/std::cbrt(real_type(n));
+  std::uniform_real_distribution<real_type> S(0,h);
+  for ( integer i = 0; i < n; ++i ) {
+    real_type a[dim], b[dim];
+    real_type s = S(gen);
+    for ( integer j = 0; j < dim; ++j ) { a[j] = U(gen); b[j] = a[j] + s; }
+    B.add( a, b );
+  }
+}
+
+// small cubes around 32 centers (gaussian)
+static
+void
+clustered( integer n, std::mt19937 & gen, Boxes & B ) {
+  std::uniform_real_distribution<real_type> U(0,100);
+  std::normal_distribution<real_type>       G(0,3);
+  real_type c[32][dim];
+  for ( auto & cc : c ) for ( auto & x : cc ) x = U(gen);
+  real_type h = 25/std::cbrt(real_type(n));
+  std::uniform_real_distribution<real_type> S(0,h);
+  for ( integer i = 0; i < n; ++i ) {
+    real_type const * ck = c[gen()%32];
+    real_type a[dim], b[dim];
+    real_type s = S(gen);
+    for ( integer j = 0; j < dim; ++j ) { a[j] = ck[j] + G(gen); b[j] = a[j] + s; }
+    B.add( a, b );
+  }
+}
+
+// bbox of segments of random direction and length up to 20
+static
+void
+elongated( integer n, std::mt19937 & gen, Boxes & B ) {
+  std::uniform_real_distribution<real_type> U(0,100);
+  std::uniform_real_distribution<real_type> L(0,20);
+  std::normal_distribution<real_type>       G(0,1);
+  for ( integer i = 0; i < n; ++i ) {
+    real_type a[dim], b[dim], d[dim], nd = 0;
+    for ( integer j = 0; j < dim; ++j ) { d[j] = G(gen); nd += d[j]*d[j]; }
+    real_type len = L(gen)/std::max( std::sqrt(nd), real_type(1e-10) );
+    for ( integer j = 0; j < dim; ++j ) { a[j] = U(gen); b[j] = a[j] + len*d[j]; }
+    B.add( a, b );
+  }
+}
+
+// bbox of the triangles of a wavy surface z = f(x,y) on a m x m grid
+static
+void
+mesh( integer n, std::mt19937 & gen, Boxes & B ) {
+  std::uniform_real_distribution<real_type> J(-0.2,0.2);
+  integer   m = std::max( 1, integer( std::sqrt( real_type(n)/2 ) ) );
+  real_type h = 100/real_type(m);
+  auto vertex = [&]( integer i, integer j, real_type v[] ) {
+    v[0] = i*h;
+    v[1] = j*h;
+    v[2] = 50 + 10*std::sin(v[0]/10)*std::cos(v[1]/7);
+  };
+  for ( integer k = 0; B.size() < n; ++k ) {
+    integer i = (k/2)%m, j = (k/2/m)%m;
+    real_type v0[dim], v1[dim], v2[dim];
+    vertex( i, j, v0 );
+    vertex( i+1, j+1, v2 );
+    if ( (k%2) == 0 ) vertex( i+1, j, v1 );
+    else              vertex( i, j+1, v1 );
+    real_type a[dim], b[dim];
+    for ( integer d = 0; d < dim; ++d ) {
+      real_type dz = J(gen)*h; // avoid exact duplicates after the first sweep
+      a[d] = std::min( v0[d], std::min( v1[d], v2[d] ) ) + dz;
+      b[d] = std::max( v0[d], std::max( v1[d], v2[d] ) ) + dz;
+    }
+    B.add( a, b );
+  }
+}
+
+/*\
+ |   ___                 _
+ |  | _ ) ___ _ _  __| |_
+ |  | _ \/ -_) ' \/ _| ' \
+ |  |___/\___|_||_\__|_||_|
+\*/
+
+class Config {
+public:
+  string    dist;
+  integer   n;
+  string    builder;
+  integer   nobj;  // max_num_objects_per_node
+  real_type ratio; // bbox_long_edge_ratio
+};
+
+class Query {
+public:
+  double qs     = 0; // queries per second
+  double checks = 0; // bbox checks per query
+  double found  = 0; // candidates per query
+};
+
+class Result {
+public:
+  double  build_ms = 0;
+  double  mem_mb   = 0;
+  integer nodes    = 0;
+  double  sah      = 0;
+  Query   point, box, nearest;
+  double  tt_ms    = 0; // tree-tree
+  double  tt_check = 0;
+  double  tt_pairs = 0;
+};
+
+static
+void
+build( AABBtree & T, Config const & c, Boxes const & B ) {
+  T.set_max_num_objects_per_node( c.nobj );
+  T.set_bbox_long_edge_ratio( c.ratio );
+  if ( c.builder == "lbvh" ) {
+    T.build_lbvh( B.bb_min.data(), dim, B.bb_max.data(), dim, B.size(), dim );
+  } else {
+    T.set_split_strategy(
+      c.builder == "sah"    ? AABBtree::SplitStrategy::BINNED_SAH :
+      c.builder == "median" ? AABBtree::SplitStrategy::MEDIAN :
+                              AABBtree::SplitStrategy::HEURISTIC
+    );
+    T.build( B.bb_min.data(), dim, B.bb_max.data(), dim, B.size(), dim );
+  }
+}
+
+// run `nq` queries, `query(i)` returns the number of candidates
+static
+Query
+run_queries( AABBtree const & T, integer nq, std::function<integer(integer)> const & query ) {
+  Utils::TicToc tm;
+  double checks = 0, found = 0;
+  tm.tic();
+  for ( integer i = 0; i < nq; ++i ) {
+    found  += query( i );
+    checks += T.num_check();
+  }
+  tm.toc();
+  Query q;
+  q.qs     = 1000 * nq / std::max( tm.elapsed_ms(), 1e-9 );
+  q.checks = checks / nq;
+  q.found  = found / nq;
+  return q;
+}
+
+static
+Result
+run(
+  Config const & c,
+  Boxes  const & B,
+  Boxes  const & B2, // second set for the tree-tree query
+  integer        nq,
+  unsigned       reps
+) {
+  Result        r;
+  AABBtree      T;
+  Utils::TicToc tm;
+
+  // median build time
+  vector<double> t_build;
+  for ( unsigned k = 0; k < reps; ++k ) {
+    tm.tic();
+    build( T, c, B );
+    tm.toc();
+    t_build.emplace_back( tm.elapsed_ms() );
+  }
+  std::sort( t_build.begin(), t_build.end() );
+  r.build_ms = t_build[t_build.size()/2];
+  r.mem_mb   = double(T.memory_usage())/(1024*1024);
+  r.nodes    = T.num_tree_nodes();
+  r.sah      = double(T.sah_cost());
+
+  // queries: centers and enlarged boxes of random objects, random points
+  std::mt19937 gen( 1234 );
+  std::uniform_real_distribution<real_type> U(0,100);
+  vector<real_type> pnts( size_t(dim*nq) ), qmin( size_t(dim*nq) ), qmax( size_t(dim*nq) ), rnd( size_t(dim*nq) );
+  for ( integer i = 0; i < nq; ++i ) {
+    integer k = integer( gen() % unsigned(B.size()) );
+    for ( integer j = 0; j < dim; ++j ) {
+      real_type a = B.bb_min[dim*k+j];
+      real_type b = B.bb_max[dim*k+j];
+      pnts[dim*i+j] = (a+b)/2;
+      qmin[dim*i+j] = a - (b-a)/2;
+      qmax[dim*i+j] = b + (b-a)/2;
+      rnd[dim*i+j]  = U(gen);
+    }
+  }
+
+  AABBtree::AABB_SET S;
+  r.point = run_queries( T, nq, [&]( integer i ) {
+    T.intersect_with_one_point_and_refine( &pnts[dim*i], S );
+    return integer(S.size());
+  } );
+
+  vector<real_type> qb( 2*dim );
+  r.box = run_queries( T, nq, [&]( integer i ) {
+    std::copy_n( &qmin[dim*i], dim, qb.data() );
+    std::copy_n( &qmax[dim*i], dim, qb.data()+dim );
+    T.intersect_with_one_bbox_and_refine( qb.data(), S );
+    return integer(S.size());
+  } );
+
+  // distance from the point to the box of the object
+  real_type const * p = nullptr;
+  AABBtree::DISTANCE_FUN dist = [&]( integer id ) {
+    real_type d2 = 0;
+    for ( integer j = 0; j < dim; ++j ) {
+      real_type a = B.bb_min[dim*id+j] - p[j];
+      real_type b = p[j] - B.bb_max[dim*id+j];
+      real_type d = std::max( std::max( a, b ), real_type(0) );
+      d2 += d*d;
+    }
+    return std::sqrt(d2);
+  };
+  r.nearest = run_queries( T, nq, [&]( integer i ) {
+    real_type d_min;
+    p = &rnd[dim*i];
+    return T.closest_object( p, dist, d_min ) >= 0 ? 1 : 0;
+  } );
+
+  AABBtree T2;
+  build( T2, c, B2 );
+  AABBtree::AABB_PAIRS pairs;
+  tm.tic();
+  T.intersect_and_refine( T2, pairs );
+  tm.toc();
+  r.tt_ms    = tm.elapsed_ms();
+  r.tt_check = T.num_check();
+  r.tt_pairs = double(pairs.size());
+
+  return r;
+}
+
+/*\
+ |   ___       _             _
+ |  / _ \ _  _| |_ _ __ _  _| |_
+ | | (_) | || |  _| '_ \ || |  _|
+ |  \___/ \_,_|\__| .__/\_,_|\__|
+ |                |_|
+\*/
+
+enum class Format { TABLE, CSV, JSON };
+
+static
+void
+print_header( Format fmt ) {
+  if ( fmt == Format::CSV )
+    fmt::print(
+      "dist,n,builder,nobj,ratio,build_ms,mem_mb,nodes,sah,"
+      "point_qs,point_checks,box_qs,box_checks,nearest_qs,nearest_checks,"
+      "tt_ms,tt_checks,tt_pairs\n"
+    );
+  else if ( fmt == Format::TABLE )
+    fmt::print(
+      "{:<10} {:>8} {:<9} {:>4} {:>4} {:>9} {:>8} {:>8} {:>8} "
+      "{:>9} {:>6} {:>9} {:>6} {:>9} {:>6} {:>9} {:>9}\n",
+      "dist", "n", "builder", "nobj", "long", "build_ms", "mem_MB", "nodes", "SAH",
+      "point/s", "chk", "box/s", "chk", "near/s", "chk", "tt_ms", "tt_chk"
+    );
+}
+
+static
+void
+print_result( Format fmt, Config const & c, Result const & r ) {
+  switch ( fmt ) {
+  case Format::CSV:
+    fmt::print(
+      "{},{},{},{},{},{:.4f},{:.3f},{},{:.2f},{:.1f},{:.2f},{:.1f},{:.2f},{:.1f},{:.2f},{:.4f},{},{}\n",
+      c.dist, c.n, c.builder, c.nobj, c.ratio, r.build_ms, r.mem_mb, r.nodes, r.sah,
+      r.point.qs, r.point.checks, r.box.qs, r.box.checks, r.nearest.qs, r.nearest.checks,
+      r.tt_ms, r.tt_check, r.tt_pairs
+    );
+    break;
+  case Format::JSON:
+    fmt::print(
+      "{{\"dist\":\"{}\",\"n\":{},\"builder\":\"{}\",\"nobj\":{},\"ratio\":{},"
+      "\"build_ms\":{:.4f},\"mem_mb\":{:.3f},\"nodes\":{},\"sah\":{:.2f},"
+      "\"point\":{{\"qs\":{:.1f},\"checks\":{:.2f},\"found\":{:.2f}}},"
+      "\"box\":{{\"qs\":{:.1f},\"checks\":{:.2f},\"found\":{:.2f}}},"
+      "\"nearest\":{{\"qs\":{:.1f},\"checks\":{:.2f}}},"
+      "\"tree_tree\":{{\"ms\":{:.4f},\"checks\":{},\"pairs\":{}}}}}\n",
+      c.dist, c.n, c.builder, c.nobj, c.ratio,
+      r.build_ms, r.mem_mb, r.nodes, r.sah,
+      r.point.qs, r.point.checks, r.point.found,
+      r.box.qs, r.box.checks, r.box.found,
+      r.nearest.qs, r.nearest.checks,
+      r.tt_ms, r.tt_check, r.tt_pairs
+    );
+    break;
+  case Format::TABLE:
+    fmt::print(
+      "{:<10} {:>8} {:<9} {:>4} {:>4} {:>9.3f} {:>8.2f} {:>8} {:>8.0f} "
+      "{:>9.0f} {:>6.1f} {:>9.0f} {:>6.1f} {:>9.0f} {:>6.1f} {:>9.3f} {:>9}\n",
+      c.dist, c.n, c.builder, c.nobj, c.ratio, r.build_ms, r.mem_mb, r.nodes, r.sah,
+      r.point.qs, r.point.checks, r.box.qs, r.box.checks,
+      r.nearest.qs, r.nearest.checks, r.tt_ms, r.tt_check
+    );
+    break;
+  }
+}
+
+int
+main( int argc, char *argv[] ) {
+  bool     full   = false;
+  Format   format = Format::TABLE;
+  string   dist_filter, builder_filter;
+  integer  n_only = 0;
+  unsigned reps   = 3;
+
+  for ( int i = 1; i < argc; ++i ) {
+    if      ( std::strcmp( argv[i], "--full" ) == 0 ) full   = true;
+    else if ( std::strcmp( argv[i], "--csv"  ) == 0 ) format = Format::CSV;
+    else if ( std::strcmp( argv[i], "--json" ) == 0 ) format = Format::JSON;
+    else if ( std::strncmp( argv[i], "--dist=",    7  ) == 0 ) dist_filter    = argv[i]+7;
+    else if ( std::strncmp( argv[i], "--builder=", 10 ) == 0 ) builder_filter = argv[i]+10;
+    else if ( std::strncmp( argv[i], "--n=",       4  ) == 0 ) n_only = std::max( 1, atoi(argv[i]+4) );
+    else if ( std::strncmp( argv[i], "--reps=",    7  ) == 0 ) reps   = unsigned(std::max(1,atoi(argv[i]+7)));
+    else {
+      fmt::print( stderr,
+        "usage: {} [--full] [--csv|--json] [--dist=NAME] [--builder=NAME] [--n=N] [--reps=N]\n",
+        argv[0]
+      );
+      return 1;
+    }
+  }
+
+  vector<std::pair<string,Generator>> dists = {
+    { "uniform",   uniform   },
+    { "clustered", clustered },
+    { "elongated", elongated },
+    { "mesh",      mesh      }
+  };
+  vector<string> builders = { "heuristic", "median", "sah", "lbvh" };
+
+  vector<integer>   sizes, nobjs;
+  vector<real_type> ratios;
+  integer           nq;
+  if ( full ) {
+    sizes  = { 1000, 10000, 100000, 1000000, 10000000 };
+    nobjs  = { 2, 4, 8, 16, 32, 64 };
+    ratios = { 0.5, 0.7, 0.8, 0.9, 0.99 };
+    nq     = 100000;
+  } else {
+    sizes  = { 1000, 20000 };
+    nobjs  = { 4, 16 };
+    ratios = { 0.8 };
+    nq     = 2000;
+  }
+  if ( n_only > 0 ) sizes = { n_only };
+
+  print_header( format );
+
+  for ( auto const & d : dists ) {
+    if ( !dist_filter.empty() && d.first.find(dist_filter) == string::npos ) continue;
+    for ( integer n : sizes ) {
+      Boxes B, B2;
+      std::mt19937 gen( 42 );
+      d.second( n, gen, B );
+      d.second( n, gen, B2 );
+      for ( string const & b : builders ) {
+        if ( !builder_filter.empty() && b.find(builder_filter) == string::npos ) continue;
+        for ( integer nobj : nobjs ) {
+          for ( real_type ratio : ratios ) {
+            Config c;
+            c.dist    = d.first;
+            c.n       = n;
+            c.builder = b;
+            c.nobj    = nobj;
+            c.ratio   = ratio;
+            print_result( format, c, run( c, B, B2, std::min( nq, 10*n ), reps ) );
+          }
+        }
+      }
+    }
+  }
+
+  if ( format == Format::TABLE ) fmt::print( "\nAll done folks!\n\n" );
+
+  return 0;
+}
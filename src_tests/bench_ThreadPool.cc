@@ -0,0 +1,366 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2022                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+//
+// Benchmark of the thread pools.
+//
+// Sweep task granularity, number of producers, number of threads and
+// the shape of the workload (independent tasks or fork-join stages)
+// over every ThreadPoolBase implementation and quickpool.
+//
+// usage: bench_ThreadPool [--full] [--csv|--json] [--pool=NAME] [--reps=N]
+//
+//   --full      long sweep (grain up to 10ms, all producers/threads counts)
+//   --csv       comma separated output
+//   --json      one json object for each run
+//   --pool=NAME run only the pools whose name contains NAME
+//   --reps=N    repetitions of each run, the median is reported
+//
+
+#include "Utils.hh"
+#include "Utils/quickpool.hxx"
+
+#include <cstring>
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+using Utils::tp::now_ns;
+
+/*\
+ |    ___       _    _               _
+ |   / _ \ _  _(_)__| |___ _ __  ___| |
+ |  | (_) | || | / _| / / '_ \/ _ \/ _ \ |
+ |   \__\_\\_,_|_\__|_\_\ .__/\___/\___/_|
+ |                      |_|
+\*/
+
+//
+// quickpool seen as a ThreadPoolBase
+//
+class QuickPool : public Utils::ThreadPoolBase {
+  unique_ptr<quickpool::ThreadPool> m_pool;
+public:
+  explicit
+  QuickPool( unsigned nt )
+  : m_pool( new quickpool::ThreadPool( nt ) )
+  {}
+
+  void exec( std::function<void()> && fun ) override { m_pool->push( std::move(fun) ); }
+  void wait() override { m_pool->wait(); }
+  void join() override { m_pool->wait(); }
+
+  unsigned thread_count() const override { return unsigned(m_pool->get_active_threads()); }
+  void     resize( unsigned nt ) override { m_pool->set_active_threads( nt ); }
+
+  char const * name() const override { return "quickpool"; }
+};
+
+/*\
+ |   ___          _
+ |  | _ ) ___ _ _ | |_
+ |  | _ \/ -_) ' \| ' \
+ |  |___/\___|_||_|_||_|
+\*/
+
+using Factory = std::function<Utils::ThreadPoolBase*(unsigned)>;
+
+class Backend {
+public:
+  string  name;
+  Factory make;
+  bool    multi_producer; // exec() can be called concurrently
+};
+
+template <typename TP>
+static
+Backend
+backend( char const * name, bool multi_producer ) {
+  Backend b;
+  b.name           = name;
+  b.make           = []( unsigned nt ) -> Utils::ThreadPoolBase * { return new TP(nt); };
+  b.multi_producer = multi_producer;
+  return b;
+}
+
+enum class Shape { INDEPENDENT, FORK_JOIN };
+
+static char const * shape_name( Shape s )
+{ return s == Shape::INDEPENDENT ? "independent" : "fork-join"; }
+
+class Config {
+public:
+  unsigned n_thread;
+  unsigned n_producer;
+  uint64_t grain_ns;
+  unsigned n_task;
+  Shape    shape;
+  unsigned fan_out; // tasks for each stage of fork-join
+};
+
+class Result {
+public:
+  double wall_ms    = 0;
+  double tasks_s    = 0; // throughput
+  double efficiency = 0; // useful work / ( wall * threads )
+  double lat_p50_us = 0; // enqueue to start latency
+  double lat_p90_us = 0;
+  double lat_p99_us = 0;
+  double lat_max_us = 0;
+};
+
+static
+void
+spin_for( uint64_t ns ) {
+  uint64_t t0 = now_ns();
+  while ( now_ns() - t0 < ns ) {}
+}
+
+static
+double
+percentile( vector<uint64_t> const & sorted, double p ) {
+  if ( sorted.empty() ) return 0;
+  std::size_t i = std::size_t( p/100 * double(sorted.size()-1) + 0.5 );
+  return double(sorted[std::min(i,sorted.size()-1)]);
+}
+
+//
+// submit tasks [i0,i1), each task record its enqueue to start latency
+//
+static
+void
+submit(
+  Utils::ThreadPoolBase & pool,
+  vector<uint64_t>      & lat,
+  unsigned                i0,
+  unsigned                i1,
+  uint64_t                grain_ns
+) {
+  for ( unsigned i = i0; i < i1; ++i ) {
+    uint64_t   t0  = now_ns();
+    uint64_t * pl  = &lat[i];
+    pool.exec( [t0,pl,grain_ns]() {
+      uint64_t t1 = now_ns();
+      *pl = t1 > t0 ? t1 - t0 : 0;
+      spin_for( grain_ns );
+    } );
+  }
+}
+
+static
+Result
+run_once( Utils::ThreadPoolBase & pool, Config const & c ) {
+  vector<uint64_t> lat( c.n_task, 0 );
+  Utils::TicToc tm;
+  tm.tic();
+  if ( c.shape == Shape::FORK_JOIN ) {
+    // fan-out a stage, fan-in with wait(), next stage
+    for ( unsigned i0 = 0; i0 < c.n_task; i0 += c.fan_out ) {
+      submit( pool, lat, i0, std::min( i0+c.fan_out, c.n_task ), c.grain_ns );
+      pool.wait();
+    }
+  } else if ( c.n_producer <= 1 ) {
+    submit( pool, lat, 0, c.n_task, c.grain_ns );
+    pool.wait();
+  } else {
+    vector<std::thread> producers;
+    unsigned chunk = (c.n_task + c.n_producer - 1) / c.n_producer;
+    for ( unsigned p = 0; p < c.n_producer; ++p ) {
+      unsigned i0 = std::min( p*chunk, c.n_task );
+      unsigned i1 = std::min( i0+chunk, c.n_task );
+      producers.emplace_back( submit, std::ref(pool), std::ref(lat), i0, i1, c.grain_ns );
+    }
+    for ( std::thread & t : producers ) t.join();
+    pool.wait();
+  }
+  tm.toc();
+
+  Result r;
+  std::sort( lat.begin(), lat.end() );
+  r.wall_ms    = tm.elapsed_ms();
+  r.tasks_s    = 1000 * c.n_task / std::max( r.wall_ms, 1e-9 );
+  r.efficiency = 1e-6 * double(c.grain_ns) * c.n_task / ( std::max( r.wall_ms, 1e-9 ) * c.n_thread );
+  r.lat_p50_us = 1e-3 * percentile( lat, 50 );
+  r.lat_p90_us = 1e-3 * percentile( lat, 90 );
+  r.lat_p99_us = 1e-3 * percentile( lat, 99 );
+  r.lat_max_us = 1e-3 * double( lat.back() );
+  return r;
+}
+
+// median of the repetitions (by wall time)
+static
+Result
+run( Utils::ThreadPoolBase & pool, Config const & c, unsigned reps ) {
+  vector<Result> res;
+  for ( unsigned k = 0; k < reps; ++k ) res.emplace_back( run_once( pool, c ) );
+  std::sort(
+    res.begin(), res.end(),
+    []( Result const & a, Result const & b ) { return a.wall_ms < b.wall_ms; }
+  );
+  return res[res.size()/2];
+}
+
+/*\
+ |   ___      _             _
+ |  / _ \ _  _| |_ _ __ _  _| |_
+ | | (_) | || |  _| '_ \ || |  _|
+ |  \___/ \_,_|\__| .__/\_,_|\__|
+ |                |_|
+\*/
+
+enum class Format { TABLE, CSV, JSON };
+
+static
+void
+print_header( Format fmt ) {
+  if ( fmt == Format::CSV )
+    fmt::print(
+      "pool,shape,threads,producers,grain_ns,tasks,wall_ms,tasks_s,"
+      "efficiency,lat_p50_us,lat_p90_us,lat_p99_us,lat_max_us\n"
+    );
+  else if ( fmt == Format::TABLE )
+    fmt::print(
+      "{:<22} {:<11} {:>3} {:>3} {:>9} {:>6} {:>10} {:>11} {:>6} {:>10} {:>10} {:>10}\n",
+      "pool", "shape", "nt", "np", "grain_ns", "tasks", "wall_ms",
+      "tasks/s", "eff", "p50_us", "p90_us", "p99_us"
+    );
+}
+
+static
+void
+print_result( Format fmt, string const & name, Config const & c, Result const & r ) {
+  switch ( fmt ) {
+  case Format::CSV:
+    fmt::print(
+      "{},{},{},{},{},{},{:.4f},{:.1f},{:.4f},{:.3f},{:.3f},{:.3f},{:.3f}\n",
+      name, shape_name(c.shape), c.n_thread, c.n_producer, c.grain_ns, c.n_task,
+      r.wall_ms, r.tasks_s, r.efficiency,
+      r.lat_p50_us, r.lat_p90_us, r.lat_p99_us, r.lat_max_us
+    );
+    break;
+  case Format::JSON:
+    fmt::print(
+      "{{\"pool\":\"{}\",\"shape\":\"{}\",\"threads\":{},\"producers\":{},"
+      "\"grain_ns\":{},\"tasks\":{},\"wall_ms\":{:.4f},\"tasks_s\":{:.1f},"
+      "\"efficiency\":{:.4f},\"latency_us\":{{\"p50\":{:.3f},\"p90\":{:.3f},"
+      "\"p99\":{:.3f},\"max\":{:.3f}}}}}\n",
+      name, shape_name(c.shape), c.n_thread, c.n_producer, c.grain_ns, c.n_task,
+      r.wall_ms, r.tasks_s, r.efficiency,
+      r.lat_p50_us, r.lat_p90_us, r.lat_p99_us, r.lat_max_us
+    );
+    break;
+  case Format::TABLE:
+    fmt::print(
+      "{:<22} {:<11} {:>3} {:>3} {:>9} {:>6} {:>10.3f} {:>11.0f} {:>6.3f} {:>10.3f} {:>10.3f} {:>10.3f}\n",
+      name, shape_name(c.shape), c.n_thread, c.n_producer, c.grain_ns, c.n_task,
+      r.wall_ms, r.tasks_s, r.efficiency,
+      r.lat_p50_us, r.lat_p90_us, r.lat_p99_us
+    );
+    break;
+  }
+}
+
+// 1, 2, 4, ... up to n (n included)
+static
+vector<unsigned>
+powers_of_two( unsigned n ) {
+  vector<unsigned> res;
+  for ( unsigned k = 1; k < n; k *= 2 ) res.emplace_back(k);
+  res.emplace_back(n);
+  return res;
+}
+
+int
+main( int argc, char *argv[] ) {
+  bool     full   = false;
+  Format   format = Format::TABLE;
+  string   filter;
+  unsigned reps   = 3;
+
+  for ( int i = 1; i < argc; ++i ) {
+    if      ( std::strcmp( argv[i], "--full" ) == 0 ) full   = true;
+    else if ( std::strcmp( argv[i], "--csv"  ) == 0 ) format = Format::CSV;
+    else if ( std::strcmp( argv[i], "--json" ) == 0 ) format = Format::JSON;
+    else if ( std::strncmp( argv[i], "--pool=", 7 ) == 0 ) filter = argv[i]+7;
+    else if ( std::strncmp( argv[i], "--reps=", 7 ) == 0 ) reps = unsigned(std::max(1,atoi(argv[i]+7)));
+    else {
+      fmt::print( stderr,
+        "usage: {} [--full] [--csv|--json] [--pool=NAME] [--reps=N]\n", argv[0]
+      );
+      return 1;
+    }
+  }
+
+  unsigned hw = std::max( 2u, std::thread::hardware_concurrency() );
+
+  vector<Backend> backends;
+  backends.emplace_back( backend<Utils::ThreadPool0>( "ThreadPool0", true  ) );
+  backends.emplace_back( backend<Utils::ThreadPool1>( "ThreadPool1", false ) );
+  backends.emplace_back( backend<Utils::ThreadPool2>( "ThreadPool2", true  ) );
+  backends.emplace_back( backend<Utils::ThreadPool3>( "ThreadPool3", true  ) );
+  backends.emplace_back( backend<Utils::ThreadPool4>( "ThreadPool4", true  ) );
+  backends.emplace_back( backend<Utils::ThreadPool5>( "ThreadPool5", true  ) );
+  backends.emplace_back( backend<Utils::ThreadPool6>( "ThreadPool6", true  ) );
+  backends.emplace_back( backend<QuickPool>( "quickpool", true ) );
+
+  vector<uint64_t> grains;
+  vector<unsigned> threads, producers;
+  uint64_t         budget_ns; // serial work of each run
+  if ( full ) {
+    grains    = { 100, 1000, 10000, 100000, 1000000, 10000000 };
+    threads   = powers_of_two( hw );
+    producers = powers_of_two( hw );
+    budget_ns = 400000000;
+  } else {
+    grains    = { 100, 10000, 1000000 };
+    threads   = { std::min( 4u, hw ) };
+    producers = { 1, 2 };
+    budget_ns = 20000000;
+  }
+
+  print_header( format );
+
+  for ( Backend const & b : backends ) {
+    if ( !filter.empty() && b.name.find(filter) == string::npos ) continue;
+    for ( unsigned nt : threads ) {
+      unique_ptr<Utils::ThreadPoolBase> pool( b.make( nt ) );
+      for ( uint64_t g : grains ) {
+        Config c;
+        c.n_thread = nt;
+        c.grain_ns = g;
+        c.n_task   = unsigned( std::min( uint64_t(100000), std::max( uint64_t(8*nt), budget_ns/g ) ) );
+        c.fan_out  = 4*nt;
+        c.shape    = Shape::INDEPENDENT;
+        for ( unsigned np : producers ) {
+          if ( np > 1 && !b.multi_producer ) continue; // exec() is not thread safe
+          c.n_producer = np;
+          print_result( format, b.name, c, run( *pool, c, reps ) );
+        }
+        c.shape      = Shape::FORK_JOIN;
+        c.n_producer = 1;
+        print_result( format, b.name, c, run( *pool, c, reps ) );
+      }
+      pool->join();
+    }
+  }
+
+  if ( format == Format::TABLE ) fmt::print( "\nAll done folks!\n\n" );
+
+  return 0;
+}
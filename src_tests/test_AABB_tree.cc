@@ -20,6 +20,12 @@
 #include "Utils_AABB_tree.hh"
 #include "Utils_GG2D.hh"
 #include <random>
+#include <fstream>
+#include <cstdlib>
+#include <cstdio>
+#ifndef UTILS_OS_WINDOWS
+  #include <unistd.h>
+#endif
 
 using namespace std;
 using integer   = int;
@@ -41,8 +47,40 @@ rand( real_type xmin, real_type xmax ) {
   return xmin + (xmax-xmin)*random;
 }
 
+//
+// scratch file with a name unique to this run, in the temporary directory
+// (not in the working directory shared with the other tests), removed when
+// the object goes out of scope also if a check fails
+//
+class ScratchFile {
+  std::string m_name;
+public:
+  ScratchFile( ScratchFile const & ) = delete;
+  ScratchFile & operator = ( ScratchFile const & ) = delete;
+
+  explicit
+  ScratchFile( char const tag[] ) {
+    #ifdef UTILS_OS_WINDOWS
+    char const * dir = std::getenv( "TEMP" );
+    m_name = fmt::format( "{}\\AABB_tree_{}_{}.bin", dir ? dir : ".", tag, std::rand() );
+    #else
+    char const * dir = std::getenv( "TMPDIR" );
+    std::string tmpl = fmt::format( "{}/AABB_tree_{}_XXXXXX", dir ? dir : "/tmp", tag );
+    int fd = mkstemp( &tmpl.front() );
+    UTILS_ASSERT( fd >= 0, "ScratchFile, cannot create `{}`\n", tmpl );
+    close( fd );
+    m_name = tmpl;
+    #endif
+  }
+
+  ~ScratchFile() { std::remove( m_name.c_str() ); }
+
+  std::string const & name() const { return m_name; }
+};
+
+static
 int
-main() {
+run() {
 
   TicToc tm;
 
@@ -140,6 +178,31 @@ main() {
 
   fmt::print("T1 T2 build elapsed {} ms\n", tm.elapsed_ms() );
 
+  // parallel build must give the same tree
+  {
+    Utils::ThreadPool3 pool(4);
+    Utils::AABBtree<real_type> TP;
+    TP.set_max_num_objects_per_node( 16 );
+    tm.tic();
+    TP.build( bb_min1, dim, bb_max1, dim, NS, dim, &pool );
+    tm.toc();
+    fmt::print("T1 parallel build elapsed {} ms\n", tm.elapsed_ms() );
+    pool.join();
+
+    integer nn = T1.num_tree_nodes();
+    UTILS_ASSERT0( nn == TP.num_tree_nodes(), "parallel build, different number of nodes\n" );
+    std::vector<real_type> a_min(nn*dim), a_max(nn*dim), b_min(nn*dim), b_max(nn*dim);
+    T1.get_bboxes_of_the_tree( a_min.data(), dim, a_max.data(), dim, 0 );
+    TP.get_bboxes_of_the_tree( b_min.data(), dim, b_max.data(), dim, 0 );
+    UTILS_ASSERT0( a_min == b_min && a_max == b_max, "parallel build, different bboxes\n" );
+    for ( integer i = 0; i < nn; ++i ) {
+      std::set<integer> sa, sb;
+      T1.get_bbox_indexes_of_a_node( i, sa );
+      TP.get_bbox_indexes_of_a_node( i, sb );
+      UTILS_ASSERT( sa == sb, "parallel build, node {} differs\n", i );
+    }
+  }
+
   /*
   for ( integer i_pos = 0; i_pos < T1.num_tree_nodes(); ++i_pos ) {
     std::set<integer> bb_index;
@@ -150,6 +213,159 @@ main() {
   }
   */
 
+  // split strategies: same refined results, different quality
+  {
+    using Split = Utils::AABBtree<real_type>::SplitStrategy;
+    std::vector<real_type> pnts(2*1000);
+    for ( auto & p : pnts ) p = rand(0,10);
+    for ( Split st : { Split::HEURISTIC, Split::MEDIAN, Split::BINNED_SAH } ) {
+      Utils::AABBtree<real_type> TS;
+      TS.set_max_num_objects_per_node( 16 );
+      TS.set_split_strategy( st );
+      tm.tic();
+      TS.build( bb_min1, dim, bb_max1, dim, NS, dim );
+      tm.toc();
+      integer n_check = 0;
+      for ( integer i = 0; i < 1000; ++i ) {
+        std::set<integer> a, b;
+        T1.intersect_with_one_point_and_refine( &pnts[2*i], a );
+        TS.intersect_with_one_point_and_refine( &pnts[2*i], b );
+        n_check += TS.num_check();
+        UTILS_ASSERT( a == b, "split {}, query {} differs\n", TS.split_strategy_name(), i );
+      }
+      fmt::print(
+        "split {:<10} build {:.4} ms, nodes {}, SAH cost {:.4}, checks per query {}\n",
+        TS.split_strategy_name(), tm.elapsed_ms(), TS.num_tree_nodes(),
+        TS.sah_cost(), n_check/1000.0
+      );
+    }
+  }
+
+  // linear BVH: same refined results, serial and parallel give the same tree
+  {
+    Utils::AABBtree<real_type> TL, TLP;
+    TL.set_max_num_objects_per_node( 16 );
+    TLP.set_max_num_objects_per_node( 16 );
+    tm.tic();
+    TL.build_lbvh( bb_min1, dim, bb_max1, dim, NS, dim );
+    tm.toc();
+    fmt::print(
+      "LBVH build {:.4} ms, nodes {}, SAH cost {:.4} (build {:.4})\n",
+      tm.elapsed_ms(), TL.num_tree_nodes(), TL.sah_cost(), T1.sah_cost()
+    );
+    Utils::ThreadPool3 pool(4);
+    TLP.build_lbvh( bb_min1, dim, bb_max1, dim, NS, dim, &pool );
+    pool.join();
+
+    integer nn = TL.num_tree_nodes();
+    UTILS_ASSERT0( nn == TLP.num_tree_nodes(), "parallel LBVH, different number of nodes\n" );
+    for ( integer i = 0; i < nn; ++i ) {
+      std::set<integer> sa, sb;
+      TL.get_bbox_indexes_of_a_node( i, sa );
+      TLP.get_bbox_indexes_of_a_node( i, sb );
+      UTILS_ASSERT( sa == sb, "parallel LBVH, node {} differs\n", i );
+    }
+
+    std::vector<real_type> pnts(2*1000);
+    for ( auto & p : pnts ) p = rand(0,10);
+    for ( integer i = 0; i < 1000; ++i ) {
+      std::set<integer> a, b;
+      T1.intersect_with_one_point_and_refine( &pnts[2*i], a );
+      TL.intersect_with_one_point_and_refine( &pnts[2*i], b );
+      UTILS_ASSERT( a == b, "LBVH query {} differs\n", i );
+    }
+
+    // large set of random boxes
+    integer const NL = 200000;
+    std::vector<real_type> lmin(2*NL), lmax(2*NL);
+    for ( integer i = 0; i < NL; ++i ) {
+      lmin[2*i+0] = rand(0,100); lmax[2*i+0] = lmin[2*i+0] + rand(0,0.5);
+      lmin[2*i+1] = rand(0,100); lmax[2*i+1] = lmin[2*i+1] + rand(0,0.5);
+    }
+    tm.tic();
+    TL.build( lmin.data(), dim, lmax.data(), dim, NL, dim );
+    tm.toc();
+    fmt::print( "{} boxes: build {:.4} ms, SAH cost {:.4}\n", NL, tm.elapsed_ms(), TL.sah_cost() );
+    tm.tic();
+    TL.build_lbvh( lmin.data(), dim, lmax.data(), dim, NL, dim );
+    tm.toc();
+    fmt::print( "{} boxes: LBVH  {:.4} ms, SAH cost {:.4}\n", NL, tm.elapsed_ms(), TL.sah_cost() );
+  }
+
+  // dimension fixed at compile time: same results as the run time version
+  {
+    Utils::AABBtree<real_type,2> F1, F2;
+    F1.set_max_num_objects_per_node( 16 );
+    F2.set_max_num_objects_per_node( 16 );
+    F1.build( bb_min1, dim, bb_max1, dim, NS, dim );
+    F2.build( bb_min2, dim, bb_max2, dim, NS, dim );
+
+    std::vector<real_type> pnts(2*20000);
+    for ( auto & p : pnts ) p = rand(0,10);
+    std::vector<std::set<integer>> a(20000), b(20000);
+    tm.tic();
+    for ( integer i = 0; i < 20000; ++i ) T1.intersect_with_one_point_and_refine( &pnts[2*i], a[i] );
+    tm.toc();
+    real_type t_run = tm.elapsed_ms();
+    tm.tic();
+    for ( integer i = 0; i < 20000; ++i ) F1.intersect_with_one_point_and_refine( &pnts[2*i], b[i] );
+    tm.toc();
+    UTILS_ASSERT0( a == b, "AABBtree<Real,2> point queries differ\n" );
+    fmt::print( "20000 point queries, dim at run time {} ms, fixed dim {} ms\n", t_run, tm.elapsed_ms() );
+
+    Utils::AABBtree<real_type>::AABB_PAIRS   p1;
+    Utils::AABBtree<real_type,2>::AABB_PAIRS p2;
+    tm.tic();
+    T1.intersect_and_refine( T2, p1 );
+    tm.toc();
+    t_run = tm.elapsed_ms();
+    tm.tic();
+    F1.intersect_and_refine( F2, p2 );
+    tm.toc();
+    std::sort( p1.begin(), p1.end() );
+    std::sort( p2.begin(), p2.end() );
+    UTILS_ASSERT0( p1 == p2, "AABBtree<Real,2> tree vs tree differs\n" );
+    fmt::print( "tree vs tree, dim at run time {} ms, fixed dim {} ms\n", t_run, tm.elapsed_ms() );
+
+    // fixed size bboxes of a mapped, loaded and copied tree
+    ScratchFile f1( "F1" );
+    F1.save( f1.name() );
+    Utils::AABBtree<real_type,2> FM, FL, FC( F1 );
+    FM.map_file( f1.name() );
+    FL.load( f1.name() );
+    for ( integer i = 0; i < 20000; ++i ) {
+      std::set<integer> sm, sl, sc;
+      FM.intersect_with_one_point_and_refine( &pnts[2*i], sm );
+      FL.intersect_with_one_point_and_refine( &pnts[2*i], sl );
+      FC.intersect_with_one_point_and_refine( &pnts[2*i], sc );
+      UTILS_ASSERT(
+        sm == b[i] && sl == b[i] && sc == b[i],
+        "AABBtree<Real,2> mapped/loaded/copied tree, point query {} differs\n", i
+      );
+    }
+  }
+
+  // run time dimensions with an unrolled (7) and the generic (10) overlap test
+  for ( integer d : { 7, 10 } ) {
+    integer const nb = 500;
+    std::vector<real_type> bmin(nb*d), bmax(nb*d);
+    for ( integer i = 0; i < nb*d; ++i ) { bmin[i] = rand(0,10); bmax[i] = bmin[i]+rand(0,5); }
+    AABBtree<real_type> TD;
+    TD.build( bmin.data(), d, bmax.data(), d, nb, d );
+    for ( integer k = 0; k < 200; ++k ) {
+      std::vector<real_type> q(2*d);
+      for ( integer j = 0; j < d; ++j ) { q[j] = rand(0,10); q[d+j] = q[j]+rand(0,3); }
+      std::set<integer> got, ref;
+      TD.intersect_with_one_bbox_and_refine( q.data(), got );
+      for ( integer i = 0; i < nb; ++i ) {
+        bool ok = true;
+        for ( integer j = 0; j < d && ok; ++j ) ok = bmin[i*d+j] <= q[d+j] && bmax[i*d+j] >= q[j];
+        if ( ok ) ref.insert(i);
+      }
+      UTILS_ASSERT( got == ref, "dim {}, bbox query {} differs\n", d, k );
+    }
+  }
+
   std::set<integer> bb_index;
   real_type const pnt[2] = { 4, 4 };
   tm.tic();
@@ -180,6 +396,713 @@ main() {
   tm.toc();
   fmt::print("intersect_with_refine T1 vs T2 elapsed {} ms\nsize = {}\n", tm.elapsed_ms(), bbb_index.size() );
 
+  // visitor and flat vector queries
+  {
+    std::vector<integer> flat;
+    integer const NP = 1000;
+    for ( integer i = 0; i < NP; ++i ) {
+      real_type p[2]  = { rand(0,10), rand(0,10) };
+      real_type bb[4] = { p[0], p[1], p[0]+rand(0,0.5), p[1]+rand(0,0.5) };
+      for ( int refine = 0; refine < 2; ++refine ) {
+        std::set<integer> S, V, B, VB;
+        if ( refine ) {
+          T1.intersect_with_one_point_and_refine( p, S );
+          T1.intersect_with_one_point_and_refine( p, [&V]( integer id ) { V.insert(id); } );
+          T1.intersect_with_one_point_and_refine( p, flat );
+          T1.intersect_with_one_bbox_and_refine( bb, B );
+          T1.intersect_with_one_bbox_and_refine( bb, [&VB]( integer id ) { VB.insert(id); } );
+        } else {
+          T1.intersect_with_one_point( p, S );
+          T1.intersect_with_one_point( p, [&V]( integer id ) { V.insert(id); } );
+          T1.intersect_with_one_point( p, flat );
+          T1.intersect_with_one_bbox( bb, B );
+          T1.intersect_with_one_bbox( bb, [&VB]( integer id ) { VB.insert(id); } );
+        }
+        UTILS_ASSERT( S == V,  "visitor point query {} differs\n", i );
+        UTILS_ASSERT( B == VB, "visitor bbox query {} differs\n", i );
+        UTILS_ASSERT( S == std::set<integer>( flat.begin(), flat.end() ), "flat point query {} differs\n", i );
+
+        // early exit after the first object
+        integer n_visit = 0;
+        bool done = T1.intersect_with_one_bbox( bb, [&n_visit]( integer ) { ++n_visit; return false; } );
+        UTILS_ASSERT( n_visit == (B.empty() ? 0 : 1) && done == B.empty(), "visitor early exit {}\n", i );
+      }
+    }
+
+    // tree vs tree
+    for ( int refine = 0; refine < 2; ++refine ) {
+      std::map<integer,std::set<integer>> M;
+      std::vector<std::pair<integer,integer>> pairs;
+      if ( refine ) {
+        T1.intersect_and_refine( T2, M );
+        tm.tic();
+        T1.intersect_and_refine( T2, pairs );
+        tm.toc();
+      } else {
+        T1.intersect( T2, M );
+        tm.tic();
+        T1.intersect( T2, pairs );
+        tm.toc();
+      }
+      std::map<integer,std::set<integer>> P;
+      for ( auto const & ij : pairs ) P[ij.first].insert( ij.second );
+      for ( auto it = M.begin(); it != M.end(); )
+        if ( it->second.empty() ) it = M.erase(it); else ++it;
+      UTILS_ASSERT( M == P, "flat tree-tree query (refine={}) differs\n", refine );
+      fmt::print( "flat T1 vs T2 (refine={}) elapsed {} ms, {} pairs\n", refine, tm.elapsed_ms(), pairs.size() );
+    }
+  }
+
+  // parallel tree-tree pairs
+  {
+    Utils::ThreadPool3 pool(4);
+    for ( int refine = 0; refine < 2; ++refine ) {
+      std::vector<std::pair<integer,integer>> serial, parallel, ref;
+      tm.tic();
+      T1.intersect_pairs( T2, serial, refine != 0 );
+      tm.toc();
+      real_type t_serial = tm.elapsed_ms();
+      tm.tic();
+      T1.intersect_pairs( T2, parallel, refine != 0, &pool );
+      tm.toc();
+      fmt::print(
+        "intersect_pairs (refine={}) {} pairs, serial {} ms, parallel {} ms\n",
+        refine, serial.size(), t_serial, tm.elapsed_ms()
+      );
+      UTILS_ASSERT( serial == parallel, "intersect_pairs (refine={}), serial != parallel\n", refine );
+
+      // reference from the map query
+      std::map<integer,std::set<integer>> M;
+      if ( refine ) {
+        T1.intersect_and_refine( T2, M );
+        for ( auto const & m : M )
+          for ( auto j : m.second ) ref.emplace_back( m.first, j );
+      } else {
+        T1.intersect( T2, M );
+        std::set<integer> objs;
+        for ( auto const & m : M ) {
+          T1.get_bbox_indexes_of_a_node( m.first, objs );
+          for ( auto i : objs ) for ( auto j : m.second ) ref.emplace_back( i, j );
+          objs.clear();
+        }
+        std::sort( ref.begin(), ref.end() );
+        ref.erase( std::unique( ref.begin(), ref.end() ), ref.end() );
+      }
+      UTILS_ASSERT( serial == ref, "intersect_pairs (refine={}) differs from intersect\n", refine );
+    }
+    pool.join();
+  }
+
+  // self intersection
+  {
+    Utils::ThreadPool3 pool(4);
+    for ( int refine = 0; refine < 2; ++refine ) {
+      AABBtree<real_type>::AABB_PAIRS serial, parallel, ref;
+      tm.tic();
+      T1.self_intersect_pairs( serial, refine != 0 );
+      tm.toc();
+      real_type t_self = tm.elapsed_ms();
+      T1.self_intersect_pairs( parallel, refine != 0, &pool );
+      UTILS_ASSERT( serial == parallel, "self_intersect_pairs (refine={}), serial != parallel\n", refine );
+
+      tm.tic();
+      T1.intersect_pairs( T1, ref, refine != 0 );
+      tm.toc();
+      fmt::print(
+        "self_intersect_pairs (refine={}) {} pairs {} ms, T1 vs T1 {} ms\n",
+        refine, serial.size(), t_self, tm.elapsed_ms()
+      );
+      // T1 vs T1 without the pairs (i,i) and with i < j
+      ref.erase(
+        std::remove_if( ref.begin(), ref.end(), []( std::pair<integer,integer> const & p ) { return p.first >= p.second; } ),
+        ref.end()
+      );
+      UTILS_ASSERT( serial == ref, "self_intersect_pairs (refine={}) differs from T1 vs T1\n", refine );
+    }
+
+    // brute force
+    AABBtree<real_type>::AABB_PAIRS pairs, ref;
+    T1.self_intersect_pairs( pairs );
+    for ( integer i = 0; i < NS; ++i )
+      for ( integer j = i+1; j < NS; ++j )
+        if ( bb_min1[2*i]   <= bb_max1[2*j]   && bb_min1[2*j]   <= bb_max1[2*i] &&
+             bb_min1[2*i+1] <= bb_max1[2*j+1] && bb_min1[2*j+1] <= bb_max1[2*i+1] )
+          ref.emplace_back( i, j );
+    UTILS_ASSERT0( pairs == ref, "self_intersect_pairs differs from brute force\n" );
+    pool.join();
+  }
+
+  // save, load and map a built tree
+  {
+    ScratchFile t1( "T1" );
+    T1.save( t1.name() );
+
+    AABBtree<real_type> TL, TM;
+    tm.tic();
+    TL.load( t1.name() );
+    tm.toc();
+    real_type t_load = tm.elapsed_ms();
+    tm.tic();
+    TM.map_file( t1.name() );
+    tm.toc();
+    fmt::print( "load {} ms, map {} ms\n", t_load, tm.elapsed_ms() );
+
+    UTILS_ASSERT0(
+      TL.num_tree_nodes() == T1.num_tree_nodes() && TM.num_tree_nodes() == T1.num_tree_nodes() &&
+      TL.sah_cost() == T1.sah_cost() && TM.sah_cost() == T1.sah_cost(),
+      "loaded tree differs\n"
+    );
+    for ( integer i = 0; i < 500; ++i ) {
+      real_type p[2]  = { rand(0,10), rand(0,10) };
+      real_type bb[4] = { p[0], p[1], p[0]+rand(0,0.5), p[1]+rand(0,0.5) };
+      std::set<integer> A, B, C;
+      T1.intersect_with_one_bbox_and_refine( bb, A );
+      TL.intersect_with_one_bbox_and_refine( bb, B );
+      TM.intersect_with_one_bbox_and_refine( bb, C );
+      UTILS_ASSERT( A == B && A == C, "loaded tree, query {} differs\n", i );
+    }
+    AABBtree<real_type>::AABB_PAIRS P1, PM;
+    T1.intersect_pairs( T2, P1 );
+    TM.intersect_pairs( T2, PM );
+    UTILS_ASSERT0( P1 == PM, "mapped tree, tree-tree query differs\n" );
+
+    // a copy of a mapped tree is in memory
+    AABBtree<real_type> TC( TM );
+    UTILS_ASSERT0( TM.is_mapped() && !TC.is_mapped() && TC.sah_cost() == T1.sah_cost(), "copy of a mapped tree\n" );
+
+    // mapped trees are read only
+    bool read_only = false;
+    try { TM.build(); } catch ( std::exception const & ) { read_only = true; }
+    UTILS_ASSERT0( read_only, "mapped tree can be rebuilt\n" );
+
+    // a new allocation release the mapping
+    TM.build( bb_min2, dim, bb_max2, dim, NS, dim );
+    UTILS_ASSERT0( !TM.is_mapped() && TM.num_tree_nodes() == T2.num_tree_nodes(), "rebuild after map\n" );
+
+    // bad files
+    bool bad = false;
+    try { AABBtree<float> TF; TF.map_file( t1.name() ); } catch ( std::exception const & ) { bad = true; }
+    UTILS_ASSERT0( bad, "tree of float loaded from a file of double\n" );
+  }
+
+  // out of core build: chunks of boxes merged in a mapped file
+  {
+    integer next = 0;
+    AABBtree<real_type>::BOX_READER read = [&]( real_type mi[], real_type ma[], integer nmax ) {
+      integer n = std::min( { nmax, NS-next, integer(337) } ); // partial reads
+      std::copy_n( bb_min1+next*dim, n*dim, mi );
+      std::copy_n( bb_max1+next*dim, n*dim, ma );
+      next += n;
+      return n;
+    };
+    ScratchFile ooc( "ooc" ), ooc2( "ooc2" ), boxes( "boxes" );
+    AABBtree<real_type> TO, TF;
+    TO.set_max_num_objects_per_node( 16 );
+    tm.tic();
+    TO.build_out_of_core( read, dim, ooc.name(), 1000 );
+    tm.toc();
+    fmt::print(
+      "out of core build {:.4} ms, nodes {}, SAH cost {:.4} (build {:.4})\n",
+      tm.elapsed_ms(), TO.num_tree_nodes(), TO.sah_cost(), T1.sah_cost()
+    );
+    UTILS_ASSERT0( TO.is_mapped() && TO.num_objects() == NS, "out of core tree\n" );
+
+    // same boxes from a binary file, parallel build of the chunks
+    {
+      std::vector<real_type> bb(2*dim*NS);
+      for ( integer i = 0; i < NS; ++i ) {
+        std::copy_n( bb_min1+i*dim, dim, &bb[2*i*dim] );
+        std::copy_n( bb_max1+i*dim, dim, &bb[(2*i+1)*dim] );
+      }
+      std::ofstream file( boxes.name(), std::ios::binary );
+      file.write( reinterpret_cast<char const*>(bb.data()), std::streamsize(bb.size()*sizeof(real_type)) );
+    }
+    Utils::ThreadPool3 pool(4);
+    TF.build_out_of_core( boxes.name(), dim, ooc2.name(), 3000, &pool );
+    pool.join();
+
+    for ( integer i = 0; i < 500; ++i ) {
+      real_type p[2]  = { rand(0,10), rand(0,10) };
+      real_type bb[4] = { p[0], p[1], p[0]+rand(0,0.5), p[1]+rand(0,0.5) };
+      std::set<integer> A, B, C;
+      T1.intersect_with_one_bbox_and_refine( bb, A );
+      TO.intersect_with_one_bbox_and_refine( bb, B );
+      TF.intersect_with_one_bbox_and_refine( bb, C );
+      UTILS_ASSERT( A == B && A == C, "out of core tree, query {} differs\n", i );
+    }
+    AABBtree<real_type>::AABB_PAIRS P1, PO;
+    T1.intersect_pairs( T2, P1 );
+    TO.intersect_pairs( T2, PO );
+    UTILS_ASSERT0( P1 == PO, "out of core tree, tree-tree query differs\n" );
+
+    // the loaded tree can be updated as a tree built in memory
+    AABBtree<real_type> TL;
+    TL.load( ooc.name() );
+    TL.update( 2 );
+    std::set<integer> all;
+    for ( integer i = 0; i < TL.num_tree_nodes(); ++i ) TL.get_bbox_indexes_of_a_node( i, all );
+    UTILS_ASSERT0( integer(all.size()) == NS, "out of core tree, objects lost\n" );
+    real_type pq[2] = { 5, 5 };
+    std::set<integer> A, B;
+    T1.intersect_with_one_point_and_refine( pq, A );
+    TL.intersect_with_one_point_and_refine( pq, B );
+    UTILS_ASSERT0( A == B, "out of core tree, query after update differs\n" );
+
+    // a failing build leaves neither the chunks nor a partial tree
+    {
+      ScratchFile bad( "bad" );
+      std::remove( bad.name().c_str() );
+      integer ncall = 0;
+      AABBtree<real_type>::BOX_READER fail = [&]( real_type mi[], real_type ma[], integer nmax ) {
+        if ( ++ncall > 3 ) return nmax+1; // reader out of contract
+        std::copy_n( bb_min1, nmax*dim, mi );
+        std::copy_n( bb_max1, nmax*dim, ma );
+        return nmax;
+      };
+      AABBtree<real_type> TB;
+      bool failed = false;
+      try { TB.build_out_of_core( fail, dim, bad.name(), 500 ); } catch ( std::exception const & ) { failed = true; }
+      std::ifstream f0( bad.name() ), f1( bad.name() + ".chunk0" );
+      UTILS_ASSERT0( failed && !f0.good() && !f1.good(), "out of core build, files left after an error\n" );
+    }
+  }
+
+  // concurrent queries on the same tree
+  {
+    integer const NP = 2000;
+    integer const NT = 4;
+    std::vector<real_type> pnts(2*NP);
+    for ( auto & p : pnts ) p = rand(0,10);
+
+    std::vector<std::set<integer>> serial(NP), parallel(NP);
+    for ( integer i = 0; i < NP; ++i )
+      T1.intersect_with_one_point( &pnts[2*i], serial[i] );
+
+    std::vector<std::thread> threads;
+    tm.tic();
+    for ( integer t = 0; t < NT; ++t )
+      threads.emplace_back( [&,t]() {
+        Utils::AABBtree<real_type>::Workspace ws;
+        for ( integer i = t; i < NP; i += NT )
+          T1.intersect_with_one_point( &pnts[2*i], parallel[i], ws );
+      } );
+    for ( auto & th : threads ) th.join();
+    tm.toc();
+
+    for ( integer i = 0; i < NP; ++i )
+      UTILS_ASSERT( serial[i] == parallel[i], "concurrent query {} differs\n", i );
+    fmt::print("{} concurrent point queries on {} threads: {} ms\n", NP, NT, tm.elapsed_ms() );
+  }
+
+  // compact layout, refined queries must not change
+  {
+    Utils::AABBtree<real_type> TC( T1 );
+    TC.set_compact_layout( true );
+    integer const NP = 5000;
+    std::vector<real_type> pnts(2*NP);
+    for ( auto & p : pnts ) p = rand(0,10);
+    std::vector<std::set<integer>> a(NP), b(NP);
+    tm.tic();
+    for ( integer i = 0; i < NP; ++i ) T1.intersect_with_one_point_and_refine( &pnts[2*i], a[i] );
+    tm.toc();
+    real_type t1 = tm.elapsed_ms();
+    tm.tic();
+    for ( integer i = 0; i < NP; ++i ) TC.intersect_with_one_point_and_refine( &pnts[2*i], b[i] );
+    tm.toc();
+    for ( integer i = 0; i < NP; ++i )
+      UTILS_ASSERT( a[i] == b[i], "compact layout, query {} differs\n", i );
+    fmt::print("{} refined point queries: {} ms, compact layout {} ms\n", NP, t1, tm.elapsed_ms() );
+
+    // 4-wide layout, also bbox queries
+    TC.set_wide_layout( true );
+    for ( auto & bi : b ) bi.clear();
+    tm.tic();
+    for ( integer i = 0; i < NP; ++i ) TC.intersect_with_one_point_and_refine( &pnts[2*i], b[i] );
+    tm.toc();
+    for ( integer i = 0; i < NP; ++i )
+      UTILS_ASSERT( a[i] == b[i], "wide layout, query {} differs\n", i );
+    fmt::print("{} refined point queries, wide layout {} ms\n", NP, tm.elapsed_ms() );
+    for ( integer i = 0; i < NP; ++i ) {
+      real_type bb[4] = { pnts[2*i], pnts[2*i+1], pnts[2*i]+0.1, pnts[2*i+1]+0.1 };
+      std::set<integer> sa, sb;
+      T1.intersect_with_one_bbox_and_refine( bb, sa );
+      TC.intersect_with_one_bbox_and_refine( bb, sb );
+      UTILS_ASSERT( sa == sb, "wide layout, bbox query {} differs\n", i );
+    }
+
+    // quantized layout, then compressed trees
+    Utils::AABBtree<real_type> TQ( T1 ), TF( T1 ), TN( T1 );
+    TQ.set_quantized_layout( true );
+    TF.set_compact_layout( true );
+    TN.set_quantized_layout( true );
+    size_t mem_full = T1.memory_usage();
+    TF.compress();
+    TN.compress( false );
+    for ( auto & bi : b ) bi.clear();
+    tm.tic();
+    for ( integer i = 0; i < NP; ++i ) TQ.intersect_with_one_point_and_refine( &pnts[2*i], b[i] );
+    tm.toc();
+    fmt::print("{} refined point queries, quantized layout {} ms\n", NP, tm.elapsed_ms() );
+    for ( integer i = 0; i < NP; ++i ) {
+      UTILS_ASSERT( a[i] == b[i], "quantized layout, query {} differs\n", i );
+      real_type bb[4] = { pnts[2*i], pnts[2*i+1], pnts[2*i]+0.1, pnts[2*i+1]+0.1 };
+      std::set<integer> sa, sb, sf, sn;
+      T1.intersect_with_one_bbox_and_refine( bb, sa );
+      TQ.intersect_with_one_bbox_and_refine( bb, sb );
+      TF.intersect_with_one_bbox_and_refine( bb, sf );
+      UTILS_ASSERT( sa == sb && sa == sf, "quantized/compressed, bbox query {} differs\n", i );
+      // without object bboxes: candidates only, a superset of the refined result
+      TN.intersect_with_one_bbox( bb, sn );
+      UTILS_ASSERT(
+        std::includes( sn.begin(), sn.end(), sa.begin(), sa.end() ),
+        "compressed without object bboxes, bbox query {} lost candidates\n", i
+      );
+    }
+    fmt::print(
+      "memory: full {} bytes, compressed float {} bytes, compressed 16 bit without object bboxes {} bytes\n",
+      mem_full, TF.memory_usage(), TN.memory_usage()
+    );
+    bool refused = false;
+    try { TN.intersect_with_one_point_and_refine( pnts.data(), b[0] ); }
+    catch ( std::exception const & ) { refused = true; }
+    UTILS_ASSERT0( refused, "compressed tree without object bboxes, refined query accepted\n" );
+
+    // visitor and batch queries on the compressed trees
+    AABBtree<real_type>::Workspace ws;
+    std::vector<integer> offset, index;
+    TF.intersect_with_points( pnts.data(), 2, NP, offset, index, true );
+    for ( integer i = 0; i < NP; ++i ) {
+      std::set<integer> sv, sn;
+      TF.intersect_with_one_point_and_refine( &pnts[2*i], [&sv]( integer s ) { sv.insert(s); }, ws );
+      UTILS_ASSERT( sv == a[i], "compressed, visitor point query {} differs\n", i );
+      sn.insert( index.begin()+offset[i], index.begin()+offset[i+1] );
+      UTILS_ASSERT( sn == a[i], "compressed, batch point query {} differs\n", i );
+      sn.clear();
+      TN.intersect_with_one_point( &pnts[2*i], [&sn]( integer s ) { sn.insert(s); }, ws );
+      UTILS_ASSERT(
+        std::includes( sn.begin(), sn.end(), a[i].begin(), a[i].end() ),
+        "compressed without object bboxes, visitor point query {} lost candidates\n", i
+      );
+      integer nv = 0;
+      bool done = TN.intersect_with_one_point( &pnts[2*i], [&nv]( integer ) { return ++nv < 1; }, ws );
+      UTILS_ASSERT( done == sn.empty() && nv == (sn.empty() ? 0 : 1), "compressed, visitor point query {} not stopped\n", i );
+    }
+  }
+
+  // traversal statistics
+  {
+    AABBtree<real_type> TC( T1 ), TQ( T1 );
+    TC.set_compact_layout( true );
+    TQ.set_quantized_layout( true );
+    AABBtree<real_type>::Workspace ws;
+    ws.collect_stats = true;
+    for ( integer i = 0; i < 200; ++i ) {
+      real_type bb[4] = { rand(0,10), rand(0,10), 0, 0 };
+      bb[2] = bb[0]+rand(0,0.5); bb[3] = bb[1]+rand(0,0.5);
+      for ( AABBtree<real_type> const * T : { &T1, &TC, &TQ } ) {
+        std::set<integer>    A;
+        std::vector<integer> B;
+        T->intersect_with_one_bbox_and_refine( bb, A, ws );
+        auto const & st = ws.stats;
+        UTILS_ASSERT(
+          st.nodes + st.objects == ws.num_check && st.hits == integer(A.size()) && st.max_stack > 0,
+          "statistics of query {} inconsistent\n", i
+        );
+        T->intersect_with_one_bbox( bb, B, ws );
+        UTILS_ASSERT( st.hits == integer(B.size()) && st.objects == 0, "statistics of query {} inconsistent\n", i );
+      }
+    }
+    AABBtree<real_type>::AABB_PAIRS P;
+    T1.intersect_and_refine( T2, P, ws );
+    UTILS_ASSERT0( ws.stats.hits == integer(P.size()), "statistics of tree-tree query\n" );
+
+    // default workspace of this thread (shared by all the trees)
+    AABBtree<real_type>::collect_thread_stats( true );
+    std::set<integer> A;
+    real_type pq[2] = { 5, 5 };
+    T1.intersect_with_one_point_and_refine( pq, A );
+    UTILS_ASSERT0( AABBtree<real_type>::thread_query_stats().hits == integer(A.size()), "statistics of the thread workspace\n" );
+    AABBtree<real_type>::collect_thread_stats( false );
+
+    // batch: the aggregate does not depend on the threads
+    integer const NB = 2000;
+    std::vector<real_type> qmin(2*NB), qmax(2*NB);
+    for ( integer i = 0; i < 2*NB; ++i ) { qmin[i] = rand(0,10); qmax[i] = qmin[i] + rand(0,0.3); }
+    std::vector<integer> offset, index;
+    AABBtree<real_type>::BatchStats bs, bp;
+    T1.intersect_with_bboxes( qmin.data(), dim, qmax.data(), dim, NB, offset, index, true, nullptr, &bs );
+    Utils::ThreadPool3 pool(4);
+    T1.intersect_with_bboxes( qmin.data(), dim, qmax.data(), dim, NB, offset, index, true, &pool, &bp );
+    pool.join();
+    UTILS_ASSERT0(
+      bs.num_queries == NB && bs.total_hits == integer(index.size()) &&
+      bs.total_nodes == bp.total_nodes && bs.total_objects == bp.total_objects &&
+      bs.hist_nodes == bp.hist_nodes && bs.hist_stack == bp.hist_stack,
+      "batch statistics\n"
+    );
+    fmt::print( "refined bbox queries\n{}", bs.info() );
+  }
+
+  // objects move: refit and partial rebuild
+  {
+    Utils::AABBtree<real_type> TM( T1 ), TR;
+    std::vector<real_type> m_min( bb_min1, bb_min1+NS*dim ), m_max( bb_max1, bb_max1+NS*dim );
+    std::vector<real_type> pnts(2*1000);
+    for ( auto & p : pnts ) p = rand(0,10);
+    Utils::ThreadPool3 pool(4);
+    for ( integer step = 0; step < 4; ++step ) {
+      // small motion everywhere, large motion in a corner
+      for ( integer k = 0; k < NS; ++k ) {
+        real_type dx = rand(-0.02,0.02), dy = rand(-0.02,0.02);
+        if ( m_min[2*k] < 2 && m_min[2*k+1] < 2 ) { dx *= 50; dy *= 50; }
+        m_min[2*k] += dx; m_max[2*k] += dx;
+        m_min[2*k+1] += dy; m_max[2*k+1] += dy;
+        TM.replace_bbox( &m_min[2*k], &m_max[2*k], k );
+      }
+      tm.tic();
+      integer nr = TM.update( 1.5, &pool );
+      tm.toc();
+      fmt::print(
+        "step {}: update {} ms, subtrees rebuilt {}, SAH {:.4} (build {:.4})\n",
+        step, tm.elapsed_ms(), nr, TM.sah_cost(), TM.build_sah_cost()
+      );
+      TR.build( m_min.data(), dim, m_max.data(), dim, NS, dim );
+      for ( integer i = 0; i < 1000; ++i ) {
+        std::set<integer> a, b;
+        TM.intersect_with_one_point_and_refine( &pnts[2*i], a );
+        TR.intersect_with_one_point_and_refine( &pnts[2*i], b );
+        UTILS_ASSERT( a == b, "refit, step {} query {} differs\n", step, i );
+      }
+    }
+    pool.join();
+  }
+
+  // batched queries, compact (CSR) output
+  {
+    integer const NP = 5000;
+    std::vector<real_type> pnts(2*NP), bmin(2*NP), bmax(2*NP);
+    for ( auto & p : pnts ) p = rand(0,10);
+    for ( integer i = 0; i < 2*NP; ++i ) {
+      bmin[i] = pnts[i] - rand(0,0.2);
+      bmax[i] = pnts[i] + rand(0,0.2);
+    }
+
+    Utils::ThreadPool3 pool(4);
+    std::vector<integer> offset, index, offset1, index1;
+
+    for ( int refine = 0; refine < 2; ++refine ) {
+      tm.tic();
+      T1.intersect_with_points( pnts.data(), 2, NP, offset, index, refine != 0, &pool );
+      tm.toc();
+      fmt::print("batched {} points (refine={}): {} ms\n", NP, refine, tm.elapsed_ms() );
+      T1.intersect_with_points( pnts.data(), 2, NP, offset1, index1, refine != 0 );
+      UTILS_ASSERT0( offset == offset1 && index == index1, "batched point query, serial != parallel\n" );
+
+      tm.tic();
+      T1.intersect_with_bboxes( bmin.data(), 2, bmax.data(), 2, NP, offset1, index1, refine != 0, &pool );
+      tm.toc();
+      fmt::print("batched {} boxes  (refine={}): {} ms\n", NP, refine, tm.elapsed_ms() );
+
+      for ( integer i = 0; i < NP; ++i ) {
+        std::set<integer> S, B;
+        real_type bb[4] = { bmin[2*i], bmin[2*i+1], bmax[2*i], bmax[2*i+1] };
+        if ( refine ) {
+          T1.intersect_with_one_point_and_refine( &pnts[2*i], S );
+          T1.intersect_with_one_bbox_and_refine( bb, B );
+        } else {
+          T1.intersect_with_one_point( &pnts[2*i], S );
+          T1.intersect_with_one_bbox( bb, B );
+        }
+        std::set<integer> SS( index.begin()+offset[i], index.begin()+offset[i+1] );
+        std::set<integer> BB( index1.begin()+offset1[i], index1.begin()+offset1[i+1] );
+        UTILS_ASSERT( S == SS, "batched point query {} differs\n", i );
+        UTILS_ASSERT( B == BB, "batched bbox query {} differs\n", i );
+      }
+    }
+    pool.join();
+  }
+
+  // nearest objects, exact distance point-segment
+  {
+    auto seg_dist = [&S_set_1]( real_type const p[2], integer i ) -> real_type {
+      Segment2D<real_type> const & S = S_set_1[i];
+      Point2D<real_type> P, D;
+      P.coeffRef(0) = p[0];
+      P.coeffRef(1) = p[1];
+      D.noalias()   = S.Pb() - S.Pa();
+      real_type t   = D.dot(P-S.Pa())/D.squaredNorm();
+      if      ( t < 0 ) t = 0;
+      else if ( t > 1 ) t = 1;
+      return (S.Pa() + t*D - P).norm();
+    };
+
+    integer const NP = 200;
+    integer const K  = 5;
+    std::vector<std::pair<real_type,integer>> res, ref(NS);
+    integer num_check = 0;
+    tm.tic();
+    for ( integer i = 0; i < NP; ++i ) {
+      real_type p[2] = { rand(-1,11), rand(-1,11) };
+      AABBtree<real_type>::DISTANCE_FUN dist = [&]( integer j ) { return seg_dist( p, j ); };
+      AABBtree<real_type>::Workspace ws;
+      T1.k_nearest( p, K, dist, res, Utils::Inf<real_type>(), ws );
+      num_check += ws.num_check;
+
+      for ( integer j = 0; j < NS; ++j ) ref[j] = std::make_pair( seg_dist( p, j ), j );
+      std::partial_sort( ref.begin(), ref.begin()+K, ref.end() );
+      UTILS_ASSERT( integer(res.size()) == K, "k_nearest query {} found {} objects\n", i, res.size() );
+      for ( integer k = 0; k < K; ++k )
+        UTILS_ASSERT(
+          std::abs( res[k].first - ref[k].first ) < 1e-12,
+          "k_nearest query {} item {} distance {} expected {}\n",
+          i, k, res[k].first, ref[k].first
+        );
+
+      real_type d_min;
+      integer   id = T1.closest_object( p, dist, d_min );
+      UTILS_ASSERT( id >= 0 && d_min == res[0].first, "closest_object query {} failed\n", i );
+
+      // limited search radius
+      real_type radius = ref[2].first;
+      T1.k_nearest( p, K, dist, res, radius );
+      UTILS_ASSERT( res.size() >= 3 && res.back().first <= radius, "k_nearest query {} bad radius\n", i );
+    }
+    tm.toc();
+    fmt::print(
+      "{} nearest queries: {} ms, {} bbox checks per query\n",
+      NP, tm.elapsed_ms(), num_check/NP
+    );
+
+    real_type d_min;
+    real_type far[2] = { 100, 100 };
+    UTILS_ASSERT0( T1.closest_object( far, nullptr, d_min, 1 ) == -1, "closest_object out of radius\n" );
+
+    #ifndef UTILS_NO_DEBUG
+    // a distance below the one of the bbox breaks the search
+    bool refused = false;
+    try { T1.closest_object( far, []( integer ) { return real_type(0); }, d_min ); }
+    catch ( std::exception const & ) { refused = true; }
+    UTILS_ASSERT0( refused, "k_nearest accepted a distance below the bbox distance\n" );
+    #endif
+  }
+
+  // ray and segment casts
+  {
+    // exact hit of the ray o + t*d with the segment i
+    auto ray_seg = [&S_set_1]( real_type const o[2], real_type const d[2], integer i, real_type & t ) -> bool {
+      Segment2D<real_type> const & S = S_set_1[i];
+      real_type ex  = S.Pb().x() - S.Pa().x();
+      real_type ey  = S.Pb().y() - S.Pa().y();
+      real_type px  = S.Pa().x() - o[0];
+      real_type py  = S.Pa().y() - o[1];
+      real_type den = d[0]*ey - d[1]*ex;
+      if ( den == 0 ) return false;
+      real_type s = (px*d[1] - py*d[0])/den;
+      if ( s < 0 || s > 1 ) return false;
+      t = (px*ey - py*ex)/den;
+      return true;
+    };
+
+    integer const NR = 500;
+    integer num_check = 0, num_hit = 0;
+    tm.tic();
+    for ( integer i = 0; i < NR; ++i ) {
+      real_type o[2] = { rand(0,10), rand(0,10) };
+      real_type a    = rand(0,2*m_pi);
+      real_type d[2] = { cos(a), sin(a) };
+      if ( i == 0 ) { d[0] = 1; d[1] = 0; } // axis aligned ray
+      real_type t_max = rand(0.5,5);
+
+      AABBtree<real_type>::RAY_HIT_FUN hit = [&]( integer j, real_type & t ) { return ray_seg( o, d, j, t ); };
+      AABBtree<real_type>::Workspace ws;
+      real_type t_hit, t_any;
+      integer id = T1.ray_first_hit( o, d, 0, t_max, hit, t_hit, ws );
+      num_check += ws.num_check;
+
+      real_type t_ref = Utils::Inf<real_type>();
+      integer   n_ref = 0;
+      for ( integer j = 0; j < NS; ++j ) {
+        real_type t;
+        if ( ray_seg( o, d, j, t ) && t >= 0 && t <= t_max ) {
+          ++n_ref;
+          if ( t < t_ref ) t_ref = t;
+        }
+      }
+      if ( n_ref > 0 ) {
+        ++num_hit;
+        UTILS_ASSERT(
+          id >= 0 && std::abs( t_hit - t_ref ) < 1e-10,
+          "ray_first_hit query {} t = {} expected {}\n", i, t_hit, t_ref
+        );
+        UTILS_ASSERT( T1.ray_any_hit( o, d, 0, t_max, hit, t_any ) >= 0, "ray_any_hit query {} no hit\n", i );
+      } else {
+        UTILS_ASSERT( id == -1, "ray_first_hit query {} false hit\n", i );
+        UTILS_ASSERT( T1.ray_any_hit( o, d, 0, t_max, hit, t_any ) == -1, "ray_any_hit query {} false hit\n", i );
+      }
+
+      // the same query as a segment
+      real_type pb[2] = { o[0]+t_max*d[0], o[1]+t_max*d[1] };
+      AABBtree<real_type>::RAY_HIT_FUN shit = [&]( integer j, real_type & t ) {
+        bool ok = ray_seg( o, d, j, t );
+        t /= t_max;
+        return ok;
+      };
+      real_type s_hit;
+      integer sid = T1.segment_first_hit( o, pb, shit, s_hit );
+      UTILS_ASSERT( sid == id && ( id < 0 || std::abs( s_hit*t_max - t_hit ) < 1e-10 ), "segment_first_hit query {} differs\n", i );
+
+      // candidates must contain all the segments hit
+      std::set<integer> S;
+      T1.intersect_with_segment( o, pb, S );
+      for ( integer j = 0; j < NS; ++j ) {
+        real_type t;
+        if ( ray_seg( o, d, j, t ) && t >= 0 && t <= t_max )
+          UTILS_ASSERT( S.find(j) != S.end(), "intersect_with_segment query {} lost {}\n", i, j );
+      }
+    }
+    tm.toc();
+    fmt::print(
+      "{} ray casts ({} hit): {} ms, {} bbox checks per ray\n",
+      NR, num_hit, tm.elapsed_ms(), num_check/NR
+    );
+
+    // 3D boxes, hit of the bbox of the objects
+    integer const NB = 2000;
+    std::vector<real_type> bmin(3*NB), bmax(3*NB);
+    for ( integer i = 0; i < 3*NB; ++i ) {
+      bmin[i] = rand(0,10);
+      bmax[i] = bmin[i] + rand(0,0.5);
+    }
+    AABBtree<real_type> T3;
+    T3.build( bmin.data(), 3, bmax.data(), 3, NB, 3 );
+    for ( integer i = 0; i < NR; ++i ) {
+      real_type o[3] = { rand(-1,11), rand(-1,11), rand(-1,11) };
+      real_type d[3] = { rand(-1,1), rand(-1,1), rand(-1,1) };
+      if ( i % 10 == 0 ) d[i%3] = 0;
+      real_type t_ref = Utils::Inf<real_type>();
+      for ( integer j = 0; j < NB; ++j ) {
+        real_type t0 = 0, t1 = 20;
+        for ( integer k = 0; k < 3 && t0 <= t1; ++k ) {
+          if ( d[k] == 0 ) {
+            if ( o[k] < bmin[3*j+k] || o[k] > bmax[3*j+k] ) t0 = t1+1;
+            continue;
+          }
+          real_type a = (bmin[3*j+k]-o[k])/d[k];
+          real_type b = (bmax[3*j+k]-o[k])/d[k];
+          if ( a > b ) std::swap(a,b);
+          t0 = std::max(t0,a);
+          t1 = std::min(t1,b);
+        }
+        if ( t0 <= t1 && t0 < t_ref ) t_ref = t0;
+      }
+      real_type t_hit;
+      integer id = T3.ray_first_hit( o, d, 0, 20, nullptr, t_hit );
+      UTILS_ASSERT(
+        ( id < 0 && t_ref == Utils::Inf<real_type>() ) || std::abs( t_hit - t_ref ) < 1e-10,
+        "3D ray_first_hit query {} t = {} expected {}\n", i, t_hit, t_ref
+      );
+    }
+  }
 
   fmt::print("T1\n{}\n", T1.info() );
   fmt::print("T2\n{}\n", T2.info() );
@@ -187,3 +1110,15 @@ main() {
   fmt::print("\n\nAll done!\n");
   return 0;
 }
+
+int
+main() {
+  try {
+    return run();
+  } catch ( std::exception const & exc ) {
+    cout << "Error: " << exc.what() << '\n';
+  } catch ( ... ) {
+    cout << "Unknown error\n";
+  }
+  return 1;
+}
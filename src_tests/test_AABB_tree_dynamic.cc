@@ -0,0 +1,145 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2026                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+#include "Utils_AABB_tree_dynamic.hh"
+#include <random>
+#include <array>
+
+using namespace std;
+using integer   = int;
+using real_type = double;
+
+static std::mt19937 generator(3);
+
+static
+real_type
+rand( real_type xmin, real_type xmax ) {
+  real_type random = real_type(generator())/generator.max();
+  return xmin + (xmax-xmin)*random;
+}
+
+// brute force reference
+static
+void
+brute_force(
+  std::map<integer,std::array<real_type,4>> const & objs,
+  real_type const                                   pnt[2],
+  std::set<integer>                               & res
+) {
+  res.clear();
+  for ( auto const & o : objs ) {
+    auto const & b = o.second;
+    if ( pnt[0] >= b[0] && pnt[0] <= b[2] && pnt[1] >= b[1] && pnt[1] <= b[3] )
+      res.insert( o.first );
+  }
+}
+
+int
+main() {
+
+  Utils::TicToc tm;
+
+  Utils::AABBtreeDynamic<real_type> T( 2, 0.05 );
+
+  std::map<integer,std::array<real_type,4>> objs;   // id -> bbox
+  std::map<integer,integer>                 handle; // id -> handle
+
+  integer next_id = 0;
+  auto add = [&]() {
+    real_type x = rand(0,10), y = rand(0,10);
+    std::array<real_type,4> b{ x, y, x+rand(0,0.3), y+rand(0,0.3) };
+    objs[next_id]   = b;
+    handle[next_id] = T.insert( &b[0], &b[2], next_id );
+    ++next_id;
+  };
+
+  // initial population
+  tm.tic();
+  for ( integer i = 0; i < 5000; ++i ) add();
+  tm.toc();
+  T.validate();
+  fmt::print( "insert 5000 objects: {} ms, height {}\n", tm.elapsed_ms(), T.height() );
+
+  // simulation: objects move, are destroyed and spawned
+  std::vector<real_type> pnts(2*200);
+  integer n_reinsert = 0;
+  tm.tic();
+  for ( integer step = 0; step < 50; ++step ) {
+    for ( auto & o : objs ) {
+      auto & b = o.second;
+      real_type dx = rand(-0.01,0.01), dy = rand(-0.01,0.01);
+      b[0] += dx; b[2] += dx; b[1] += dy; b[3] += dy;
+      if ( T.move( handle[o.first], &b[0], &b[2] ) ) ++n_reinsert;
+    }
+    for ( integer k = 0; k < 50; ++k ) {
+      auto it = objs.begin();
+      std::advance( it, integer(rand(0,objs.size()-1)) );
+      T.remove( handle[it->first] );
+      handle.erase( it->first );
+      objs.erase( it );
+    }
+    for ( integer k = 0; k < 50; ++k ) add();
+  }
+  tm.toc();
+  T.validate();
+  fmt::print(
+    "50 steps: {} ms, reinserted {} of {} moves\n",
+    tm.elapsed_ms(), n_reinsert, 50*5000
+  );
+
+  // queries against brute force
+  for ( auto & p : pnts ) p = rand(0,10);
+  for ( integer i = 0; i < 200; ++i ) {
+    std::set<integer> a, b, c;
+    T.intersect_with_one_point_and_refine( &pnts[2*i], a );
+    T.intersect_with_one_point( &pnts[2*i], c );
+    brute_force( objs, &pnts[2*i], b );
+    UTILS_ASSERT( a == b, "AABBtreeDynamic query {} differs from brute force\n", i );
+    UTILS_ASSERT( std::includes( c.begin(), c.end(), a.begin(), a.end() ), "AABBtreeDynamic query {} lost candidates\n", i );
+  }
+
+  // statistics with an explicit workspace, a degenerate bbox is a point
+  Utils::AABBtreeDynamic<real_type>::Workspace ws;
+  ws.collect_stats = true;
+  for ( integer i = 0; i < 200; ++i ) {
+    std::set<integer> a, b;
+    real_type const * p = &pnts[2*i];
+    real_type bb[4] = { p[0], p[1], p[0], p[1] };
+    T.intersect_with_one_bbox_and_refine( bb, a, ws );
+    brute_force( objs, p, b );
+    UTILS_ASSERT( a == b, "AABBtreeDynamic bbox query {} differs from brute force\n", i );
+    UTILS_ASSERT(
+      ws.stats.hits == integer(a.size()) && ws.stats.nodes + ws.stats.objects == ws.num_check,
+      "AABBtreeDynamic statistics of query {} inconsistent\n", i
+    );
+  }
+
+  UTILS_ASSERT0( T.num_objects() == integer(objs.size()), "AABBtreeDynamic bad number of objects\n" );
+  UTILS_ASSERT( T.height() < 40, "AABBtreeDynamic unbalanced, height {}\n", T.height() );
+
+  fmt::print( "{}\n", T.info() );
+
+  // remove all
+  for ( auto & h : handle ) T.remove( h.second );
+  T.validate();
+  UTILS_ASSERT0( T.num_objects() == 0, "AABBtreeDynamic not empty\n" );
+
+  fmt::print("\n\nAll done!\n");
+  return 0;
+}
@@ -145,6 +145,8 @@ main( int argc, char *argv[] ) {
 
   test_TP<Utils::ThreadPool5>( NN, nt, sz, "ThreadPool5");
 
+  test_TP<Utils::ThreadPool6>( NN, nt, sz, "ThreadPool6");
+
   fmt::print("All done folks!\n\n");
 
   if ( zz > 0 ) {
@@ -0,0 +1,88 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2022                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+#include "Utils.hh"
+
+using std::cout;
+
+static std::atomic<unsigned> accumulator;
+
+static
+void
+do_job( unsigned mus ) {
+  Utils::sleep_for_microseconds( mus );
+  ++accumulator;
+}
+
+int
+main() {
+  Utils::TicToc tm;
+
+  // elastic pool: 1 to 8 workers, idle workers retire after 200ms
+  Utils::ThreadPool6 pool( 8, 1 );
+  pool.set_elastic( 1, 8, 200, 50 );
+
+  fmt::print( "start:  {} workers\n", pool.thread_count() );
+
+  // burst of work, the pool must grow
+  accumulator = 0;
+  tm.tic();
+  for ( int i = 0; i < 400; ++i ) pool.run( do_job, 500 );
+  pool.wait();
+  tm.toc();
+  fmt::print(
+    "burst:  {} workers, result {} [{:.4} ms]\n",
+    pool.thread_count(), accumulator.load(), tm.elapsed_ms()
+  );
+  UTILS_ASSERT0( accumulator == 400, "ThreadPool6 lost some job\n" );
+  UTILS_ASSERT0( pool.thread_count() > 1, "ThreadPool6 did not grow\n" );
+
+  // quiet period, the pool must shrink
+  Utils::sleep_for_milliseconds( 1000 );
+  fmt::print( "quiet:  {} workers\n", pool.thread_count() );
+  UTILS_ASSERT0( pool.thread_count() == 1, "ThreadPool6 did not shrink\n" );
+
+  // resize without draining the queue
+  accumulator = 0;
+  for ( int i = 0; i < 200; ++i ) pool.run( do_job, 200 );
+  pool.resize( 4 );
+  for ( int i = 0; i < 200; ++i ) pool.run( do_job, 200 );
+  pool.resize( 2 );
+  pool.wait();
+  fmt::print(
+    "resize: {} workers, result {}\n",
+    pool.thread_count(), accumulator.load()
+  );
+  UTILS_ASSERT0( accumulator == 400, "ThreadPool6 lost some job after resize\n" );
+  UTILS_ASSERT0( pool.thread_count() <= 2, "ThreadPool6 resize failed\n" );
+
+  pool.info( cout );
+
+  // runtime statistic, also of the retired workers
+  Utils::tp::Metrics m = pool.metrics();
+  fmt::print( "{}\n\n", m.to_json() );
+  UTILS_ASSERT0( m.n_job() == 800, "ThreadPool6 metrics lost some job\n" );
+  UTILS_ASSERT0( m.queue_high_water > 0, "ThreadPool6 queue high water not set\n" );
+
+  pool.join();
+
+  cout << "All done folks!\n\n";
+
+  return 0;
+}
@@ -0,0 +1,115 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2022                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+#include "Utils.hh"
+
+using std::cout;
+
+#ifdef UTILS_HAS_COROUTINES
+
+using Utils::coro::task;
+using Utils::coro::schedule_on;
+using Utils::coro::when_all;
+using Utils::coro::sync_wait;
+
+static
+task<long>
+partial_sum( Utils::ThreadPoolBase & pool, long i0, long i1 ) {
+  co_await schedule_on( pool ); // the rest run on a worker
+  long s = 0;
+  for ( long i = i0; i < i1; ++i ) s += i;
+  co_return s;
+}
+
+//
+// a "request handler": fan-out on the pool and fan-in with when_all,
+// no thread is blocked waiting for the partial results
+//
+static
+task<long>
+handler( Utils::ThreadPoolBase & pool, long n, long nchunk ) {
+  co_await schedule_on( pool );
+  std::vector<task<long>> parts;
+  for ( long k = 0; k < nchunk; ++k )
+    parts.emplace_back( partial_sum( pool, (k*n)/nchunk, ((k+1)*n)/nchunk ) );
+  std::vector<long> res = co_await when_all( std::move(parts) );
+  long s = 0;
+  for ( long r : res ) s += r;
+  co_return s;
+}
+
+static
+task<long>
+failing( Utils::ThreadPoolBase & pool ) {
+  co_await schedule_on( pool );
+  throw std::runtime_error("failing task");
+  co_return 0;
+}
+
+template <typename TP>
+static
+void
+test_coro( char const * name ) {
+  Utils::TicToc tm;
+  TP pool(4);
+
+  // many overlapping handlers on a small pool
+  long const n = 100000, nreq = 64;
+  std::vector<task<long>> reqs;
+  for ( long r = 0; r < nreq; ++r ) reqs.emplace_back( handler( pool, n, 16 ) );
+  tm.tic();
+  std::vector<long> res = sync_wait( when_all( std::move(reqs) ) );
+  tm.toc();
+  for ( long r : res )
+    UTILS_ASSERT( r == n*(n-1)/2, "{}: wrong result {}\n", name, r );
+
+  // exceptions are propagated to the awaiting coroutine
+  bool caught = false;
+  try {
+    sync_wait( failing( pool ) );
+  } catch ( std::runtime_error const & ) {
+    caught = true;
+  }
+  UTILS_ASSERT( caught, "{}: exception not propagated\n", name );
+
+  pool.join();
+  fmt::print( "[{}] {} requests [{:.4} ms]\n", name, nreq, tm.elapsed_ms() );
+}
+
+int
+main() {
+  test_coro<Utils::ThreadPool0>( "ThreadPool0" );
+  test_coro<Utils::ThreadPool2>( "ThreadPool2" );
+  test_coro<Utils::ThreadPool3>( "ThreadPool3" );
+  // ThreadPool4/5 block exec() called by a worker when busy: not usable here
+  test_coro<Utils::ThreadPool6>( "ThreadPool6" );
+  cout << "All done folks!\n\n";
+  return 0;
+}
+
+#else
+
+int
+main() {
+  cout << "C++20 coroutines not available, test skipped\n";
+  cout << "All done folks!\n\n";
+  return 0;
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*--------------------------------------------------------------------------*\
+ |                                                                          |
+ |  Copyright (C) 2022                                                      |
+ |                                                                          |
+ |         , __                 , __                                        |
+ |        /|/  \               /|/  \                                       |
+ |         | __/ _   ,_         | __/ _   ,_                                |
+ |         |   \|/  /  |  |   | |   \|/  /  |  |   |                        |
+ |         |(__/|__/   |_/ \_/|/|(__/|__/   |_/ \_/|/                       |
+ |                           /|                   /|                        |
+ |                           \|                   \|                        |
+ |                                                                          |
+ |      Enrico Bertolazzi                                                   |
+ |      Dipartimento di Ingegneria Industriale                              |
+ |      Universita` degli Studi di Trento                                   |
+ |      email: enrico.bertolazzi@unitn.it                                   |
+ |                                                                          |
+\*--------------------------------------------------------------------------*/
+
+#include "Utils.hh"
+
+using std::cout;
+
+static std::atomic<unsigned> accumulator;
+
+static
+void
+do_job( unsigned i ) {
+  Utils::sleep_for_microseconds( 100 );
+  if ( i == 13 ) throw std::runtime_error( "job 13 failed" );
+  ++accumulator;
+}
+
+template <class TP>
+static
+void
+test_TP( char const * name ) {
+  TP pool(4);
+
+  // exception rethrown by wait()
+  accumulator = 0;
+  for ( unsigned i = 0; i < 100; ++i ) pool.run( do_job, i );
+  bool caught = false;
+  try {
+    pool.wait();
+  } catch ( std::runtime_error const & e ) {
+    caught = true;
+    fmt::print( "[{}] wait() rethrow: {}\n", name, e.what() );
+  }
+  UTILS_ASSERT( caught, "{}: wait() did not rethrow\n", name );
+  UTILS_ASSERT( accumulator == 99, "{}: result {}\n", name, accumulator.load() );
+
+  // pool usable after the exception
+  accumulator = 0;
+  for ( unsigned i = 0; i < 10; ++i ) pool.run( do_job, 0 );
+  pool.wait();
+  UTILS_ASSERT( accumulator == 10, "{}: result {}\n", name, accumulator.load() );
+
+  // a failed group skip the jobs not yet started
+  {
+    Utils::TaskGroup group( pool );
+    accumulator = 0;
+    for ( unsigned i = 0; i < 1000; ++i ) group.run( do_job, i );
+    caught = false;
+    try {
+      group.wait();
+    } catch ( std::runtime_error const & ) {
+      caught = true;
+    }
+    UTILS_ASSERT( caught, "{}: TaskGroup::wait() did not rethrow\n", name );
+    fmt::print(
+      "[{}] group: {} done, {} skipped\n",
+      name, accumulator.load(), group.skipped()
+    );
+    UTILS_ASSERT(
+      accumulator + group.skipped() == 999,
+      "{}: lost some job in TaskGroup\n", name
+    );
+  }
+
+  pool.join();
+}
+
+int
+main() {
+  test_TP<Utils::ThreadPool0>( "ThreadPool0" );
+  test_TP<Utils::ThreadPool1>( "ThreadPool1" );
+  test_TP<Utils::ThreadPool2>( "ThreadPool2" );
+  test_TP<Utils::ThreadPool3>( "ThreadPool3" );
+  test_TP<Utils::ThreadPool4>( "ThreadPool4" );
+  test_TP<Utils::ThreadPool5>( "ThreadPool5" );
+  test_TP<Utils::ThreadPool6>( "ThreadPool6" );
+  cout << "All done folks!\n\n";
+  return 0;
+}